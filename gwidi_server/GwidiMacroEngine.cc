@@ -0,0 +1,207 @@
+#include "GwidiMacroEngine.h"
+#include "GwidiLogging.h"
+#include "GwidiMetrics.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace gwidi::server {
+
+MacroEngine::MacroEngine(SendInput *sendInput) : m_sendInput{sendInput} {
+    m_worker = std::thread([this] {
+        workerLoop();
+    });
+}
+
+MacroEngine::~MacroEngine() {
+    {
+        std::lock_guard<std::mutex> lock(m_runsMutex);
+        m_stop = true;
+    }
+    m_runsCv.notify_all();
+    m_worker.join();
+
+    // Never leave a key stuck down in whatever has focus
+    for(auto &run : m_runs) {
+        releaseHeld(run);
+    }
+}
+
+void MacroEngine::setMacros(const std::vector<gwidi::udpsocket::MacroDefinition> &macros) {
+    MacroTable table;
+    for(auto &macro : macros) {
+        if(macro.trigger < 0 || macro.trigger >= static_cast<int>(table.size())) {
+            spdlog::warn("Ignoring macro {} with out of range trigger: {}", macro.id, macro.trigger);
+            continue;
+        }
+        table[macro.trigger].emplace_back(std::make_shared<const gwidi::udpsocket::MacroDefinition>(macro));
+    }
+    m_macros.publish(std::move(table));
+}
+
+bool MacroEngine::onKey(int code, int value, bool hasFocus, const std::bitset<0x100> &pressed) {
+    if(value == 0) {
+        auto consumed = m_consumedPresses.test(code);
+        m_consumedPresses.reset(code);
+        return consumed;
+    }
+    if(value > 1) {
+        return m_consumedPresses.test(code);
+    }
+
+    auto consumed = false;
+    auto macros = m_macros.current();
+    for(auto &macro : macros->value[code]) {
+        if(!macro->enabled || (macro->focusOnly && !hasFocus)) {
+            continue;
+        }
+        auto modifiersHeld = std::all_of(macro->modifiers.begin(), macro->modifiers.end(), [&pressed](int modifier) {
+            return modifier >= 0 && modifier < static_cast<int>(pressed.size()) && pressed.test(modifier);
+        });
+        if(!modifiersHeld) {
+            continue;
+        }
+
+        SPDLOG_DEBUG("Macro {} triggered by key: {}", macro->id, code);
+        GWIDI_TRACE_EVENT(logging::TraceKind::INJECT, code, macro->id);
+        metrics::count(metrics::Counter::MACROS_FIRED);
+        consumed |= macro->consumeTrigger;
+
+        Run run{macro, 0, std::chrono::steady_clock::now(), {}, m_focusEpoch.load()};
+        if(macro->steps.empty()) {
+            continue;
+        }
+        if(macro->steps.front().delayMs > 0) {
+            run.deadline += std::chrono::milliseconds{macro->steps.front().delayMs};
+            schedule(std::move(run));
+        }
+        else if(runSteps(run)) {
+            schedule(std::move(run));
+        }
+    }
+
+    if(consumed) {
+        m_consumedPresses.set(code);
+    }
+    return consumed;
+}
+
+bool MacroEngine::runSteps(Run &run) {
+    auto sendInput = m_sendInput.load();
+    if(!sendInput) {
+        SPDLOG_DEBUG("Dropping macro {}, uinput is not set up yet", run.macro->id);
+        return false;
+    }
+
+    auto &steps = run.macro->steps;
+    while(run.nextStep < steps.size()) {
+        auto &step = steps[run.nextStep++];
+        if(step.code < 0 || step.code >= static_cast<int>(run.held.size())) {
+            continue;
+        }
+
+        switch(step.action) {
+            case gwidi::udpsocket::MacroAction::MACRO_TAP: {
+                sendInput->tapKey(step.code);
+                break;
+            }
+            case gwidi::udpsocket::MacroAction::MACRO_PRESS: {
+                sendInput->sendKey(step.code, 1);
+                run.held.set(step.code);
+                break;
+            }
+            case gwidi::udpsocket::MacroAction::MACRO_RELEASE: {
+                sendInput->sendKey(step.code, 0);
+                run.held.reset(step.code);
+                break;
+            }
+        }
+
+        if(run.nextStep < steps.size() && steps[run.nextStep].delayMs > 0) {
+            run.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds{steps[run.nextStep].delayMs};
+            return true;
+        }
+    }
+    return false;
+}
+
+void MacroEngine::schedule(Run run) {
+    {
+        std::lock_guard<std::mutex> lock(m_runsMutex);
+        m_runs.emplace_back(std::move(run));
+    }
+    m_runsCv.notify_all();
+}
+
+void MacroEngine::releaseHeld(Run &run) {
+    // Nothing can be held without a device
+    auto sendInput = m_sendInput.load();
+    if(!sendInput) {
+        return;
+    }
+    for(auto code = 0; code < static_cast<int>(run.held.size()); code++) {
+        if(run.held.test(code)) {
+            sendInput->sendKey(code, 0);
+        }
+    }
+    run.held.reset();
+}
+
+void MacroEngine::onFocusLost() {
+    m_focusEpoch.fetch_add(1);
+
+    std::lock_guard<std::mutex> lock(m_runsMutex);
+    auto it = std::partition(m_runs.begin(), m_runs.end(), [](const Run& run) { return !run.macro->focusOnly; });
+    for(auto cancelled = it; cancelled != m_runs.end(); cancelled++) {
+        releaseHeld(*cancelled);
+    }
+    m_runs.erase(it, m_runs.end());
+}
+
+std::size_t MacroEngine::pendingCount() {
+    std::lock_guard<std::mutex> lock(m_runsMutex);
+    return m_runs.size();
+}
+
+void MacroEngine::workerLoop() {
+    std::vector<Run> due;
+    std::unique_lock<std::mutex> lock(m_runsMutex);
+    while(!m_stop) {
+        if(m_runs.empty()) {
+            m_runsCv.wait(lock, [this] { return m_stop || !m_runs.empty(); });
+            continue;
+        }
+
+        auto next = std::min_element(m_runs.begin(), m_runs.end(), [](const Run& a, const Run& b) {
+            return a.deadline < b.deadline;
+        })->deadline;
+        if(m_runsCv.wait_until(lock, next, [this, next] {
+            return m_stop || std::any_of(m_runs.begin(), m_runs.end(), [next](const Run& run) { return run.deadline < next; });
+        })) {
+            // Stopping, or something earlier was scheduled meanwhile
+            continue;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto it = std::partition(m_runs.begin(), m_runs.end(), [now](const Run& run) { return run.deadline > now; });
+        std::move(it, m_runs.end(), std::back_inserter(due));
+        m_runs.erase(it, m_runs.end());
+
+        // Inject without holding the lock, the reader thread may be scheduling more runs
+        lock.unlock();
+        for(auto &run : due) {
+            // Focus was lost after we took the run, it must not type into whatever has focus now
+            if(run.macro->focusOnly && run.focusEpoch != m_focusEpoch.load()) {
+                releaseHeld(run);
+                continue;
+            }
+            if(runSteps(run)) {
+                schedule(std::move(run));
+            }
+        }
+        due.clear();
+        lock.lock();
+    }
+}
+
+}
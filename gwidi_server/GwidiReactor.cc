@@ -0,0 +1,123 @@
+#include "GwidiReactor.h"
+
+#include <spdlog/spdlog.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+
+namespace gwidi::server {
+
+Reactor::Reactor() {
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    m_controlFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;  // the control fd is the only registration without a handler
+    if(m_epollFd < 0 || m_controlFd < 0 || epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_controlFd, &ev) != 0) {
+        spdlog::error("Failed to set up the epoll reactor");
+    }
+}
+
+Reactor::~Reactor() {
+    if(m_controlFd >= 0) {
+        close(m_controlFd);
+    }
+    if(m_epollFd >= 0) {
+        close(m_epollFd);
+    }
+}
+
+bool Reactor::add(int fd, Handler handler, uint32_t events) {
+    auto registration = std::make_unique<Registration>(Registration{fd, std::move(handler)});
+
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.ptr = registration.get();
+    if(epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        spdlog::warn("Failed to add fd {} to the reactor, errno: {}", fd, errno);
+        return false;
+    }
+    m_registrations[fd] = std::move(registration);
+    return true;
+}
+
+void Reactor::remove(int fd) {
+    auto it = m_registrations.find(fd);
+    if(it == m_registrations.end()) {
+        return;
+    }
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    it->second->removed = true;
+    m_retired.emplace_back(std::move(it->second));
+    m_registrations.erase(it);
+}
+
+void Reactor::run() {
+    if(m_epollFd < 0) {
+        return;
+    }
+
+    m_running.store(true);
+
+    epoll_event events[32];
+    while(!m_stopRequested.load()) {
+        auto count = epoll_wait(m_epollFd, events, 32, -1);
+        if(count < 0 && errno != EINTR) {
+            spdlog::error("epoll_wait failed, errno: {}", errno);
+            break;
+        }
+
+        for(auto i = 0; i < count; i++) {
+            auto registration = static_cast<Registration*>(events[i].data.ptr);
+            if(registration == nullptr) {
+                drainControl();
+                continue;
+            }
+
+            if(!registration->removed) {
+                registration->handler(events[i].events);
+            }
+        }
+        m_retired.clear();
+    }
+
+    m_running.store(false);
+}
+
+void Reactor::drainControl() {
+    uint64_t value;
+    while(read(m_controlFd, &value, sizeof(value)) == sizeof(value)) {}
+
+    std::vector<Task> tasks;
+    {
+        std::lock_guard<std::mutex> lock(m_tasksMutex);
+        tasks.swap(m_tasks);
+    }
+    for(auto &task : tasks) {
+        task();
+    }
+}
+
+void Reactor::stop() {
+    m_stopRequested.store(true);
+    uint64_t one = 1;
+    write(m_controlFd, &one, sizeof(one));
+}
+
+std::size_t Reactor::pendingTasks() {
+    std::lock_guard<std::mutex> lock(m_tasksMutex);
+    return m_tasks.size();
+}
+
+void Reactor::post(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(m_tasksMutex);
+        m_tasks.emplace_back(std::move(task));
+    }
+    uint64_t one = 1;
+    write(m_controlFd, &one, sizeof(one));
+}
+
+}
@@ -1,66 +1,644 @@
 #include "GwidiServer.h"
+#include "GwidiLogging.h"
+#include "GwidiProbes.h"
 
+#include <algorithm>
+#include <future>
 #include <utility>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 namespace gwidi::server {
 
+namespace {
+
+// The default profile first, then the named ones
+std::vector<gwidi::udpsocket::Profile> profileTable(const Configuration &cfg) {
+    std::vector<gwidi::udpsocket::Profile> table;
+    table.push_back({gwidi::udpsocket::DEFAULT_PROFILE, cfg.watchedWindowName, cfg.watchedWindowClass, cfg.watchedKeys});
+    table.insert(table.end(), cfg.profiles.begin(), cfg.profiles.end());
+    return table;
+}
+
+std::vector<gwidi::input::WindowMatch> windowMatches(const Configuration &cfg) {
+    std::vector<gwidi::input::WindowMatch> matches;
+    for(auto &profile : profileTable(cfg)) {
+        matches.push_back({profile.windowName, profile.windowClass});
+    }
+    return matches;
+}
+
+bool sameMatches(const std::vector<gwidi::input::WindowMatch> &a, const std::vector<gwidi::input::WindowMatch> &b) {
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](auto &x, auto &y) {
+        return x.name == y.name && x.wmClass == y.wmClass;
+    });
+}
+
+}
+
 GwidiServer::GwidiServer(Configuration cfg) : m_configuration{std::move(cfg)} {
 }
 
+GwidiServer::GwidiServer(Configuration cfg, std::unique_ptr<gwidi::input::FocusSource> focusSource)
+    : m_focusDetector{std::move(focusSource)}, m_configuration{std::move(cfg)} {
+}
+
 GwidiServer::~GwidiServer() {
     stop();
 }
 
 void GwidiServer::start() {
-    m_socketServer = std::make_unique<gwidi::udpsocket::ReaderSocketServer>();
-    m_socketServer->setEventCb([this](gwidi::udpsocket::ServerEventType type, gwidi::udpsocket::ServerEvent event){
-        if(type == udpsocket::ServerEventType::EVENT_WATCHEDKEYS_RECONFIGURE) {
-            std::vector<int> watchedKeys;
-            for(auto i = 0; i < event.watchedKeysReconfigEvent.watchedKeysSize; i++) {
-                int key = event.watchedKeysReconfigEvent.watchedKeysList[i];
-                watchedKeys.emplace_back(key);
+    m_startupTrace = std::make_unique<StartupTrace>();
+    auto snapshot = m_configuration.current();
+    auto &cfg = snapshot->value;
+
+    // Setting up uinput sleeps for a second and the X11 detector walks the whole window tree, nothing on the key path
+    // needs either so they run alongside the socket and device setup
+    auto sendInput = std::async(std::launch::async, [this, nullSink = cfg.nullSendInput] {
+        return m_startupTrace->measure("uinput", [nullSink] {
+            return nullSink ? SendInput::nullSink() : std::make_unique<SendInput>();
+        });
+    });
+    auto focusSource = std::move(m_focusDetector);
+    std::future<std::unique_ptr<gwidi::input::FocusSource>> focusDetector;
+    if(!focusSource) {
+        focusDetector = std::async(std::launch::async, [this] {
+            return m_startupTrace->measure("focus_source", [] {
+                return std::unique_ptr<gwidi::input::FocusSource>{std::make_unique<gwidi::input::InputFocusDetector>()};
+            });
+        });
+    }
+
+    m_socketServer = std::make_unique<gwidi::udpsocket::ReaderSocketServer>(nullptr, cfg.listen);
+    m_inputReader = std::make_unique<gwidi::input::LinuxInputReader>();
+    m_macroEngine = std::make_unique<MacroEngine>();
+    wireCallbacks();
+    applyConfiguration(cfg);
+
+    m_startupTrace->measure("socket", [this] {
+        m_socketServer->openSocket();
+    });
+    m_inputReader->setExclusiveGrab(cfg.exclusiveGrab);
+    m_discoveryCachePath = cfg.discoveryCachePath;
+    if(auto cache = m_discoveryCachePath.empty() ? std::nullopt : gwidi::input::DiscoveryCache::load(m_discoveryCachePath)) {
+        m_discoveryCache = std::move(*cache);
+    }
+    if(!m_discoveryCache.devices.empty()) {
+        // Nothing that was cached is still there as it was, fall back to a full scan
+        m_warmStart = !m_startupTrace->measure("input_devices_warm", [this] {
+            return m_inputReader->openInputDevices(m_discoveryCache.devices).empty();
+        });
+    }
+    if(!m_warmStart) {
+        m_startupTrace->measure("input_devices", [this] {
+            m_inputReader->openInputDevices();
+        });
+    }
+
+    if(!cfg.metricsSocketPath.empty()) {
+        // Its own thread in either mode, a slow scraper must not hold up the reactor
+        m_metricsExporter = std::make_unique<gwidi::metrics::PrometheusExporter>(cfg.metricsSocketPath);
+        m_metricsExporter->beginListening();
+    }
+
+    if(cfg.threadingMode == ThreadingMode::Reactor) {
+        startReactor();
+    }
+    else {
+        m_socketServer->beginListening();
+
+        // Gated readers start out idle, the focus detector's initial gain (if we are already focused) resumes them
+        m_inputReader->setPaused(cfg.focusGating);
+        m_inputReader->beginListening(*m_keyPipeline);
+    }
+
+    m_startupTrace->mark("ready");
+    if(cfg.readyCb) {
+        cfg.readyCb();
+    }
+
+    if(!focusSource) {
+        focusSource = focusDetector.get();
+    }
+    if(m_reactor) {
+        // Everything the detector touches belongs to the loop now
+        auto holder = std::make_shared<std::unique_ptr<gwidi::input::FocusSource>>(std::move(focusSource));
+        m_reactor->post([this, holder]() {
+            attachFocusSource(std::move(*holder));
+        });
+    }
+    else {
+        attachFocusSource(std::move(focusSource));
+    }
+
+    auto uinput = sendInput.get();
+    m_macroEngine->setSendInput(uinput.get());
+    m_socketServer->setSendInput(std::move(uinput));
+
+    m_startupTrace->mark("done");
+    m_startupTrace->publish();
+
+    if(!m_discoveryCachePath.empty()) {
+        m_discoveryThread = std::thread([this] {
+            confirmDiscovery();
+        });
+    }
+}
+
+void GwidiServer::confirmDiscovery() {
+    // After a cold start this only finds what was plugged in during startup, it is what gets the cache written
+    auto devices = m_startupTrace->measure("confirm_scan", [this] {
+        return m_inputReader->confirmInputDevices();
+    });
+
+    std::lock_guard<std::mutex> lock(m_discoveryMutex);
+    spdlog::info("Background scan found {} input devices, {} were cached", devices.size(), m_discoveryCache.devices.size());
+    m_discoveryCache.devices = std::move(devices);
+    m_discoveryCache.save(m_discoveryCachePath);
+}
+
+void GwidiServer::onWindowMatched(int profile, const gwidi::input::WindowHint &hint) {
+    if(profile != 0 || m_discoveryCachePath.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_discoveryMutex);
+    if(m_discoveryCache.window && m_discoveryCache.window->pid == hint.pid && m_discoveryCache.window->wmClass == hint.wmClass) {
+        return;
+    }
+    m_discoveryCache.window = hint;
+    m_discoveryCache.save(m_discoveryCachePath);
+}
+
+void GwidiServer::attachFocusSource(std::unique_ptr<gwidi::input::FocusSource> focusSource) {
+    focusSource->setGainFocusCb([this]() {
+        onFocusChanged(true);
+    });
+    focusSource->setLoseFocusCb([this]() {
+        onFocusChanged(false);
+    });
+    focusSource->setFocusedProfileCb([this](int profile) {
+        onProfileFocused(profile);
+    });
+    focusSource->setWindowMatchedCb([this](int profile, const gwidi::input::WindowHint &hint) {
+        onWindowMatched(profile, hint);
+    });
+    {
+        std::lock_guard<std::mutex> lock(m_discoveryMutex);
+        if(m_discoveryCache.window) {
+            focusSource->setWindowHint(*m_discoveryCache.window);
+        }
+    }
+
+    {
+        // Reconfigures that arrived before the source did only updated the snapshot
+        std::lock_guard<std::mutex> lock(m_focusDetectorMutex);
+        m_focusDetector = std::move(focusSource);
+        m_focusDetector->setSelectedWindows(windowMatches(m_configuration.current()->value));
+    }
+
+    if(!m_reactor) {
+        m_focusDetector->beginListening();
+        return;
+    }
+
+    auto focusFd = m_focusDetector->attach();
+    if(focusFd >= 0) {
+        m_reactor->add(focusFd, [this](uint32_t) {
+            m_focusDetector->dispatch();
+        });
+    }
+}
+
+void GwidiServer::startReactor() {
+    m_reactor = std::make_unique<Reactor>();
+
+    // start() opened the sockets and the devices already. Listener shards are all served from the loop thread here.
+    for(auto sockfd : m_socketServer->sockets()) {
+        m_reactor->add(sockfd, [this, sockfd](uint32_t) {
+            m_socketServer->handleReadable(sockfd);
+        });
+    }
+    if(m_socketServer->retransmitFd() >= 0) {
+        m_reactor->add(m_socketServer->retransmitFd(), [this](uint32_t) {
+            m_socketServer->handleRetransmit();
+        });
+    }
+    if(m_socketServer->heartbeatFd() >= 0) {
+        m_reactor->add(m_socketServer->heartbeatFd(), [this](uint32_t) {
+            m_socketServer->handleHeartbeat();
+        });
+    }
+    // Devices the background scan finds are read from the loop like the others
+    if(m_inputReader->discoveredFd() >= 0) {
+        m_reactor->add(m_inputReader->discoveredFd(), [this](uint32_t) {
+            for(auto fd : m_inputReader->adoptDiscoveredDevices()) {
+                if(m_inputReader->isGrabbed(fd) || m_inputDevicesRegistered) {
+                    addInputDevice(fd);
+                }
             }
-            m_inputReader->setWatchedKeys(watchedKeys);
+        });
+    }
+    // The control lane shares the loop thread with the key lane, so it steps aside whenever a key datagram is waiting
+    if(m_socketServer->controlFd() >= 0) {
+        m_reactor->add(m_socketServer->controlFd(), [this](uint32_t) {
+            m_socketServer->handleControl(true);
+        });
+    }
+
+    // Axis values held back by rate limiting go out when this fires, see armAxisTimer()
+    m_axisTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(m_axisTimerFd >= 0) {
+        m_reactor->add(m_axisTimerFd, [this](uint32_t) {
+            uint64_t expirations;
+            while(read(m_axisTimerFd, &expirations, sizeof(expirations)) == sizeof(expirations)) {}
+            m_axisTimerDeadline.reset();
+            m_inputReader->flushAxes();
+            armAxisTimer();
+        });
+    }
 
-            delete[] event.watchedKeysReconfigEvent.watchedKeysList;    // free the list we were sent
+    // Grabbed keyboards stay registered for good, they pass everything through while unregistered ones would be idle
+    for(auto &pfd : m_inputReader->inputDevices()) {
+        if(m_inputReader->isGrabbed(pfd.fd)) {
+            addInputDevice(pfd.fd);
         }
+    }
+    setInputPaused(m_configuration.current()->value.focusGating);
+
+    m_reactorGaugeId = gwidi::metrics::Metrics::instance().registerGauge(
+            "gwidi_reactor_pending_tasks", "Tasks posted to the reactor that have not run yet",
+            [this]() { return m_reactor->pendingTasks(); });
+
+    m_reactorAlive.store(true);
+    m_reactorThread = std::thread([this] {
+        m_reactor->run();
+
+        if(m_focusDetector) {
+            m_focusDetector->stopListening();
+        }
+        m_inputReader->closeInputDevices();
+        m_socketServer->closeSocket();
+        if(m_axisTimerFd >= 0) {
+            close(m_axisTimerFd);
+            m_axisTimerFd = -1;
+        }
+        m_reactorAlive.store(false);
     });
-    m_socketServer->beginListening();
+}
 
-    m_inputReader = std::make_unique<gwidi::input::LinuxInputReader>();
-    m_inputReader->setWatchedKeyCb(m_configuration.watchedKeyCb);
-    m_inputReader->setWatchedKeys(m_configuration.watchedKeys);
-    m_inputReader->beginListening();
+void GwidiServer::setInputPaused(bool paused) {
+    if(m_reactor) {
+        // Only ever called on the reactor thread (or before it runs), where registrations can be changed directly.
+        // The reader still has to know for the grabbed keyboards it keeps serving.
+        m_inputReader->setPaused(paused);
+        setInputDevicesRegistered(!paused);
+    }
+    else {
+        m_inputReader->setPaused(paused);
+    }
+}
+
+void GwidiServer::setInputDevicesRegistered(bool registered) {
+    if(registered == m_inputDevicesRegistered) {
+        return;
+    }
+    m_inputDevicesRegistered = registered;
+
+    // Unregistered devices are not polled at all, whatever queued up meanwhile is dropped when they come back
+    if(registered) {
+        m_inputReader->drainInputDevices();
+    }
+    for(auto &pfd : m_inputReader->inputDevices()) {
+        if(m_inputReader->isGrabbed(pfd.fd)) {
+            continue;
+        }
+        if(registered) {
+            addInputDevice(pfd.fd);
+        }
+        else {
+            m_reactor->remove(pfd.fd);
+        }
+    }
+}
+
+void GwidiServer::addInputDevice(int fd) {
+    m_reactor->add(fd, [this, fd](uint32_t) {
+        m_inputReader->handleReadable(fd, *m_keyPipeline);
+        armAxisTimer();
+    });
+}
+
+void GwidiServer::armAxisTimer() {
+    // Runs after every device read, only touch the timer when the earliest deadline actually moved
+    auto deadline = m_inputReader->nextAxisDeadline();
+    if(m_axisTimerFd < 0 || deadline == m_axisTimerDeadline) {
+        return;
+    }
+    m_axisTimerDeadline = deadline;
 
-    m_focusDetector = std::make_unique<gwidi::input::InputFocusDetector>();
-    m_focusDetector->setSelectedWindowName(m_configuration.watchedWindowName);
-    m_focusDetector->setGainFocusCb(m_configuration.gainFocusCb);
-    m_focusDetector->setLoseFocusCb(m_configuration.loseFocusCb);
-    m_focusDetector->beginListening();
+    // steady_clock is CLOCK_MONOTONIC on Linux, so deadlines can be handed to the timerfd as-is
+    itimerspec spec{};
+    if(deadline) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline->time_since_epoch()).count();
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+        if(spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+            spec.it_value.tv_nsec = 1;  // an all-zero value would disarm the timer
+        }
+    }
+    timerfd_settime(m_axisTimerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
 }
 
 void GwidiServer::stop() {
-    m_socketServer->stopListening();
-    m_inputReader->stopListening();
-    m_focusDetector->stopListening();
+    if(m_discoveryThread.joinable()) {
+        m_discoveryThread.join();
+    }
+    if(m_reactor) {
+        m_reactor->stop();
+        if(m_reactorThread.joinable() && m_reactorThread.get_id() != std::this_thread::get_id()) {
+            m_reactorThread.join();
+        }
+    }
+    if(m_reactorGaugeId >= 0) {
+        gwidi::metrics::Metrics::instance().unregisterGauge(m_reactorGaugeId);
+        m_reactorGaugeId = -1;
+    }
+    if(m_metricsExporter) {
+        m_metricsExporter->stopListening();
+    }
+
+    if(m_socketServer) {
+        m_socketServer->stopListening();
+    }
+    if(m_inputReader) {
+        m_inputReader->stopListening();
+    }
+    if(m_focusDetector) {
+        m_focusDetector->stopListening();
+    }
 }
 
 void GwidiServer::setConfiguration(Configuration cfg) {
-    m_configuration = std::move(cfg);
+    std::lock_guard<std::mutex> lock(m_reconfigureMutex);
+    auto previous = m_configuration.current();
+    applyConfiguration(m_configuration.publish(std::move(cfg))->value, &previous->value);
+}
 
-    if(m_inputReader) {
-        m_inputReader->setWatchedKeyCb(m_configuration.watchedKeyCb);
-        m_inputReader->setWatchedKeys(m_configuration.watchedKeys);
+std::uint64_t GwidiServer::reconfigure(const gwidi::udpsocket::ReconfigureRequest &request) {
+    std::lock_guard<std::mutex> lock(m_reconfigureMutex);
+    auto previous = m_configuration.current();
+    auto snapshot = m_configuration.update([&request](Configuration &cfg) {
+        if(request.watchedKeys) {
+            cfg.watchedKeys = *request.watchedKeys;
+        }
+        if(request.windowName) {
+            cfg.watchedWindowName = *request.windowName;
+        }
+        if(request.windowClass) {
+            cfg.watchedWindowClass = *request.windowClass;
+        }
+        if(request.forwardingMode) {
+            cfg.focusGating = *request.forwardingMode == gwidi::udpsocket::ForwardingMode::FORWARD_FOCUS_GATED;
+        }
+        if(request.axes) {
+            cfg.axes = *request.axes;
+        }
+        if(request.profiles) {
+            cfg.profiles = *request.profiles;
+        }
+        if(request.repeats) {
+            cfg.repeats = *request.repeats;
+        }
+
+        for(auto &macro : request.setMacros) {
+            auto it = std::find_if(cfg.macros.begin(), cfg.macros.end(), [&macro](auto &m) { return m.id == macro.id; });
+            if(it != cfg.macros.end()) {
+                *it = macro;
+            }
+            else {
+                cfg.macros.emplace_back(macro);
+            }
+        }
+        for(auto id : request.removeMacros) {
+            cfg.macros.erase(std::remove_if(cfg.macros.begin(), cfg.macros.end(), [id](auto &m) { return m.id == id; }), cfg.macros.end());
+        }
+        for(auto &[id, enabled] : request.enableMacros) {
+            for(auto &macro : cfg.macros) {
+                if(macro.id == id) {
+                    macro.enabled = enabled;
+                }
+            }
+        }
+    });
+    // Remote reconfigures arrive at whatever rate the network delivers them, the ack carries the version anyway
+    SPDLOG_DEBUG("Reconfigured to version {}", snapshot->version);
+
+    applyConfiguration(snapshot->value, &previous->value);
+    return snapshot->version;
+}
+
+void GwidiServer::setFocusSource(std::unique_ptr<gwidi::input::FocusSource> focusSource) {
+    m_focusDetector = std::move(focusSource);
+}
+
+void GwidiServer::wireCallbacks() {
+    // Callbacks only ever read the current configuration snapshot, so they are set once and never swapped
+    m_socketServer->setReconfigureCb([this](const gwidi::udpsocket::ReconfigureRequest &request) {
+        return reconfigure(request);
+    });
+    m_socketServer->setKeyStateCb([this](int profile) {
+        return keyStateSnapshot(profile);
+    });
+    m_keyPipeline = std::make_unique<ServerKeyPipeline>(
+            FocusGateStage{&m_configuration, &m_hasFocus},
+            MacroStage{m_macroEngine.get(), m_inputReader.get(), &m_hasFocus},
+            ProfileFilterStage{&m_profileFilters, &m_activeProfile},
+            FirstKeyStage{m_startupTrace.get(), &m_firstKeyForwarded, &m_warmStart},
+            ClientStage{&m_configuration, m_socketServer.get(), m_inputReader.get(), &m_activeProfile},
+            WatchedKeyCbStage{&m_configuration});
+    m_inputReader->setAxisCb([this](const std::vector<gwidi::udpsocket::AxisEvent> &events) {
+        onAxes(events);
+    });
+}
+
+void GwidiServer::applyConfiguration(const Configuration &cfg, const Configuration *previous) {
+    // Reconfigures come from the network and usually touch one field, every store left alone keeps its snapshot
+    auto profilesChanged = !previous || cfg.watchedKeys != previous->watchedKeys || cfg.profiles != previous->profiles;
+    auto macrosChanged = !previous || cfg.macros != previous->macros;
+
+    auto profiles = profileTable(cfg);
+    if(profilesChanged) {
+        std::vector<gwidi::input::KeyFilter> filters;
+        std::vector<std::string> profileNames;
+        for(auto &profile : profiles) {
+            filters.emplace_back(gwidi::input::KeyFilter::of(profile.watchedKeys));
+            profileNames.emplace_back(profile.name);
+        }
+        m_profileFilters.publish(std::move(filters));
+        if(m_socketServer) {
+            m_socketServer->setProfiles(std::move(profileNames));
+        }
+    }
+
+    if(m_socketServer) {
+        m_socketServer->setReliableKeyEvents(cfg.reliableKeyEvents);
+    }
+
+    if(m_inputReader && (profilesChanged || macrosChanged)) {
+        // One reader for every profile. An empty list already reads everything, otherwise macro triggers have to be
+        // read as well.
+        std::vector<int> readKeys;
+        auto readAll = std::any_of(profiles.begin(), profiles.end(), [](auto &profile) { return profile.watchedKeys.empty(); });
+        if(!readAll) {
+            for(auto &profile : profiles) {
+                readKeys.insert(readKeys.end(), profile.watchedKeys.begin(), profile.watchedKeys.end());
+            }
+            for(auto &macro : cfg.macros) {
+                readKeys.emplace_back(macro.trigger);
+            }
+        }
+        m_inputReader->setWatchedKeys(readKeys);
+    }
+    if(m_inputReader && (!previous || cfg.repeats != previous->repeats)) {
+        m_inputReader->setRepeats(cfg.repeats);
+    }
+    if(m_inputReader && (!previous || !(cfg.axes == previous->axes))) {
+        m_inputReader->setAxes(cfg.axes);
+    }
+    if(m_macroEngine && macrosChanged) {
+        m_macroEngine->setMacros(cfg.macros);
     }
 
+    std::unique_lock<std::mutex> focusLock(m_focusDetectorMutex);
     if(m_focusDetector) {
-        m_focusDetector->setSelectedWindowName(m_configuration.watchedWindowName);
-        m_focusDetector->setGainFocusCb(m_configuration.gainFocusCb);
-        m_focusDetector->setLoseFocusCb(m_configuration.loseFocusCb);
+        auto matches = windowMatches(cfg);
+        if(!sameMatches(m_focusDetector->selectedWindows(), matches)) {
+            m_focusDetector->setSelectedWindows(std::move(matches));
+            if(m_reactor) {
+                // The reactor doesn't poll the detector's wake fd, have it retarget on the loop instead
+                m_reactor->post([this]() {
+                    m_focusDetector->dispatch();
+                });
+            }
+        }
+    }
+    focusLock.unlock();
+
+    if(m_inputReader && (m_reactor || m_inputReader->isAlive()) && (!previous || cfg.focusGating != previous->focusGating)) {
+        auto paused = cfg.focusGating && !m_hasFocus.load();
+        if(m_reactor) {
+            m_reactor->post([this, paused]() {
+                setInputPaused(paused);
+            });
+        }
+        else {
+            m_inputReader->setPaused(paused);
+        }
+    }
+}
+
+void GwidiServer::onFocusChanged(bool hasFocus) {
+    auto snapshot = m_configuration.current();
+    auto &cfg = snapshot->value;
+    m_hasFocus.store(hasFocus);
+    GWIDI_TRACE_EVENT(logging::TraceKind::FOCUS, 0, hasFocus);
+
+    if(!hasFocus && m_macroEngine) {
+        m_macroEngine->onFocusLost();
+    }
+
+    if(hasFocus) {
+        if(cfg.gainFocusCb) {
+            cfg.gainFocusCb();
+        }
+    }
+    else if(cfg.loseFocusCb) {
+        cfg.loseFocusCb();
+    }
+
+    if(!cfg.focusGating || !m_inputReader) {
+        return;
+    }
+
+    setInputPaused(!hasFocus);
+    if(hasFocus) {
+        // Keys may have been pressed or released while we weren't reading, resync the client in one packet
+        sendKeyStateSnapshot();
+    }
+}
+
+void GwidiServer::onProfileFocused(int profile) {
+    auto snapshot = m_configuration.current();
+    auto &cfg = snapshot->value;
+    auto previous = m_focusedProfile;
+    m_focusedProfile = profile;
+
+    // Nothing focused falls back to the default profile
+    m_activeProfile.store(std::max(profile, 0));
+    spdlog::info("Profile focused: {}, active profile: {}", profile, m_activeProfile.load());
+
+    if(cfg.profileFocusCb) {
+        if(previous >= 0) {
+            cfg.profileFocusCb(previous, false);
+        }
+        if(profile >= 0) {
+            cfg.profileFocusCb(profile, true);
+        }
+    }
+
+    // Focus moved straight from one profile's window to another's, there is no lose/gain in between to do this
+    if(previous >= 0 && profile >= 0) {
+        if(m_macroEngine) {
+            m_macroEngine->onFocusLost();
+        }
+        if(cfg.focusGating) {
+            sendKeyStateSnapshot();
+        }
+    }
+}
+
+void GwidiServer::onAxes(const std::vector<gwidi::udpsocket::AxisEvent> &events) {
+    auto snapshot = m_configuration.current();
+    auto &cfg = snapshot->value;
+    if(cfg.focusGating && !m_hasFocus.load()) {
+        return;
+    }
+    if(cfg.axisCb) {
+        cfg.axisCb(events);
+    }
+}
+
+gwidi::udpsocket::KeyStateEvent GwidiServer::keyStateSnapshot(int profile) {
+    gwidi::udpsocket::KeyStateEvent event{};
+    event.hasFocus = m_hasFocus.load();
+    auto snapshot = m_profileFilters.current();
+    auto &filters = snapshot->value;
+    if(!m_inputReader || profile < 0 || profile >= static_cast<int>(filters.size())) {
+        return event;
+    }
+
+    // The reader watches every profile's keys, only report this profile's
+    auto pressed = m_inputReader->pressedWatchedKeys();
+    for(auto code = 0; code < static_cast<int>(pressed.size()); code++) {
+        if(pressed.test(code) && filters[profile].allows(code)) {
+            event.keyBits[code / 8] |= static_cast<unsigned char>(1 << (code % 8));
+        }
+    }
+    return event;
+}
+
+void GwidiServer::sendKeyStateSnapshot() {
+    if(m_socketServer) {
+        auto profile = m_activeProfile.load();
+        m_socketServer->sendKeyStateEvent(keyStateSnapshot(profile), profile);
     }
 }
 
 bool GwidiServer::isAlive() {
+    if(m_reactor) {
+        return m_reactorAlive.load();
+    }
+
     if(m_socketServer) {
         return m_socketServer->isAlive();
     }
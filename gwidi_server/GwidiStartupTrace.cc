@@ -0,0 +1,71 @@
+#include "GwidiStartupTrace.h"
+#include "GwidiMetrics.h"
+
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+namespace gwidi::server {
+
+StartupTrace::StartupTrace() : m_origin{Clock::now()} {
+}
+
+StartupTrace::~StartupTrace() {
+    for(auto id : m_gaugeIds) {
+        gwidi::metrics::Metrics::instance().unregisterGauge(id);
+    }
+}
+
+std::chrono::microseconds StartupTrace::mark(const std::string &name) {
+    auto now = Clock::now();
+    record(name, now, now, true);
+    return std::chrono::duration_cast<std::chrono::microseconds>(now - m_origin);
+}
+
+void StartupTrace::record(const std::string &name, Clock::time_point begin, Clock::time_point end, bool milestone) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_phases.push_back({
+        name,
+        std::chrono::duration_cast<std::chrono::microseconds>(begin - m_origin),
+        std::chrono::duration_cast<std::chrono::microseconds>(end - begin),
+        milestone
+    });
+    if(m_published) {
+        exportPhase(m_phases.back());
+    }
+}
+
+void StartupTrace::exportPhase(const Phase &phase) {
+    auto us = phase.milestone ? phase.offset : phase.duration;
+    auto help = phase.milestone ? "Microseconds from the start of startup until " + phase.name
+                                : "Microseconds spent in the " + phase.name + " startup phase";
+    m_gaugeIds.emplace_back(gwidi::metrics::Metrics::instance().registerGauge(
+            "gwidi_startup_" + phase.name + "_us", help, [value = static_cast<std::uint64_t>(us.count())]() { return value; }));
+}
+
+std::vector<StartupTrace::Phase> StartupTrace::phases() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto phases = m_phases;
+    std::stable_sort(phases.begin(), phases.end(), [](const Phase& a, const Phase& b) { return a.offset < b.offset; });
+    return phases;
+}
+
+void StartupTrace::publish() {
+    std::string timeline;
+    for(auto &phase : phases()) {
+        if(phase.milestone) {
+            timeline += fmt::format(" {}@{:.1f}ms", phase.name, phase.offset.count() / 1000.0);
+        }
+        else {
+            timeline += fmt::format(" {}[+{:.1f}ms {:.1f}ms]", phase.name, phase.offset.count() / 1000.0, phase.duration.count() / 1000.0);
+        }
+    }
+    spdlog::info("Startup timeline:{}", timeline);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto &phase : m_phases) {
+        exportPhase(phase);
+    }
+    m_published = true;
+}
+
+}
@@ -13,7 +13,7 @@ if(NOT TARGET linux_inputreader)
 endif()
 
 add_library(gwidi_server)
-target_sources(gwidi_server PUBLIC ${CMAKE_CURRENT_LIST_DIR}/GwidiServer.cc)
+target_sources(gwidi_server PUBLIC ${CMAKE_CURRENT_LIST_DIR}/GwidiServer.cc ${CMAKE_CURRENT_LIST_DIR}/GwidiReactor.cc ${CMAKE_CURRENT_LIST_DIR}/GwidiMacroEngine.cc ${CMAKE_CURRENT_LIST_DIR}/GwidiStartupTrace.cc)
 target_link_libraries(gwidi_server PUBLIC spdlog::spdlog gwidi_socketserver linux_inputreader)
 target_include_directories(gwidi_server PUBLIC ${CMAKE_CURRENT_LIST_DIR}/include)
 
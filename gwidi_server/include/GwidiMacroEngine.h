@@ -0,0 +1,78 @@
+#ifndef GWIDI_INPUTSERVER_GWIDIMACROENGINE_H
+#define GWIDI_INPUTSERVER_GWIDIMACROENGINE_H
+
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "GwidiProtocol.h"
+#include "GwidiSnapshot.h"
+#include "LinuxSendInput.h"
+
+namespace gwidi::server {
+
+// Runs client-registered macros inside the server. The reader thread calls onKey() for every watched key event and a
+// matching macro injects through uinput right there; only the steps after a delay are handed to the engine's thread.
+class MacroEngine {
+public:
+    explicit MacroEngine(SendInput* sendInput = nullptr);
+    MacroEngine(const MacroEngine&) = delete;
+    MacroEngine& operator=(const MacroEngine&) = delete;
+    ~MacroEngine();
+
+    // Publishes a new trigger table, onKey() picks it up without locking
+    void setMacros(const std::vector<gwidi::udpsocket::MacroDefinition>& macros);
+
+    // Returns true if a macro consumed the event, i.e. it should not be forwarded to the client. Repeats (value > 1)
+    // never fire a macro and are consumed along with their press.
+    bool onKey(int code, int value, bool hasFocus, const std::bitset<0x100>& pressed);
+
+    // Cancels pending steps of focus-only macros and releases any keys they still hold down
+    void onFocusLost();
+
+    std::size_t pendingCount();
+
+    // Macros that trigger before a device is set do nothing
+    inline void setSendInput(SendInput* sendInput) {
+        m_sendInput.store(sendInput);
+    }
+
+private:
+    using MacroPtr = std::shared_ptr<const gwidi::udpsocket::MacroDefinition>;
+    using MacroTable = std::array<std::vector<MacroPtr>, 0x100>;   // indexed by trigger code
+
+    struct Run {
+        MacroPtr macro;
+        std::size_t nextStep{0};
+        std::chrono::steady_clock::time_point deadline;
+        std::bitset<0x100> held;    // pressed by this run and not released yet
+        std::uint64_t focusEpoch{0};
+    };
+
+    // Runs steps from run.nextStep on until one has a delay, returns true if the run has to be resumed later
+    bool runSteps(Run& run);
+    void schedule(Run run);
+    void releaseHeld(Run& run);
+    void workerLoop();
+
+    std::atomic<SendInput*> m_sendInput;
+    gwidi::SnapshotStore<MacroTable> m_macros;
+    std::bitset<0x100> m_consumedPresses;   // reader thread only, so the matching release is swallowed too
+
+    std::atomic<std::uint64_t> m_focusEpoch{0};
+    std::mutex m_runsMutex;
+    std::condition_variable m_runsCv;
+    std::vector<Run> m_runs;
+    bool m_stop{false};
+    std::thread m_worker;
+};
+
+}
+
+#endif //GWIDI_INPUTSERVER_GWIDIMACROENGINE_H
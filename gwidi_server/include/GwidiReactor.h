@@ -0,0 +1,66 @@
+#ifndef GWIDI_INPUTSERVER_GWIDIREACTOR_H
+#define GWIDI_INPUTSERVER_GWIDIREACTOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sys/epoll.h>
+#include <unordered_map>
+#include <vector>
+
+namespace gwidi::server {
+
+// Single-threaded epoll loop. Every registered fd is served from the thread that calls run(), a control eventfd lets
+// other threads stop the loop or post work onto it.
+class Reactor {
+public:
+    using Handler = std::function<void(uint32_t)>;
+    using Task = std::function<void()>;
+
+    Reactor();
+    ~Reactor();
+
+    bool add(int fd, Handler handler, uint32_t events = EPOLLIN);
+    void remove(int fd);
+
+    // Runs until stop() is called, must only be called from one thread
+    void run();
+
+    // Thread-safe
+    void stop();
+    void post(Task task);
+
+    inline bool isRunning() {
+        return m_running.load();
+    }
+
+    std::size_t pendingTasks();
+
+private:
+    struct Registration {
+        int fd;
+        Handler handler;
+        bool removed{false};
+    };
+
+    void drainControl();
+
+    int m_epollFd{-1};
+    int m_controlFd{-1};
+    std::atomic_bool m_running{false};
+    std::atomic_bool m_stopRequested{false};
+
+    // epoll hands back the Registration pointer directly, removed registrations are kept until the current batch of
+    // events has been dispatched so a handler can safely remove any fd (itself included)
+    std::unordered_map<int, std::unique_ptr<Registration>> m_registrations;
+    std::vector<std::unique_ptr<Registration>> m_retired;
+
+    std::mutex m_tasksMutex;
+    std::vector<Task> m_tasks;
+};
+
+}
+
+#endif //GWIDI_INPUTSERVER_GWIDIREACTOR_H
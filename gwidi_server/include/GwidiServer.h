@@ -3,15 +3,31 @@
 
 #include <memory>
 #include <functional>
+#include <optional>
+#include <thread>
 
 #include "GwidiSocketServer.h"
 #include "LinuxInputReader.h"
+#include "GwidiReactor.h"
+#include "GwidiSnapshot.h"
+#include "GwidiMacroEngine.h"
+#include "GwidiStartupTrace.h"
+#include "GwidiProbes.h"
+#include "KeyPipeline.h"
 
 namespace gwidi::server {
 
 using GainFocusCb = std::function<void()>;
 using LoseFocusCb = std::function<void()>;
 using WatchedKeyCb = std::function<void(int, int)>;
+using ReadyCb = std::function<void()>;
+using AxisCb = std::function<void(const std::vector<gwidi::udpsocket::AxisEvent>&)>;
+using ProfileFocusCb = std::function<void(int, bool)>;
+
+enum class ThreadingMode {
+    Threads,    // one detached thread per subsystem (UDP listener, evdev poller, focus detector)
+    Reactor     // a single epoll loop serves every fd but the metrics socket's, stop() joins it
+};
 
 struct Configuration {
     GainFocusCb gainFocusCb;
@@ -19,30 +35,258 @@ struct Configuration {
     WatchedKeyCb watchedKeyCb;
 
     std::string watchedWindowName;
+    std::string watchedWindowClass;     // matched against WM_CLASS, takes precedence over the name when set
     std::vector<int> watchedKeys;
+
+    // Named profiles on top of the default one made of the fields above, all served by the same reader. While one of
+    // their windows has focus only its keys are forwarded, and only to the clients that subscribed to it by name in
+    // their hello; the default profile is active the rest of the time. Indexes are 0 for the default profile and
+    // 1.. for these.
+    std::vector<gwidi::udpsocket::Profile> profiles;
+    // Called with a profile's index whenever its window gains or loses focus, moving focus between two profiles'
+    // windows reports the loss first
+    ProfileFocusCb profileFocusCb;
+
+    // When set, watched keys are only forwarded while the watched window has focus and the input devices are not
+    // read at all in the meantime. Regaining focus sends a single key state snapshot to the client.
+    bool focusGating{false};
+
+    // Run inside the server straight from the reader thread, trigger keys are read even if they are not watched
+    std::vector<gwidi::udpsocket::MacroDefinition> macros;
+
+    // Watched keys go to the connected client straight from the reader thread, ahead of watchedKeyCb
+    bool sendKeyEvents{false};
+
+    // Autorepeat of watched keys, dropped unless a rule forwards it. Held updates go to the client like watched keys,
+    // watchedKeyCb sees them as KEY_VALUE_HELD.
+    std::vector<gwidi::udpsocket::RepeatRule> repeats;
+
+    // EV_ABS / EV_REL forwarding, off by default. Shaped batches go to axisCb, gated like watched keys.
+    gwidi::udpsocket::AxisSettings axes;
+    AxisCb axisCb;
+
+    // Key events carry a sequence number and are retransmitted until the client acks them (EVENT_KEY_RELIABLE)
+    bool reliableKeyEvents{false};
+
+    ThreadingMode threadingMode{ThreadingMode::Threads};
+
+    // Bind address, ports and listener shards, only read by start()
+    gwidi::udpsocket::ListenOptions listen;
+
+    // Grab the keyboards so keys the server claims (forwarded or consumed by a macro) never reach other applications,
+    // everything else is re-emitted through a uinput clone of each keyboard. Only read by start().
+    bool exclusiveGrab{false};
+
+    // Injection (EVENT_SENDINPUT, macros) goes to /dev/null instead of uinput, for load tests
+    bool nullSendInput{false};
+
+    // Prometheus text exposition is served on this Unix socket when set, from a thread of its own in either mode
+    std::string metricsSocketPath;
+
+    // Devices and the matched window are remembered here when set. The next start opens the remembered devices
+    // straight away and finds anything new with a full scan in the background. Only read by start().
+    std::string discoveryCachePath;
+
+    // Called from start() as soon as watched keys can be forwarded, uinput and the focus source may still be coming up
+    ReadyCb readyCb;
 };
 
+// Stages of the server's key path, see KeyPipeline. Each only holds pointers into the server.
+struct FocusGateStage {
+    const gwidi::SnapshotStore<Configuration>* configuration;
+    const std::atomic_bool* hasFocus;
+
+    inline gwidi::input::StageResult operator()(int code, int value) const {
+        // The reader may still be finishing a poll cycle when focus is lost, drop anything that races the pause
+        if(configuration->current()->value.focusGating && !hasFocus->load()) {
+            GWIDI_PROBE3(key_filter, code, value, gwidi::PROBE_GATED);
+            return gwidi::input::StageResult::DROP;
+        }
+        return gwidi::input::StageResult::PASS;
+    }
+};
+
+struct MacroStage {
+    MacroEngine* engine;
+    gwidi::input::LinuxInputReader* reader;
+    const std::atomic_bool* hasFocus;
+
+    inline gwidi::input::StageResult operator()(int code, int value) const {
+        // Macros run right here on the reader thread, without a round trip through the client
+        if(engine->onKey(code, value, hasFocus->load(), reader->pressedKeys())) {
+            GWIDI_PROBE3(key_filter, code, value, gwidi::PROBE_CONSUMED);
+            return gwidi::input::StageResult::CLAIM;
+        }
+        return gwidi::input::StageResult::PASS;
+    }
+};
+
+// Keys outside the active profile's filter are dropped, switching profiles is a single store to activeProfile
+struct ProfileFilterStage {
+    const gwidi::SnapshotStore<std::vector<gwidi::input::KeyFilter>>* filters;
+    const std::atomic_int* activeProfile;
+
+    inline gwidi::input::StageResult operator()(int code, int value) const {
+        // The profile table may have shrunk under an index the focus source hasn't retargeted yet
+        auto snapshot = filters->current();
+        auto &profileFilters = snapshot->value;
+        auto profile = static_cast<std::size_t>(activeProfile->load(std::memory_order_relaxed));
+        if(profile >= profileFilters.size()) {
+            profile = 0;
+        }
+        if(profileFilters.empty() || !profileFilters[profile].allows(code)) {
+            GWIDI_PROBE3(key_filter, code, value, gwidi::PROBE_FILTERED);
+            return gwidi::input::StageResult::DROP;
+        }
+        GWIDI_PROBE3(key_filter, code, value, gwidi::PROBE_FORWARDED);
+        return gwidi::input::StageResult::PASS;
+    }
+};
+
+// Logs how long after start() the first key got this far, the figure a warm start is meant to bring down
+struct FirstKeyStage {
+    StartupTrace* trace;
+    std::atomic_bool* forwarded;
+    const bool* warmStart;
+
+    inline gwidi::input::StageResult operator()(int, int) const {
+        if(!forwarded->load(std::memory_order_relaxed) && !forwarded->exchange(true)) {
+            auto offset = trace->mark("first_key");
+            spdlog::info("First key forwarded {:.1f}ms after start ({} start)", offset.count() / 1000.0,
+                         *warmStart ? "warm" : "cold");
+        }
+        return gwidi::input::StageResult::PASS;
+    }
+};
+
+struct ClientStage {
+    const gwidi::SnapshotStore<Configuration>* configuration;
+    gwidi::udpsocket::ReaderSocketServer* socketServer;
+    const gwidi::input::LinuxInputReader* reader;
+    const std::atomic_int* activeProfile;
+
+    inline gwidi::input::StageResult operator()(int code, int value) const {
+        if(!configuration->current()->value.sendKeyEvents) {
+            return gwidi::input::StageResult::PASS;
+        }
+        auto profile = activeProfile->load(std::memory_order_relaxed);
+        if(value == gwidi::input::KEY_VALUE_HELD) {
+            socketServer->sendKeyHeldEvent(gwidi::udpsocket::KeyHeldEvent{code, reader->heldMs(code)}, profile);
+        }
+        else {
+            socketServer->sendKeyEvent(gwidi::udpsocket::KeyEvent{code, value}, profile);
+        }
+        return gwidi::input::StageResult::PASS;
+    }
+};
+
+struct WatchedKeyCbStage {
+    const gwidi::SnapshotStore<Configuration>* configuration;
+
+    inline gwidi::input::StageResult operator()(int code, int value) const {
+        auto snapshot = configuration->current();
+        auto &cb = snapshot->value.watchedKeyCb;
+        if(cb) {
+            cb(code, value);
+        }
+        return gwidi::input::StageResult::PASS;
+    }
+};
+
+using ServerKeyPipeline = gwidi::input::KeyPipeline<FocusGateStage, MacroStage, ProfileFilterStage, FirstKeyStage,
+        ClientStage, WatchedKeyCbStage>;
+
 class GwidiServer {
 public:
     GwidiServer() : GwidiServer(Configuration{}) {}
     explicit GwidiServer(Configuration cfg);
+    GwidiServer(Configuration cfg, std::unique_ptr<gwidi::input::FocusSource> focusSource);
     ~GwidiServer();
 
+    // Brings the socket and the input devices up first and signals readiness, then finishes the slower uinput and
+    // focus source setup (which run concurrently meanwhile) before returning
     void start();
     void stop();
 
     bool isAlive();
 
+    // Publishes a new configuration snapshot and applies it without restarting threads or reopening devices
     void setConfiguration(Configuration cfg);
 
+    // Applies the fields present in the request on top of the current configuration, returns the new version
+    std::uint64_t reconfigure(const gwidi::udpsocket::ReconfigureRequest& request);
+
+    // Never waits on a reconfigure, the returned snapshot stays valid for as long as it is held (on the calling thread)
+    inline gwidi::SnapshotStore<Configuration>::Ptr configuration() const {
+        return m_configuration.current();
+    }
+
+    // Must be called before start(), without one the X11 InputFocusDetector is used
+    void setFocusSource(std::unique_ptr<gwidi::input::FocusSource> focusSource);
+
     gwidi::udpsocket::ReaderSocketServer* socketServer();
 
+    inline bool hasFocus() {
+        return m_hasFocus.load();
+    }
+
+    // Index of the profile watched keys are currently forwarded for, see Configuration::profiles
+    inline int activeProfile() {
+        return m_activeProfile.load();
+    }
+
 private:
+    void wireCallbacks();
+    void attachFocusSource(std::unique_ptr<gwidi::input::FocusSource> focusSource);
+    // Without a previous configuration everything is applied
+    void applyConfiguration(const Configuration& cfg, const Configuration* previous = nullptr);
+    void onFocusChanged(bool hasFocus);
+    void onProfileFocused(int profile);
+    void onAxes(const std::vector<gwidi::udpsocket::AxisEvent>& events);
+    gwidi::udpsocket::KeyStateEvent keyStateSnapshot(int profile);
+    void sendKeyStateSnapshot();
+
+    void startReactor();
+    void setInputPaused(bool paused);
+    void setInputDevicesRegistered(bool registered);
+    void addInputDevice(int fd);
+    void armAxisTimer();
+    void confirmDiscovery();
+    void onWindowMatched(int profile, const gwidi::input::WindowHint& hint);
+
     std::unique_ptr<gwidi::udpsocket::ReaderSocketServer> m_socketServer;
     std::unique_ptr<gwidi::input::LinuxInputReader> m_inputReader;
-    std::unique_ptr<gwidi::input::InputFocusDetector> m_focusDetector;
+    std::unique_ptr<gwidi::input::FocusSource> m_focusDetector;
+    std::mutex m_focusDetectorMutex;    // it arrives after the socket is already taking reconfigures
+    std::unique_ptr<MacroEngine> m_macroEngine;
+    std::unique_ptr<ServerKeyPipeline> m_keyPipeline;
+    std::unique_ptr<StartupTrace> m_startupTrace;
+
+    gwidi::SnapshotStore<Configuration> m_configuration;
+    std::mutex m_reconfigureMutex;      // sharded listeners may reconfigure concurrently, applying must not reorder
+    // What each profile's clients asked for, indexed like the profile table. The reader reads all of them at once and
+    // may be reading macro triggers on top.
+    gwidi::SnapshotStore<std::vector<gwidi::input::KeyFilter>> m_profileFilters;
+    std::atomic_int m_activeProfile{0};
+    int m_focusedProfile{-1};           // only touched from the focus source's callbacks
+    std::atomic_bool m_hasFocus{false};
+
+    std::unique_ptr<gwidi::metrics::PrometheusExporter> m_metricsExporter;
+    int m_reactorGaugeId{-1};
+
+    std::unique_ptr<Reactor> m_reactor;
+    std::thread m_reactorThread;
+    std::atomic_bool m_reactorAlive{false};
+    bool m_inputDevicesRegistered{false};
+    int m_axisTimerFd{-1};
+    std::optional<gwidi::input::AxisShaper::Clock::time_point> m_axisTimerDeadline;
 
-    Configuration m_configuration;
+    std::string m_discoveryCachePath;
+    std::mutex m_discoveryMutex;        // the background scan and the focus source both update the cache
+    gwidi::input::DiscoveryCache m_discoveryCache;
+    std::thread m_discoveryThread;
+    bool m_warmStart{false};
+    std::atomic_bool m_firstKeyForwarded{false};
 };
 
 }
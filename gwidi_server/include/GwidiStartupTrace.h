@@ -0,0 +1,68 @@
+#ifndef GWIDI_INPUTSERVER_GWIDISTARTUPTRACE_H
+#define GWIDI_INPUTSERVER_GWIDISTARTUPTRACE_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace gwidi::server {
+
+// Timeline of GwidiServer::start(). Phases may run concurrently, each records when it began relative to the start of
+// the trace and how long it took. Once published every entry is exported as a gwidi_startup_<name>_us gauge, entries
+// recorded later on (the first forwarded key, the background device scan) are exported as they come in.
+class StartupTrace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Phase {
+        std::string name;
+        std::chrono::microseconds offset;
+        std::chrono::microseconds duration;
+        bool milestone;     // a point in time rather than a span, its gauge reports the offset
+    };
+
+    StartupTrace();
+    StartupTrace(const StartupTrace&) = delete;
+    StartupTrace& operator=(const StartupTrace&) = delete;
+    ~StartupTrace();
+
+    // Thread-safe
+    template<typename Fn>
+    auto measure(const std::string& name, Fn&& fn) {
+        auto begin = Clock::now();
+        struct Record {
+            StartupTrace* trace;
+            const std::string& name;
+            Clock::time_point begin;
+            ~Record() {
+                trace->record(name, begin, Clock::now(), false);
+            }
+        } record{this, name, begin};
+        return std::forward<Fn>(fn)();
+    }
+
+    // Returns how long after the start of the trace it was
+    std::chrono::microseconds mark(const std::string& name);
+
+    std::vector<Phase> phases();
+
+    // Logs the timeline and registers the gauges, call once every phase has finished
+    void publish();
+
+private:
+    void record(const std::string& name, Clock::time_point begin, Clock::time_point end, bool milestone);
+
+    void exportPhase(const Phase& phase);
+
+    Clock::time_point m_origin;
+    bool m_published{false};
+    std::mutex m_mutex;
+    std::vector<Phase> m_phases;
+    std::vector<int> m_gaugeIds;
+};
+
+}
+
+#endif //GWIDI_INPUTSERVER_GWIDISTARTUPTRACE_H
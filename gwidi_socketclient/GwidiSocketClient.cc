@@ -0,0 +1,482 @@
+#include "GwidiSocketClient.h"
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+
+#include "spdlog/spdlog.h"
+
+namespace gwidi::udpsocket {
+
+namespace {
+
+// Bounds-checked cursor over a received datagram, nothing is copied out except fixed size scalars
+struct DatagramReader {
+    const char* buffer;
+    std::size_t bufferSize;
+    std::size_t bufferOffset{0};
+
+    template<typename T>
+    bool read(T& out) {
+        if(bufferSize - bufferOffset < sizeof(T)) {
+            return false;
+        }
+        memcpy(&out, buffer + bufferOffset, sizeof(T));
+        bufferOffset += sizeof(T);
+        return true;
+    }
+
+    bool view(std::size_t size, const char*& out) {
+        if(bufferSize - bufferOffset < size) {
+            return false;
+        }
+        out = buffer + bufferOffset;
+        bufferOffset += size;
+        return true;
+    }
+};
+
+std::int64_t steadyNowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+SocketClient::SocketClient(ClientOptions options) : m_options{std::move(options)} {
+    m_serverAddr.sin_family = AF_INET;
+    m_serverAddr.sin_port = htons(m_options.serverPort);
+    m_serverAddr.sin_addr.s_addr = inet_addr(m_options.serverAddress.c_str());
+}
+
+SocketClient::~SocketClient() {
+    stopListening();
+    if(m_th && m_th->joinable()) {
+        m_th->join();
+    }
+    closeSockets();
+}
+
+int SocketClient::attach() {
+    if(m_epollFd >= 0) {
+        return m_epollFd;
+    }
+
+    m_sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    sockaddr_in listenAddr{};
+    listenAddr.sin_family = AF_INET;
+    listenAddr.sin_port = htons(m_options.listenPort);
+    listenAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(m_sockfd, (struct sockaddr*)&listenAddr, sizeof(listenAddr)) != 0) {
+        spdlog::warn("Failed to bind client socket on port {}", m_options.listenPort);
+        closeSockets();
+        return -1;
+    }
+
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    itimerspec spec{};
+    auto intervalMs = m_options.keepaliveInterval.count();
+    spec.it_interval.tv_sec = intervalMs / 1000;
+    spec.it_interval.tv_nsec = (intervalMs % 1000) * 1000000;
+    spec.it_value = spec.it_interval;
+    timerfd_settime(m_timerFd, 0, &spec, nullptr);
+
+    // One fd for the caller's loop, dispatch() finds out which of the two is ready
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = m_sockfd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_sockfd, &ev);
+    ev.data.fd = m_timerFd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_timerFd, &ev);
+
+    sendHello();
+    return m_epollFd;
+}
+
+void SocketClient::closeSockets() {
+    for(auto fd : {&m_epollFd, &m_timerFd, &m_sockfd}) {
+        if(*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+void SocketClient::dispatch() {
+    epoll_event events[2];
+    auto count = epoll_wait(m_epollFd, events, 2, 0);
+    for(auto i = 0; i < count; i++) {
+        if(events[i].data.fd == m_timerFd) {
+            uint64_t expirations;
+            while(read(m_timerFd, &expirations, sizeof(expirations)) == sizeof(expirations)) {}
+            handleKeepalive();
+        }
+    }
+
+    ssize_t received;
+    while((received = recv(m_sockfd, m_buffer, sizeof(m_buffer), MSG_DONTWAIT)) >= 0) {
+        handleDatagram(m_buffer, received);
+    }
+
+    // One cumulative ack covers every reliable event in this batch
+    if(m_ackPending) {
+        m_ackPending = false;
+        char buffer[sizeof(int) + sizeof(std::uint32_t)];
+        int msg_type = static_cast<int>(ServerEventType::EVENT_KEY_ACK);
+        auto seq = m_sequence.cumulativeAck();
+        memcpy(buffer, &msg_type, sizeof(int));
+        memcpy(buffer + sizeof(int), &seq, sizeof(seq));
+        send(buffer, sizeof(buffer));
+    }
+}
+
+void SocketClient::beginListening() {
+    if(m_thAlive.load() || attach() < 0) {
+        return;
+    }
+
+    m_thAlive.store(true);
+    m_th = std::make_shared<std::thread>([this] {
+        pollfd pfd{m_epollFd, POLLIN, 0};
+        while(m_thAlive.load()) {
+            if(poll(&pfd, 1, 500) > 0) {
+                dispatch();
+            }
+        }
+    });
+}
+
+void SocketClient::stopListening() {
+    m_thAlive.store(false);
+}
+
+void SocketClient::handleDatagram(const char *buffer, std::size_t bufferSize) {
+    DatagramReader reader{buffer, bufferSize};
+    int msg_type;
+    if(!reader.read(msg_type)) {
+        return;
+    }
+
+    switch(static_cast<ServerEventType>(msg_type)) {
+        case ServerEventType::EVENT_HELLO: {
+            std::size_t msgSize;
+            const char* msg;
+            if(!reader.read(msgSize) || !reader.view(msgSize, msg) || std::string_view{msg, msgSize} != HELLO_REPLY) {
+                break;
+            }
+            // The server starts a fresh sequence for every hello it answers
+            m_sequence.reset();
+            m_unansweredPings = 0;
+            setConnected(true);
+            break;
+        }
+        case ServerEventType::EVENT_KEY: {
+            KeyEvent event{};
+            if(reader.read(event.code) && reader.read(event.eventType) && m_keyCb) {
+                m_keyCb(event);
+            }
+            break;
+        }
+        case ServerEventType::EVENT_KEY_RELIABLE: {
+            std::uint32_t seq;
+            KeyEvent event{};
+            if(!reader.read(seq) || !reader.read(event.code) || !reader.read(event.eventType)) {
+                break;
+            }
+            // Duplicates are acked again too, the ack they were retransmitted for may be the one that got lost
+            m_ackPending = true;
+            m_sequence.accept(seq, event, [this](const KeyEvent &inOrder) {
+                if(m_keyCb) {
+                    m_keyCb(inOrder);
+                }
+            });
+            break;
+        }
+        case ServerEventType::EVENT_KEYSTATE_RELIABLE: {
+            std::uint32_t seq;
+            std::size_t bitsSize;
+            const char* bits;
+            bool hasFocus;
+            if(!reader.read(seq) || !reader.read(bitsSize) || bitsSize != KEYSTATE_BITS_SIZE || !reader.view(bitsSize, bits) || !reader.read(hasFocus)) {
+                break;
+            }
+            m_ackPending = true;
+            m_sequence.resync(seq, [this, bits, hasFocus] {
+                if(m_keyStateCb) {
+                    m_keyStateCb(KeyStateView{reinterpret_cast<const unsigned char*>(bits), hasFocus});
+                }
+            }, [this](const KeyEvent &inOrder) {
+                if(m_keyCb) {
+                    m_keyCb(inOrder);
+                }
+            });
+            break;
+        }
+        case ServerEventType::EVENT_KEY_HELD: {
+            KeyHeldEvent event{};
+            if(reader.read(event.code) && reader.read(event.heldMs) && m_keyHeldCb) {
+                m_keyHeldCb(event);
+            }
+            break;
+        }
+        case ServerEventType::EVENT_FOCUS: {
+            std::size_t nameSize;
+            const char* name;
+            bool hasFocus;
+            if(reader.read(nameSize) && reader.view(nameSize, name) && reader.read(hasFocus) && m_focusCb) {
+                m_focusCb(FocusView{{name, nameSize}, hasFocus});
+            }
+            break;
+        }
+        case ServerEventType::EVENT_KEYSTATE: {
+            std::size_t bitsSize;
+            const char* bits;
+            bool hasFocus;
+            if(reader.read(bitsSize) && bitsSize == KEYSTATE_BITS_SIZE && reader.view(bitsSize, bits) && reader.read(hasFocus) && m_keyStateCb) {
+                m_keyStateCb(KeyStateView{reinterpret_cast<const unsigned char*>(bits), hasFocus});
+            }
+            break;
+        }
+        case ServerEventType::EVENT_RECONFIGURE_ACK: {
+            std::uint64_t version;
+            if(reader.read(version) && m_reconfigureAckCb) {
+                m_reconfigureAckCb(version);
+            }
+            break;
+        }
+        case ServerEventType::EVENT_AXIS: {
+            std::uint16_t count;
+            if(!m_axisCb || !reader.read(count)) {
+                break;
+            }
+            m_axisEvents.clear();
+            for(auto i = 0; i < count; i++) {
+                std::uint16_t evType;
+                std::uint16_t code;
+                std::int32_t value;
+                if(!reader.read(evType) || !reader.read(code) || !reader.read(value)) {
+                    break;
+                }
+                m_axisEvents.push_back({evType, code, value});
+            }
+            if(m_axisEvents.size() == count) {
+                m_axisCb(m_axisEvents);
+            }
+            break;
+        }
+        case ServerEventType::EVENT_PONG: {
+            std::uint64_t token;
+            if(!reader.read(token)) {
+                break;
+            }
+            // The token is the send time, so no bookkeeping of outstanding pings is needed
+            auto rtt = steadyNowUs() - static_cast<std::int64_t>(token);
+            m_lastRttUs.store(rtt);
+            auto smoothed = m_smoothedRttUs.load();
+            m_smoothedRttUs.store(smoothed == 0 ? rtt : smoothed + (rtt - smoothed) / 8);
+            m_unansweredPings = 0;
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+}
+
+void SocketClient::handleKeepalive() {
+    if(!m_connected.load()) {
+        sendHello();
+        return;
+    }
+
+    if(m_unansweredPings >= m_options.missedKeepalives) {
+        spdlog::warn("Server stopped answering, reconnecting");
+        setConnected(false);
+        m_unansweredPings = 0;
+        sendHello();
+        return;
+    }
+
+    m_unansweredPings++;
+    sendPing();
+}
+
+void SocketClient::setConnected(bool connected) {
+    if(m_connected.exchange(connected) == connected) {
+        return;
+    }
+    if(m_connectionCb) {
+        m_connectionCb(connected);
+    }
+}
+
+void SocketClient::send(const char *buffer, std::size_t bufferSize) {
+    if(m_sockfd < 0) {
+        return;
+    }
+    sendto(m_sockfd, buffer, bufferSize, 0, (struct sockaddr*)&m_serverAddr, sizeof(m_serverAddr));
+}
+
+void SocketClient::sendHello() {
+    std::string_view msg{HELLO_MESSAGE};
+    std::string buffer;
+    auto append = [&buffer](const void* data, std::size_t size) {
+        buffer.append(reinterpret_cast<const char*>(data), size);
+    };
+    int msg_type = static_cast<int>(ServerEventType::EVENT_HELLO);
+    std::size_t msgSize = msg.size();
+    append(&msg_type, sizeof(int));
+    append(&msgSize, sizeof(msgSize));
+    append(msg.data(), msgSize);
+    if(!m_options.profile.empty()) {
+        std::size_t profileSize = m_options.profile.size();
+        append(&profileSize, sizeof(profileSize));
+        append(m_options.profile.data(), profileSize);
+    }
+    send(buffer.data(), buffer.size());
+}
+
+void SocketClient::sendPing() {
+    char buffer[sizeof(int) + sizeof(std::uint64_t)];
+    int msg_type = static_cast<int>(ServerEventType::EVENT_PING);
+    auto token = static_cast<std::uint64_t>(steadyNowUs());
+    memcpy(buffer, &msg_type, sizeof(int));
+    memcpy(buffer + sizeof(int), &token, sizeof(token));
+    send(buffer, sizeof(buffer));
+}
+
+void SocketClient::requestKeyState() {
+    int msg_type = static_cast<int>(ServerEventType::EVENT_KEYSTATE_REQUEST);
+    send(reinterpret_cast<const char*>(&msg_type), sizeof(int));
+}
+
+void SocketClient::reconfigure(const ReconfigureRequest &request) {
+    // Control traffic, building it in a string is fine
+    std::string buffer;
+    auto append = [&buffer](const void* data, std::size_t size) {
+        buffer.append(reinterpret_cast<const char*>(data), size);
+    };
+    auto appendField = [&append](ReconfigureField field, const void* data, std::size_t size) {
+        int id = static_cast<int>(field);
+        append(&id, sizeof(int));
+        append(&size, sizeof(size));
+        append(data, size);
+    };
+
+    int msg_type = static_cast<int>(ServerEventType::EVENT_RECONFIGURE);
+    append(&msg_type, sizeof(int));
+    std::size_t fieldCount = request.watchedKeys.has_value() + request.windowName.has_value() +
+            request.windowClass.has_value() + request.forwardingMode.has_value() + request.setMacros.size() +
+            request.removeMacros.size() + request.enableMacros.size() + request.axes.has_value() +
+            request.profiles.has_value() + request.repeats.has_value();
+    append(&fieldCount, sizeof(fieldCount));
+
+    if(request.watchedKeys) {
+        appendField(RECONFIGURE_WATCHED_KEYS, request.watchedKeys->data(), request.watchedKeys->size() * sizeof(int));
+    }
+    if(request.windowName) {
+        appendField(RECONFIGURE_WINDOW_NAME, request.windowName->data(), request.windowName->size());
+    }
+    if(request.windowClass) {
+        appendField(RECONFIGURE_WINDOW_CLASS, request.windowClass->data(), request.windowClass->size());
+    }
+    if(request.forwardingMode) {
+        int mode = static_cast<int>(*request.forwardingMode);
+        appendField(RECONFIGURE_FORWARDING_MODE, &mode, sizeof(int));
+    }
+    for(auto &macro : request.setMacros) {
+        std::string payload;
+        auto appendPayload = [&payload](const void* data, std::size_t size) {
+            payload.append(reinterpret_cast<const char*>(data), size);
+        };
+        std::size_t modifierCount = macro.modifiers.size();
+        std::size_t stepCount = macro.steps.size();
+        appendPayload(&macro.id, sizeof(int));
+        appendPayload(&macro.trigger, sizeof(int));
+        appendPayload(&modifierCount, sizeof(modifierCount));
+        appendPayload(macro.modifiers.data(), modifierCount * sizeof(int));
+        appendPayload(&macro.focusOnly, sizeof(bool));
+        appendPayload(&macro.consumeTrigger, sizeof(bool));
+        appendPayload(&macro.enabled, sizeof(bool));
+        appendPayload(&stepCount, sizeof(stepCount));
+        for(auto &step : macro.steps) {
+            int action = static_cast<int>(step.action);
+            appendPayload(&step.code, sizeof(int));
+            appendPayload(&action, sizeof(int));
+            appendPayload(&step.delayMs, sizeof(std::uint32_t));
+        }
+        appendField(RECONFIGURE_MACRO_SET, payload.data(), payload.size());
+    }
+    for(auto id : request.removeMacros) {
+        appendField(RECONFIGURE_MACRO_REMOVE, &id, sizeof(int));
+    }
+    for(auto &[id, enabled] : request.enableMacros) {
+        char payload[sizeof(int) + sizeof(bool)];
+        memcpy(payload, &id, sizeof(int));
+        memcpy(payload + sizeof(int), &enabled, sizeof(bool));
+        appendField(RECONFIGURE_MACRO_ENABLE, payload, sizeof(payload));
+    }
+    if(request.axes) {
+        std::string payload;
+        auto appendPayload = [&payload](const void* data, std::size_t size) {
+            payload.append(reinterpret_cast<const char*>(data), size);
+        };
+        std::size_t ruleCount = request.axes->rules.size();
+        appendPayload(&request.axes->enabled, sizeof(bool));
+        appendPayload(&ruleCount, sizeof(ruleCount));
+        for(auto &rule : request.axes->rules) {
+            appendPayload(&rule.evType, sizeof(int));
+            appendPayload(&rule.code, sizeof(int));
+            appendPayload(&rule.center, sizeof(int));
+            appendPayload(&rule.deadband, sizeof(int));
+            appendPayload(&rule.quantum, sizeof(int));
+            appendPayload(&rule.minIntervalMs, sizeof(std::uint32_t));
+        }
+        appendField(RECONFIGURE_AXES, payload.data(), payload.size());
+    }
+    if(request.profiles) {
+        std::string payload;
+        auto appendPayload = [&payload](const void* data, std::size_t size) {
+            payload.append(reinterpret_cast<const char*>(data), size);
+        };
+        auto appendString = [&appendPayload](const std::string &str) {
+            std::size_t size = str.size();
+            appendPayload(&size, sizeof(size));
+            appendPayload(str.data(), size);
+        };
+        std::size_t profileCount = request.profiles->size();
+        appendPayload(&profileCount, sizeof(profileCount));
+        for(auto &profile : *request.profiles) {
+            std::size_t keyCount = profile.watchedKeys.size();
+            appendString(profile.name);
+            appendString(profile.windowName);
+            appendString(profile.windowClass);
+            appendPayload(&keyCount, sizeof(keyCount));
+            appendPayload(profile.watchedKeys.data(), keyCount * sizeof(int));
+        }
+        appendField(RECONFIGURE_PROFILES, payload.data(), payload.size());
+    }
+    if(request.repeats) {
+        std::string payload;
+        auto appendPayload = [&payload](const void* data, std::size_t size) {
+            payload.append(reinterpret_cast<const char*>(data), size);
+        };
+        std::size_t ruleCount = request.repeats->size();
+        appendPayload(&ruleCount, sizeof(ruleCount));
+        for(auto &rule : *request.repeats) {
+            int mode = static_cast<int>(rule.mode);
+            appendPayload(&rule.code, sizeof(int));
+            appendPayload(&mode, sizeof(int));
+            appendPayload(&rule.intervalMs, sizeof(std::uint32_t));
+        }
+        appendField(RECONFIGURE_REPEATS, payload.data(), payload.size());
+    }
+
+    send(buffer.data(), buffer.size());
+}
+
+}
@@ -0,0 +1,17 @@
+if(NOT TARGET spdlog)
+    find_package(spdlog REQUIRED)
+endif()
+
+# Only the protocol header is shared with the server, consumers don't link the server or uinput libraries
+add_library(gwidi_socketclient)
+target_sources(gwidi_socketclient PUBLIC ${CMAKE_CURRENT_LIST_DIR}/GwidiSocketClient.cc)
+target_link_libraries(gwidi_socketclient PUBLIC spdlog::spdlog)
+target_include_directories(gwidi_socketclient PUBLIC ${CMAKE_CURRENT_LIST_DIR}/include ${CMAKE_CURRENT_LIST_DIR}/../gwidi_socketserver/include)
+
+set(gwidi_socketclient_INCLUDE_DIRS ${CMAKE_CURRENT_LIST_DIR}/include ${CMAKE_CURRENT_LIST_DIR}/../gwidi_socketserver/include)
+set(gwidi_socketclient_LIBRARIES gwidi_socketclient)
+
+if(SOCKETCLIENT_BUILD_TESTS)
+    message("BUILDING TESTS")
+    add_subdirectory(${CMAKE_CURRENT_LIST_DIR}/test)
+endif()
@@ -0,0 +1,161 @@
+#ifndef GWIDI_INPUTSERVER_GWIDISOCKETCLIENT_H
+#define GWIDI_INPUTSERVER_GWIDISOCKETCLIENT_H
+
+#include <netinet/in.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "GwidiProtocol.h"
+
+namespace gwidi::udpsocket {
+
+// Views are decoded in place over the receive buffer and are only valid for the duration of the callback
+struct FocusView {
+    std::string_view windowName;
+    bool hasFocus;
+};
+
+struct KeyStateView {
+    const unsigned char* keyBits;   // KEYSTATE_BITS_SIZE bytes
+    bool hasFocus;
+
+    inline bool isPressed(int code) const {
+        return code >= 0 && code < static_cast<int>(KEYSTATE_BITS_SIZE * 8) && (keyBits[code / 8] & (1 << (code % 8)));
+    }
+};
+
+struct ClientOptions {
+    std::string serverAddress{"127.0.0.1"};
+    int serverPort{SERVER_PORT};
+    int listenPort{CLIENT_PORT};
+
+    // Subscribes to this server profile instead of the default one, the server then answers at listenPort (and not
+    // its own clientPort) so several clients can share a host
+    std::string profile;
+
+    // A ping goes out every interval, after this many go unanswered the client considers the server gone and
+    // handshakes again until it answers
+    std::chrono::milliseconds keepaliveInterval{1000};
+    int missedKeepalives{3};
+};
+
+// Consumer side of the protocol: handshake, keepalive, acks for reliable key events and decoding. Either call attach()
+// and dispatch() from your own event loop, or beginListening() to have a thread do it. Callbacks run on whichever
+// thread calls dispatch().
+class SocketClient {
+public:
+    using KeyCb = std::function<void(const KeyEvent&)>;
+    using KeyHeldCb = std::function<void(const KeyHeldEvent&)>;
+    using FocusCb = std::function<void(const FocusView&)>;
+    using KeyStateCb = std::function<void(const KeyStateView&)>;
+    using ConnectionCb = std::function<void(bool)>;
+    using ReconfigureAckCb = std::function<void(std::uint64_t)>;
+    using AxisCb = std::function<void(const std::vector<AxisEvent>&)>;   // one datagram's batch, the vector is reused
+
+    explicit SocketClient(ClientOptions options = {});
+    SocketClient(const SocketClient&) = delete;
+    SocketClient& operator=(const SocketClient&) = delete;
+    ~SocketClient();
+
+    // Binds the listen port and says hello. Returns an fd that is readable whenever dispatch() has work, or -1.
+    int attach();
+    void dispatch();
+
+    void beginListening();
+    void stopListening();
+
+    inline bool isAlive() {
+        return m_thAlive.load();
+    }
+
+    // Reliable key events arrive here in the order they were sent
+    inline void setKeyCb(KeyCb cb) {
+        m_keyCb = std::move(cb);
+    }
+
+    inline void setKeyHeldCb(KeyHeldCb cb) {
+        m_keyHeldCb = std::move(cb);
+    }
+
+    inline void setFocusCb(FocusCb cb) {
+        m_focusCb = std::move(cb);
+    }
+
+    // Also called in sequence with reliable key events when the server replaces ones it gave up on with a snapshot
+    inline void setKeyStateCb(KeyStateCb cb) {
+        m_keyStateCb = std::move(cb);
+    }
+
+    inline void setConnectionCb(ConnectionCb cb) {
+        m_connectionCb = std::move(cb);
+    }
+
+    inline void setReconfigureAckCb(ReconfigureAckCb cb) {
+        m_reconfigureAckCb = std::move(cb);
+    }
+
+    inline void setAxisCb(AxisCb cb) {
+        m_axisCb = std::move(cb);
+    }
+
+    void requestKeyState();
+    void reconfigure(const ReconfigureRequest& request);
+
+    inline bool isConnected() {
+        return m_connected.load();
+    }
+
+    // Round trip of the most recent ping, and a moving average over recent ones
+    inline std::chrono::microseconds lastRtt() {
+        return std::chrono::microseconds{m_lastRttUs.load()};
+    }
+
+    inline std::chrono::microseconds smoothedRtt() {
+        return std::chrono::microseconds{m_smoothedRttUs.load()};
+    }
+
+private:
+    void closeSockets();
+    void send(const char* buffer, std::size_t bufferSize);
+    void sendHello();
+    void sendPing();
+    void handleDatagram(const char* buffer, std::size_t bufferSize);
+    void handleKeepalive();
+    void setConnected(bool connected);
+
+    ClientOptions m_options;
+    sockaddr_in m_serverAddr{};
+    int m_sockfd{-1};
+    int m_timerFd{-1};
+    int m_epollFd{-1};
+
+    char m_buffer[2048];
+    SequenceWindow<KeyEvent> m_sequence;
+    bool m_ackPending{false};
+    int m_unansweredPings{0};
+    std::vector<AxisEvent> m_axisEvents;
+
+    std::atomic_bool m_connected{false};
+    std::atomic<std::int64_t> m_lastRttUs{0};
+    std::atomic<std::int64_t> m_smoothedRttUs{0};
+
+    std::atomic_bool m_thAlive{false};
+    std::shared_ptr<std::thread> m_th;
+
+    KeyCb m_keyCb;
+    KeyHeldCb m_keyHeldCb;
+    FocusCb m_focusCb;
+    KeyStateCb m_keyStateCb;
+    ConnectionCb m_connectionCb;
+    ReconfigureAckCb m_reconfigureAckCb;
+    AxisCb m_axisCb;
+};
+
+}
+
+#endif //GWIDI_INPUTSERVER_GWIDISOCKETCLIENT_H
@@ -0,0 +1,649 @@
+#include "GwidiProtocol.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Drives a running server with a weighted mix of every client -> server message, subscribes as its client and
+// measures the replies. Prints achieved rate, loss and reply latency percentiles every report interval, and the
+// server's own counters (via EVENT_STATS) at the end. Run the server with --null-sendinput so EVENT_SENDINPUT does
+// not need /dev/uinput. Binds the client port, so no other client can be running. --sources sends from that many
+// sockets (source ports) round robin, which is what spreads load over a server's --listeners shards.
+//
+//   gwidi_loadgen [--server <addr>] [--port <port>] [--listen-port <port>] [--sources <n>]
+//                 [--rate <msgs/s>] [--duration <s>] [--report <s>]
+//                 [--mix hello=1,ping=40,keystate=10,reconfigure=5,sendinput=30,stats=1,malformed=10,unknown=3]
+
+using namespace gwidi::udpsocket;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+enum Kind {
+    KIND_HELLO = 0,
+    KIND_PING,
+    KIND_KEYSTATE,
+    KIND_RECONFIGURE,
+    KIND_SENDINPUT,
+    KIND_STATS,
+    KIND_MALFORMED,
+    KIND_UNKNOWN,
+    KIND_COUNT
+};
+
+const char* kindNames[KIND_COUNT] = {"hello", "ping", "keystate", "reconfigure", "sendinput", "stats", "malformed", "unknown"};
+
+// Log-linear latency histogram, 32 sub-buckets per power of two of microseconds. Fixed size so a soak run can keep
+// every sample.
+class Histogram {
+public:
+    void record(std::int64_t us) {
+        auto value = static_cast<std::uint64_t>(std::max<std::int64_t>(us, 0));
+        m_buckets[bucketFor(value)]++;
+        m_count++;
+        m_max = std::max(m_max, value);
+    }
+
+    std::uint64_t percentile(double p) const {
+        if(m_count == 0) {
+            return 0;
+        }
+        auto target = static_cast<std::uint64_t>(std::ceil(p / 100.0 * m_count));
+        std::uint64_t seen = 0;
+        for(std::size_t i = 0; i < m_buckets.size(); i++) {
+            seen += m_buckets[i];
+            if(seen >= target) {
+                return std::min(upperBound(i), m_max);
+            }
+        }
+        return m_max;
+    }
+
+    std::uint64_t count() const {
+        return m_count;
+    }
+
+    std::uint64_t max() const {
+        return m_max;
+    }
+
+private:
+    static constexpr std::size_t SUB_BUCKETS = 32;
+
+    static std::size_t bucketFor(std::uint64_t value) {
+        if(value < SUB_BUCKETS) {
+            return value;
+        }
+        auto magnitude = 63 - __builtin_clzll(value);     // >= 5
+        auto sub = (value >> (magnitude - 5)) & (SUB_BUCKETS - 1);
+        return std::min<std::size_t>((magnitude - 4) * SUB_BUCKETS + sub, BUCKETS - 1);
+    }
+
+    static std::uint64_t upperBound(std::size_t bucket) {
+        if(bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        auto magnitude = bucket / SUB_BUCKETS + 4;
+        auto sub = bucket % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (magnitude - 5)) - 1;
+    }
+
+    static constexpr std::size_t BUCKETS = SUB_BUCKETS * 40;
+    std::array<std::uint64_t, BUCKETS> m_buckets{};
+    std::uint64_t m_count{0};
+    std::uint64_t m_max{0};
+};
+
+struct Options {
+    std::string server{"127.0.0.1"};
+    int port{SERVER_PORT};
+    int listenPort{CLIENT_PORT};
+    int sources{1};
+    double rate{1000};
+    double durationS{10};
+    double reportS{1};
+    std::array<double, KIND_COUNT> mix{1, 40, 10, 5, 30, 1, 10, 3};
+};
+
+// What a reply is matched against. Pings carry their send time, everything else is matched FIFO per reply type,
+// which is exact as long as nothing is lost in between (loopback keeps order).
+struct Expected {
+    std::mutex mutex;
+    std::deque<Clock::time_point> sentAt;
+};
+
+class LoadGen {
+public:
+    explicit LoadGen(Options options) : m_options{std::move(options)} {}
+
+    bool open() {
+        m_sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+        int bufferSize = 8 * 1024 * 1024;
+        setsockopt(m_sockfd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+        setsockopt(m_sockfd, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+
+        sockaddr_in listenAddr{};
+        listenAddr.sin_family = AF_INET;
+        listenAddr.sin_port = htons(m_options.listenPort);
+        listenAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        if(bind(m_sockfd, reinterpret_cast<sockaddr*>(&listenAddr), sizeof(listenAddr)) != 0) {
+            fprintf(stderr, "Unable to bind client port %d, is another client running?\n", m_options.listenPort);
+            return false;
+        }
+
+        // The listening socket is the first source, replies always come back to it
+        m_sendFds.emplace_back(m_sockfd);
+        for(auto i = 1; i < m_options.sources; i++) {
+            auto sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+            setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+            m_sendFds.emplace_back(sockfd);
+        }
+
+        m_serverAddr.sin_family = AF_INET;
+        m_serverAddr.sin_port = htons(m_options.port);
+        m_serverAddr.sin_addr.s_addr = inet_addr(m_options.server.c_str());
+        return true;
+    }
+
+    int run() {
+        m_receiving.store(true);
+        std::thread receiver([this] {
+            receiveLoop();
+        });
+
+        auto before = fetchStats();
+        if(before.empty()) {
+            fprintf(stderr, "No EVENT_STATS reply, is the server running?\n");
+        }
+        // Subscribe first so anything the server pushes (keys, focus) is counted too
+        sendOne(KIND_HELLO);
+
+        m_sending.store(true);
+        std::thread sender([this] {
+            sendLoop();
+        });
+
+        auto start = Clock::now();
+        auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_options.durationS));
+        auto nextReport = start;
+        auto reportInterval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_options.reportS));
+        while(Clock::now() < end) {
+            nextReport += reportInterval;
+            std::this_thread::sleep_until(std::min(nextReport, end));
+            report(false);
+        }
+        m_sending.store(false);
+        sender.join();
+
+        // Let in-flight replies land before counting them as lost
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        report(true);
+
+        auto after = fetchStats();
+        m_receiving.store(false);
+        receiver.join();
+        serverReport(before, after);
+        for(auto sockfd : m_sendFds) {
+            close(sockfd);
+        }
+        return 0;
+    }
+
+private:
+    void sendLoop() {
+        std::mt19937 rng{std::random_device{}()};
+        std::discrete_distribution<int> pick(m_options.mix.begin(), m_options.mix.end());
+        auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_options.rate));
+
+        auto next = Clock::now();
+        while(m_sending.load()) {
+            sendOne(static_cast<Kind>(pick(rng)), rng());
+            next += interval;
+
+            auto now = Clock::now();
+            if(next > now) {
+                std::this_thread::sleep_until(next);
+            }
+            else if(now - next > std::chrono::milliseconds(100)) {
+                // Too far behind to catch up in a burst, the report shows the achieved rate instead
+                next = now;
+            }
+        }
+    }
+
+    void sendOne(Kind kind, std::uint32_t noise = 0) {
+        std::string buffer;
+        auto append = [&buffer](const void* data, std::size_t size) {
+            buffer.append(reinterpret_cast<const char*>(data), size);
+        };
+        auto appendInt = [&append](int value) {
+            append(&value, sizeof(value));
+        };
+        auto appendSize = [&append](std::size_t value) {
+            append(&value, sizeof(value));
+        };
+
+        Expected* expected = nullptr;
+        switch(kind) {
+            case KIND_HELLO: {
+                appendInt(EVENT_HELLO);
+                appendSize(strlen(HELLO_MESSAGE));
+                append(HELLO_MESSAGE, strlen(HELLO_MESSAGE));
+                expected = &m_expected[EVENT_HELLO];
+                // The helloback is followed by a key state snapshot
+                std::lock_guard<std::mutex> lock(m_expected[EVENT_KEYSTATE].mutex);
+                m_expected[EVENT_KEYSTATE].sentAt.emplace_back(Clock::now());
+                break;
+            }
+            case KIND_PING: {
+                appendInt(EVENT_PING);
+                std::uint64_t token = Clock::now().time_since_epoch().count();
+                append(&token, sizeof(token));
+                break;
+            }
+            case KIND_KEYSTATE: {
+                appendInt(EVENT_KEYSTATE_REQUEST);
+                expected = &m_expected[EVENT_KEYSTATE];
+                break;
+            }
+            case KIND_RECONFIGURE: {
+                // No fields: goes through parsing, a new snapshot and the ack without changing what the server does
+                appendInt(EVENT_RECONFIGURE);
+                appendSize(0);
+                expected = &m_expected[EVENT_RECONFIGURE_ACK];
+                break;
+            }
+            case KIND_SENDINPUT: {
+                appendInt(EVENT_SENDINPUT);
+                char key = static_cast<char>('0' + noise % 10);
+                appendSize(1);
+                append(&key, 1);
+                break;
+            }
+            case KIND_STATS: {
+                appendInt(EVENT_STATS);
+                expected = &m_expected[EVENT_STATS];
+                break;
+            }
+            case KIND_MALFORMED: {
+                // Each of these has to be rejected by the server's length checks
+                switch(noise % 5) {
+                    case 0: {
+                        buffer.assign("\x01\x02", 2);   // shorter than the type
+                        break;
+                    }
+                    case 1: {
+                        appendInt(EVENT_HELLO);
+                        appendSize(1u << 20);           // length prefix past the end
+                        append(HELLO_MESSAGE, strlen(HELLO_MESSAGE));
+                        break;
+                    }
+                    case 2: {
+                        appendInt(EVENT_RECONFIGURE);
+                        appendSize(3);                  // promises fields that are not there
+                        appendInt(RECONFIGURE_WINDOW_NAME);
+                        break;
+                    }
+                    case 3: {
+                        appendInt(EVENT_PING);          // token cut short
+                        append("\x01\x02\x03", 3);
+                        break;
+                    }
+                    default: {
+                        appendInt(EVENT_SENDINPUT);
+                        appendSize(~std::size_t{0});    // overflowing size
+                        break;
+                    }
+                }
+                break;
+            }
+            case KIND_UNKNOWN: {
+                appendInt(1000 + static_cast<int>(noise % 100));
+                appendInt(static_cast<int>(noise));
+                break;
+            }
+            default: {
+                return;
+            }
+        }
+
+        if(expected) {
+            std::lock_guard<std::mutex> lock(expected->mutex);
+            expected->sentAt.emplace_back(Clock::now());
+        }
+        auto sendFd = m_sendFds[m_nextSource++ % m_sendFds.size()];
+        auto sent = sendto(sendFd, buffer.data(), buffer.size(), 0, reinterpret_cast<sockaddr*>(&m_serverAddr), sizeof(m_serverAddr));
+        if(sent < 0) {
+            m_sendErrors.fetch_add(1);
+            if(expected) {
+                std::lock_guard<std::mutex> lock(expected->mutex);
+                expected->sentAt.pop_back();
+            }
+            return;
+        }
+        m_sent[kind].fetch_add(1);
+    }
+
+    void receiveLoop() {
+        char buffer[65536];
+        pollfd pfd{m_sockfd, POLLIN, 0};
+        while(m_receiving.load()) {
+            if(poll(&pfd, 1, 100) <= 0) {
+                continue;
+            }
+            auto received = recv(m_sockfd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if(received < static_cast<ssize_t>(sizeof(int))) {
+                continue;
+            }
+            auto now = Clock::now();
+            int type;
+            memcpy(&type, buffer, sizeof(int));
+
+            std::lock_guard<std::mutex> lock(m_resultsMutex);
+            if(type >= 0 && type < static_cast<int>(m_received.size())) {
+                m_received[type]++;
+            }
+            switch(type) {
+                case EVENT_PONG: {
+                    std::uint64_t token;
+                    if(received >= static_cast<ssize_t>(sizeof(int) + sizeof(token))) {
+                        memcpy(&token, buffer + sizeof(int), sizeof(token));
+                        auto sentAt = Clock::time_point{Clock::duration{static_cast<Clock::rep>(token)}};
+                        auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - sentAt).count();
+                        m_latency[EVENT_PONG].record(us);
+                        m_intervalLatency.record(us);
+                    }
+                    break;
+                }
+                case EVENT_KEY_RELIABLE:
+                case EVENT_KEYSTATE_RELIABLE: {
+                    // Ack everything right away so the server doesn't spend its time retransmitting to us
+                    char ack[sizeof(int) + sizeof(std::uint32_t)];
+                    int ackType = EVENT_KEY_ACK;
+                    memcpy(ack, &ackType, sizeof(int));
+                    memcpy(ack + sizeof(int), buffer + sizeof(int), sizeof(std::uint32_t));
+                    sendto(m_sockfd, ack, sizeof(ack), 0, reinterpret_cast<sockaddr*>(&m_serverAddr), sizeof(m_serverAddr));
+                    m_acksSent++;
+                    break;
+                }
+                case EVENT_STATS: {
+                    m_lastStats.assign(buffer, received);
+                    matchFifo(type, now);
+                    break;
+                }
+                default: {
+                    matchFifo(type, now);
+                    break;
+                }
+            }
+        }
+    }
+
+    void matchFifo(int type, Clock::time_point now) {
+        if(type < 0 || type >= static_cast<int>(m_expected.size())) {
+            return;
+        }
+        auto &expected = m_expected[type];
+        std::lock_guard<std::mutex> lock(expected.mutex);
+        if(expected.sentAt.empty()) {
+            // Not a reply, e.g. a key state snapshot pushed on focus gain
+            return;
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - expected.sentAt.front()).count();
+        m_latency[type].record(us);
+        m_intervalLatency.record(us);
+        expected.sentAt.pop_front();
+    }
+
+    void report(bool final) {
+        auto now = Clock::now();
+        std::uint64_t sent = 0;
+        std::array<std::uint64_t, KIND_COUNT> sentByKind{};
+        for(auto kind = 0; kind < KIND_COUNT; kind++) {
+            sentByKind[kind] = m_sent[kind].load();
+            sent += sentByKind[kind];
+        }
+
+        std::lock_guard<std::mutex> lock(m_resultsMutex);
+        if(!final) {
+            auto elapsed = std::chrono::duration<double>(now - m_lastReportAt).count();
+            if(m_lastReportAt == Clock::time_point{}) {
+                elapsed = m_options.reportS;
+            }
+            auto &interval = m_intervalLatency;
+            printf("sent %8.0f/s  received %8.0f/s  replies p50 %5luus p99 %6luus max %6luus\n",
+                   (sent - m_lastSent) / elapsed, (totalReceived() - m_lastReceived) / elapsed,
+                   static_cast<unsigned long>(interval.percentile(50)), static_cast<unsigned long>(interval.percentile(99)),
+                   static_cast<unsigned long>(interval.max()));
+            m_lastSent = sent;
+            m_lastReceived = totalReceived();
+            m_lastReportAt = now;
+            m_intervalLatency = {};
+            return;
+        }
+
+        printf("\n%-12s %10s %10s %8s %8s %8s %8s %8s %8s\n", "reply", "expected", "received", "loss%", "p50us", "p90us", "p99us", "p99.9us", "maxus");
+        auto row = [this](const char* name, std::uint64_t expected, int type) {
+            auto received = m_latency[type].count();
+            auto loss = expected ? 100.0 * (static_cast<double>(expected) - static_cast<double>(received)) / expected : 0.0;
+            auto &h = m_latency[type];
+            printf("%-12s %10lu %10lu %8.2f %8lu %8lu %8lu %8lu %8lu\n", name, static_cast<unsigned long>(expected),
+                   static_cast<unsigned long>(received), loss, static_cast<unsigned long>(h.percentile(50)),
+                   static_cast<unsigned long>(h.percentile(90)), static_cast<unsigned long>(h.percentile(99)),
+                   static_cast<unsigned long>(h.percentile(99.9)), static_cast<unsigned long>(h.max()));
+        };
+        row("pong", sentByKind[KIND_PING], EVENT_PONG);
+        row("helloback", sentByKind[KIND_HELLO], EVENT_HELLO);
+        row("keystate", sentByKind[KIND_KEYSTATE] + sentByKind[KIND_HELLO], EVENT_KEYSTATE);
+        row("reconf ack", sentByKind[KIND_RECONFIGURE], EVENT_RECONFIGURE_ACK);
+        row("stats", sentByKind[KIND_STATS], EVENT_STATS);
+
+        printf("\nsent:");
+        for(auto kind = 0; kind < KIND_COUNT; kind++) {
+            printf(" %s=%lu", kindNames[kind], static_cast<unsigned long>(sentByKind[kind]));
+        }
+        printf(" (send errors %lu)\n", static_cast<unsigned long>(m_sendErrors.load()));
+        printf("pushed by the server: key=%lu key_reliable=%lu focus=%lu\n", static_cast<unsigned long>(m_received[EVENT_KEY]),
+               static_cast<unsigned long>(m_received[EVENT_KEY_RELIABLE]), static_cast<unsigned long>(m_received[EVENT_FOCUS]));
+    }
+
+    std::uint64_t totalReceived() {
+        std::uint64_t total = 0;
+        for(auto count : m_received) {
+            total += count;
+        }
+        return total;
+    }
+
+    // Asks for EVENT_STATS outside of the measured mix, returns name -> value
+    std::map<std::string, std::uint64_t> fetchStats() {
+        {
+            std::lock_guard<std::mutex> lock(m_resultsMutex);
+            m_lastStats.clear();
+        }
+        int type = EVENT_STATS;
+        for(auto attempt = 0; attempt < 10; attempt++) {
+            sendto(m_sockfd, &type, sizeof(type), 0, reinterpret_cast<sockaddr*>(&m_serverAddr), sizeof(m_serverAddr));
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            std::lock_guard<std::mutex> lock(m_resultsMutex);
+            if(!m_lastStats.empty()) {
+                // Not part of the mix, take it back out of the reply accounting
+                m_received[EVENT_STATS]--;
+                return parseStats(m_lastStats);
+            }
+        }
+        return {};
+    }
+
+    static std::map<std::string, std::uint64_t> parseStats(const std::string& buffer) {
+        std::map<std::string, std::uint64_t> ret;
+        std::size_t offset = sizeof(int);
+        auto read = [&](void* dst, std::size_t size) {
+            if(buffer.size() - offset < size) {
+                return false;
+            }
+            memcpy(dst, buffer.data() + offset, size);
+            offset += size;
+            return true;
+        };
+
+        std::size_t count;
+        if(!read(&count, sizeof(count))) {
+            return ret;
+        }
+        for(std::size_t i = 0; i < count; i++) {
+            std::size_t nameSize;
+            bool isCounter;
+            std::uint64_t value;
+            if(!read(&nameSize, sizeof(nameSize)) || nameSize > buffer.size() - offset) {
+                break;
+            }
+            std::string name{buffer.data() + offset, nameSize};
+            offset += nameSize;
+            if(!read(&isCounter, sizeof(isCounter)) || !read(&value, sizeof(value))) {
+                break;
+            }
+            ret[name] = value;
+        }
+        return ret;
+    }
+
+    void serverReport(const std::map<std::string, std::uint64_t>& before, const std::map<std::string, std::uint64_t>& after) {
+        if(before.empty() || after.empty()) {
+            printf("\nserver counters unavailable\n");
+            return;
+        }
+
+        std::uint64_t sent = 0;
+        for(auto &count : m_sent) {
+            sent += count.load();
+        }
+        auto delta = [&](const char* name) -> std::int64_t {
+            auto b = before.find(name);
+            auto a = after.find(name);
+            if(a == after.end() || b == before.end()) {
+                return 0;
+            }
+            return static_cast<std::int64_t>(a->second - b->second);
+        };
+
+        // The closing stats request and our key acks are counted by the server as well
+        auto datagramsIn = delta("gwidi_datagrams_in_total") - 1 - static_cast<std::int64_t>(m_acksSent);
+        printf("\nserver: datagrams in %ld of %lu sent (%.3f%% dropped before the server read them)\n",
+               static_cast<long>(datagramsIn), static_cast<unsigned long>(sent),
+               sent ? 100.0 * (static_cast<double>(sent) - datagramsIn) / sent : 0.0);
+        printf("server: parse failures %ld, unknown types %ld, send errors %ld, uinput writes %ld, uinput errors %ld\n",
+               static_cast<long>(delta("gwidi_parse_failures_total")), static_cast<long>(delta("gwidi_unknown_message_types_total")),
+               static_cast<long>(delta("gwidi_send_errors_total")), static_cast<long>(delta("gwidi_uinput_writes_total")),
+               static_cast<long>(delta("gwidi_uinput_errors_total")));
+    }
+
+    Options m_options;
+    int m_sockfd{-1};
+    std::vector<int> m_sendFds;
+    std::size_t m_nextSource{0};    // sender thread only
+    sockaddr_in m_serverAddr{};
+
+    std::atomic_bool m_sending{false};
+    std::atomic_bool m_receiving{false};
+    std::array<std::atomic<std::uint64_t>, KIND_COUNT> m_sent{};
+    std::atomic<std::uint64_t> m_sendErrors{0};
+    std::array<Expected, EVENT_PONG + 1> m_expected;
+
+    std::mutex m_resultsMutex;
+    std::array<std::uint64_t, EVENT_PONG + 1> m_received{};
+    std::array<Histogram, EVENT_PONG + 1> m_latency;
+    Histogram m_intervalLatency;
+    std::uint64_t m_acksSent{0};
+    std::string m_lastStats;
+
+    Clock::time_point m_lastReportAt{};
+    std::uint64_t m_lastSent{0};
+    std::uint64_t m_lastReceived{0};
+};
+
+bool parseMix(const char* spec, std::array<double, KIND_COUNT>& mix) {
+    mix.fill(0);
+    std::string s{spec};
+    std::size_t start = 0;
+    while(start < s.size()) {
+        auto end = s.find(',', start);
+        auto item = s.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        auto eq = item.find('=');
+        auto found = false;
+        for(auto kind = 0; kind < KIND_COUNT && eq != std::string::npos; kind++) {
+            if(item.compare(0, eq, kindNames[kind]) == 0) {
+                mix[kind] = atof(item.c_str() + eq + 1);
+                found = true;
+            }
+        }
+        if(!found) {
+            fprintf(stderr, "Unknown mix entry: %s\n", item.c_str());
+            return false;
+        }
+        if(end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    for(auto i = 1; i + 1 < argc; i++) {
+        if(strcmp(argv[i], "--server") == 0) {
+            options.server = argv[++i];
+        }
+        else if(strcmp(argv[i], "--port") == 0) {
+            options.port = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--listen-port") == 0) {
+            options.listenPort = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--sources") == 0) {
+            options.sources = std::max(1, atoi(argv[++i]));
+        }
+        else if(strcmp(argv[i], "--rate") == 0) {
+            options.rate = std::max(1.0, atof(argv[++i]));
+        }
+        else if(strcmp(argv[i], "--duration") == 0) {
+            options.durationS = atof(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--report") == 0) {
+            options.reportS = std::max(0.1, atof(argv[++i]));
+        }
+        else if(strcmp(argv[i], "--mix") == 0) {
+            if(!parseMix(argv[++i], options.mix)) {
+                return 1;
+            }
+        }
+    }
+
+    LoadGen loadGen{options};
+    if(!loadGen.open()) {
+        return 1;
+    }
+    return loadGen.run();
+}
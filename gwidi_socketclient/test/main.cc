@@ -0,0 +1,107 @@
+#include "GwidiSocketClient.h"
+#include <cstring>
+#include <string_view>
+#include <cstdio>
+#include <linux/input-event-codes.h>
+
+int main(int argc, char** argv) {
+
+    // --profile <name> subscribes to a server profile, --listen-port <port> lets several of these run side by side
+    gwidi::udpsocket::ClientOptions options;
+    for(auto i = 1; i + 1 < argc; i++) {
+        if(strcmp(argv[i], "--profile") == 0) {
+            options.profile = argv[i + 1];
+        }
+        else if(strcmp(argv[i], "--listen-port") == 0) {
+            options.listenPort = atoi(argv[i + 1]);
+        }
+    }
+    gwidi::udpsocket::SocketClient client{options};
+
+    // Connects to a running server and prints whatever it forwards, along with the round trip time every 2s
+    client.setConnectionCb([&client](bool connected) {
+        printf("connected: %d\n", connected);
+        if(connected) {
+            client.requestKeyState();
+        }
+    });
+    client.setKeyCb([](const gwidi::udpsocket::KeyEvent &event) {
+        printf("key: %d, type: %d\n", event.code, event.eventType);
+    });
+    client.setKeyHeldCb([](const gwidi::udpsocket::KeyHeldEvent &event) {
+        printf("key held: %d, for: %ums\n", event.code, event.heldMs);
+    });
+    client.setFocusCb([](const gwidi::udpsocket::FocusView &focus) {
+        printf("focus: %.*s, hasFocus: %d\n", static_cast<int>(focus.windowName.size()), focus.windowName.data(), focus.hasFocus);
+    });
+    client.setKeyStateCb([](const gwidi::udpsocket::KeyStateView &keyState) {
+        printf("key state, hasFocus: %d, pressed:", keyState.hasFocus);
+        for(auto code = 0; code < 0x100; code++) {
+            if(keyState.isPressed(code)) {
+                printf(" %d", code);
+            }
+        }
+        printf("\n");
+    });
+    client.setAxisCb([](const std::vector<gwidi::udpsocket::AxisEvent> &events) {
+        for(auto &event : events) {
+            printf("axis: type %d, code %d, value %d\n", event.evType, event.code, event.value);
+        }
+    });
+    client.setReconfigureAckCb([](std::uint64_t version) {
+        printf("reconfigured, version: %lu\n", static_cast<unsigned long>(version));
+    });
+
+    client.beginListening();
+
+    // --keys <code,code,...> asks the server to watch these keys once connected, --axes <interval ms> turns on axis
+    // forwarding for every EV_ABS / EV_REL axis with that rate limit, --repeat <all|throttled|held>[:ms] forwards
+    // autorepeat of every watched key
+    for(auto i = 1; i + 1 < argc; i++) {
+        if(strcmp(argv[i], "--axes") == 0) {
+            while(!client.isConnected()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            auto intervalMs = static_cast<std::uint32_t>(atoi(argv[i + 1]));
+            gwidi::udpsocket::ReconfigureRequest request;
+            request.axes = gwidi::udpsocket::AxisSettings{true, {
+                    {EV_ABS, -1, 0, 0, 1, intervalMs},
+                    {EV_REL, -1, 0, 0, 1, intervalMs}
+            }};
+            client.reconfigure(request);
+        }
+        if(strcmp(argv[i], "--repeat") == 0) {
+            while(!client.isConnected()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            std::string_view arg{argv[i + 1]};
+            auto sep = arg.find(':');
+            auto name = arg.substr(0, sep);
+            auto mode = name == "all" ? gwidi::udpsocket::REPEAT_ALL :
+                        name == "throttled" ? gwidi::udpsocket::REPEAT_THROTTLED :
+                        name == "held" ? gwidi::udpsocket::REPEAT_HELD : gwidi::udpsocket::REPEAT_OFF;
+            auto intervalMs = sep == std::string_view::npos ? 0u : static_cast<std::uint32_t>(atoi(argv[i + 1] + sep + 1));
+            gwidi::udpsocket::ReconfigureRequest request;
+            request.repeats = std::vector<gwidi::udpsocket::RepeatRule>{{-1, mode, intervalMs}};
+            client.reconfigure(request);
+        }
+        if(strcmp(argv[i], "--keys") == 0) {
+            while(!client.isConnected()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            gwidi::udpsocket::ReconfigureRequest request;
+            request.watchedKeys.emplace();
+            for(auto key = strtok(argv[i + 1], ","); key; key = strtok(nullptr, ",")) {
+                request.watchedKeys->emplace_back(atoi(key));
+            }
+            client.reconfigure(request);
+        }
+    }
+
+    while(client.isAlive()) {
+        std::this_thread::sleep_for(std::chrono::seconds(2));
+        printf("rtt: %ldus, smoothed: %ldus\n", static_cast<long>(client.lastRtt().count()), static_cast<long>(client.smoothedRtt().count()));
+    }
+
+    return 0;
+}
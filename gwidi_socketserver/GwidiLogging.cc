@@ -0,0 +1,89 @@
+#include "GwidiLogging.h"
+
+#include <spdlog/async.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <cstdio>
+#include <ctime>
+
+namespace gwidi::logging {
+
+static std::int64_t monotonicNs() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void initAsyncLogging(std::size_t queueSize) {
+    if(spdlog::get("gwidi")) {
+        return;
+    }
+
+    spdlog::init_thread_pool(queueSize, 1);
+    auto logger = spdlog::create_async_nb<spdlog::sinks::stdout_color_sink_mt>("gwidi");
+    logger->set_level(spdlog::get_level());
+    logger->set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%^%l%$] %v");  // same as the default logger, minus logger name / source
+    spdlog::set_default_logger(logger);
+}
+
+bool RateLimiter::allow() {
+    auto now = monotonicNs();
+    auto next = m_nextNs.load(std::memory_order_relaxed);
+    if(now < next) {
+        return false;
+    }
+    // Only one thread wins the slot for this interval
+    return m_nextNs.compare_exchange_strong(next, now + m_intervalNs, std::memory_order_relaxed);
+}
+
+EventTrace &EventTrace::instance() {
+    static EventTrace trace;
+    return trace;
+}
+
+void EventTrace::enable(std::size_t capacity) {
+    if(m_enabled.load()) {
+        return;
+    }
+
+    std::size_t size = 1;
+    while(size < capacity) {
+        size <<= 1;
+    }
+    m_records = std::make_unique<Record[]>(size);
+    m_mask = size - 1;
+    m_enabled.store(true);
+}
+
+void EventTrace::record(TraceKind kind, int code, int value) {
+    auto slot = m_next.fetch_add(1, std::memory_order_relaxed) & m_mask;
+    m_records[slot] = Record{
+        static_cast<std::uint64_t>(monotonicNs()),
+        static_cast<std::uint16_t>(kind),
+        static_cast<std::uint16_t>(code),
+        static_cast<std::int32_t>(value)
+    };
+}
+
+bool EventTrace::dump(const std::string &path) {
+    if(!m_enabled.load()) {
+        return false;
+    }
+
+    auto file = fopen(path.c_str(), "wb");
+    if(file == nullptr) {
+        spdlog::error("Unable to open event trace file: {}", path);
+        return false;
+    }
+
+    auto written = m_next.load();
+    auto size = m_mask + 1;
+    auto count = written < size ? written : size;
+    for(std::uint64_t i = written - count; i < written; i++) {
+        fwrite(&m_records[i & m_mask], sizeof(Record), 1, file);
+    }
+    fclose(file);
+    spdlog::info("Wrote {} event trace records to {}", count, path);
+    return true;
+}
+
+}
@@ -0,0 +1,270 @@
+#include "GwidiMetrics.h"
+#include "LinuxSendInput.h"
+
+#include <spdlog/spdlog.h>
+#include <spdlog/async.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+
+namespace gwidi::metrics {
+
+static const char* counterNames[] = {
+        "gwidi_datagrams_in_total",
+        "gwidi_datagrams_out_total",
+        "gwidi_bytes_in_total",
+        "gwidi_bytes_out_total",
+        "gwidi_send_errors_total",
+        "gwidi_parse_failures_total",
+        "gwidi_unknown_message_types_total",
+        "gwidi_evdev_events_read_total",
+        "gwidi_evdev_events_filtered_total",
+        "gwidi_keys_forwarded_total",
+        "gwidi_reconnects_total",
+        "gwidi_retransmits_total",
+        "gwidi_acks_in_total",
+        "gwidi_delivery_failures_total",
+        "gwidi_macros_fired_total",
+        "gwidi_axis_events_forwarded_total",
+        "gwidi_axis_events_suppressed_total",
+        "gwidi_keys_swallowed_total",
+        "gwidi_passthrough_frames_total",
+        "gwidi_passthrough_latency_us_total",
+        "gwidi_passthrough_slow_frames_total",
+        "gwidi_peers_dead_total",
+        "gwidi_heartbeats_out_total",
+        "gwidi_repeats_coalesced_total",
+        "gwidi_control_lane_dropped_total",
+};
+
+static const char* counterHelp[] = {
+        "Datagrams received on the listening socket",
+        "Datagrams sent to clients",
+        "Bytes received on the listening socket",
+        "Bytes sent to clients",
+        "sendto calls that failed",
+        "Datagrams whose declared sizes did not fit the datagram",
+        "Datagrams with an unknown message type",
+        "Events read from evdev devices",
+        "Key events dropped because the key is not watched",
+        "Watched key events handed to the forwarding callback",
+        "Hello messages that replaced an existing client",
+        "Reliable key events sent again because no ack arrived in time",
+        "Key event acks received from the client",
+        "Reliable key events given up on after the last retransmit",
+        "Server-side macros triggered by a watched key",
+        "EV_ABS / EV_REL values handed to the forwarding callback",
+        "EV_ABS / EV_REL values dropped by deadband or quantization, or folded into a later update by the rate limit",
+        "Key events on grabbed keyboards kept from the passthrough clone",
+        "Frames re-emitted through a passthrough clone",
+        "Kernel timestamp to clone write, summed over passthrough frames (divide by the frame count for the mean)",
+        "Passthrough frames that took 1ms or more from the kernel timestamp to the clone write",
+        "Subscribed clients dropped because their port was unreachable",
+        "Heartbeats sent to clients that had gone quiet",
+        "Autorepeats of watched keys held back by the key's repeat interval",
+        "Hellos, reconfigures and other control datagrams dropped because the control lane was full",
+};
+
+static_assert(sizeof(counterNames) / sizeof(counterNames[0]) == static_cast<std::size_t>(Counter::COUNT));
+static_assert(sizeof(counterHelp) / sizeof(counterHelp[0]) == static_cast<std::size_t>(Counter::COUNT));
+
+Metrics &Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::CounterBlock &Metrics::localBlock() {
+    thread_local CounterBlock* block = nullptr;
+    if(block == nullptr) {
+        auto owned = std::make_unique<CounterBlock>();
+        block = owned.get();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_blocks.emplace_back(std::move(owned));
+    }
+    return *block;
+}
+
+int Metrics::registerGauge(const std::string &name, const std::string &help, GaugeFn fn) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto id = m_nextGaugeId++;
+    m_gauges.push_back({id, name, help, std::move(fn)});
+    return id;
+}
+
+void Metrics::unregisterGauge(int id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_gauges.erase(std::remove_if(m_gauges.begin(), m_gauges.end(), [id](const Gauge& g) { return g.id == id; }), m_gauges.end());
+}
+
+std::vector<Sample> Metrics::snapshot() {
+    std::vector<Sample> ret;
+    std::uint64_t totals[static_cast<std::size_t>(Counter::COUNT)]{};
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto &block : m_blocks) {
+        for(std::size_t i = 0; i < static_cast<std::size_t>(Counter::COUNT); i++) {
+            totals[i] += block->values[i].load(std::memory_order_relaxed);
+        }
+    }
+    for(std::size_t i = 0; i < static_cast<std::size_t>(Counter::COUNT); i++) {
+        ret.push_back({counterNames[i], counterHelp[i], true, totals[i]});
+    }
+
+    // uinput lives below us and keeps its own process-wide counts
+    ret.push_back({"gwidi_uinput_writes_total", "Events written to uinput", true, SendInput::writeCount()});
+    ret.push_back({"gwidi_uinput_errors_total", "Failed uinput writes", true, SendInput::errorCount()});
+
+    if(auto pool = spdlog::thread_pool()) {
+        ret.push_back({"gwidi_log_queue_depth", "Messages waiting in the async log queue", false, pool->queue_size()});
+        ret.push_back({"gwidi_log_overruns_total", "Log messages dropped because the queue was full", true, pool->overrun_counter()});
+    }
+
+    for(auto &gauge : m_gauges) {
+        ret.push_back({gauge.name, gauge.help, false, gauge.fn()});
+    }
+    return ret;
+}
+
+std::string Metrics::prometheusText() {
+    std::string ret;
+    for(auto &sample : snapshot()) {
+        ret += "# HELP " + sample.name + " " + sample.help + "\n";
+        ret += "# TYPE " + sample.name + (sample.isCounter ? " counter\n" : " gauge\n");
+        ret += sample.name + " " + std::to_string(sample.value) + "\n";
+    }
+    return ret;
+}
+
+PrometheusExporter::PrometheusExporter(std::string socketPath) : m_socketPath{std::move(socketPath)} {
+}
+
+PrometheusExporter::~PrometheusExporter() {
+    stopListening();
+    if(m_th && m_th->joinable()) {
+        m_th->join();
+    }
+    closeSocket();
+}
+
+int PrometheusExporter::openSocket() {
+    if(m_sockfd >= 0) {
+        return m_sockfd;
+    }
+
+    sockaddr_un addr{};
+    if(m_socketPath.size() >= sizeof(addr.sun_path)) {
+        spdlog::warn("Metrics socket path too long: {}", m_socketPath);
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, m_socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    m_sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(m_socketPath.c_str());
+    if(bind(m_sockfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(m_sockfd, 8) != 0) {
+        spdlog::warn("Failed to bind metrics socket: {}", m_socketPath);
+        closeSocket();
+        return -1;
+    }
+    spdlog::info("Serving metrics on {}", m_socketPath);
+    return m_sockfd;
+}
+
+void PrometheusExporter::closeSocket() {
+    if(m_sockfd >= 0) {
+        close(m_sockfd);
+        unlink(m_socketPath.c_str());
+        m_sockfd = -1;
+    }
+}
+
+void PrometheusExporter::acceptConnections() {
+    int conn;
+    while((conn = accept4(m_sockfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        // Whatever request was sent is irrelevant, there is only one thing to serve. Still give an HTTP client a moment
+        // to send it, closing with the request unread would reset the connection under it.
+        if(m_pending.size() >= MAX_PENDING) {
+            respond(conn);
+            continue;
+        }
+        m_pending.push_back({conn, std::chrono::steady_clock::now() + REQUEST_TIMEOUT});
+    }
+}
+
+void PrometheusExporter::respond(int conn) {
+    char discard[512];
+    while(recv(conn, discard, sizeof(discard), MSG_DONTWAIT) > 0) {}
+
+    auto body = Metrics::instance().prometheusText();
+    auto response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                    std::to_string(body.size()) + "\r\n\r\n" + body;
+    // Fits the socket buffer, a reader that doesn't keep up gets it cut short rather than holding us up
+    std::size_t sent = 0;
+    while(sent < response.size()) {
+        auto n = send(conn, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if(n <= 0) {
+            break;
+        }
+        sent += n;
+    }
+    shutdown(conn, SHUT_WR);
+    close(conn);
+}
+
+void PrometheusExporter::serve() {
+    std::vector<pollfd> pfds;
+    while(m_thAlive.load()) {
+        pfds.assign(1, {m_sockfd, POLLIN, 0});
+        auto timeout = std::chrono::milliseconds{500};
+        auto now = std::chrono::steady_clock::now();
+        for(auto &pending : m_pending) {
+            pfds.push_back({pending.fd, POLLIN, 0});
+            timeout = std::min(timeout, std::chrono::duration_cast<std::chrono::milliseconds>(pending.deadline - now));
+        }
+        if(poll(pfds.data(), pfds.size(), std::max<int>(0, static_cast<int>(timeout.count()))) < 0) {
+            continue;
+        }
+
+        // Answer whoever sent a request or ran out of time, pfds[i + 1] is m_pending[i]
+        now = std::chrono::steady_clock::now();
+        std::size_t kept = 0;
+        for(std::size_t i = 0; i < m_pending.size(); i++) {
+            if(pfds[i + 1].revents != 0 || m_pending[i].deadline <= now) {
+                respond(m_pending[i].fd);
+            }
+            else {
+                m_pending[kept++] = m_pending[i];
+            }
+        }
+        m_pending.resize(kept);
+
+        if(pfds[0].revents & POLLIN) {
+            acceptConnections();
+        }
+    }
+
+    for(auto &pending : m_pending) {
+        close(pending.fd);
+    }
+    m_pending.clear();
+}
+
+void PrometheusExporter::beginListening() {
+    if(m_thAlive.load() || openSocket() < 0) {
+        return;
+    }
+
+    m_thAlive.store(true);
+    m_th = std::make_shared<std::thread>([this] {
+        serve();
+    });
+}
+
+void PrometheusExporter::stopListening() {
+    m_thAlive.store(false);
+}
+
+}
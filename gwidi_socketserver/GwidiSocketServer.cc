@@ -1,61 +1,370 @@
 #include <arpa/inet.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <cstring>
-#include <spdlog/spdlog.h>
+#include <algorithm>
 #include "GwidiSocketServer.h"
+#include "GwidiLogging.h"
+#include "GwidiMetrics.h"
+#include "GwidiProbes.h"
 
 namespace gwidi::udpsocket {
 
+namespace {
+
+// Message types handled on the key lane, anything too short to carry a type is left to processEvent() to reject
+bool onKeyLane(const char* buffer, std::size_t size) {
+    int msg_type;
+    if(size < sizeof(int)) {
+        return true;
+    }
+    memcpy(&msg_type, buffer, sizeof(int));
+    switch(static_cast<ServerEventType>(msg_type)) {
+        case ServerEventType::EVENT_SENDINPUT:
+        case ServerEventType::EVENT_KEY_ACK:
+        case ServerEventType::EVENT_PING:
+            return true;
+        default:
+            return false;
+    }
+}
+
+}
+
 std::string ipForSin(const sockaddr_in& sin) {
     char str[INET_ADDRSTRLEN];
     inet_ntop(AF_INET, &(sin.sin_addr), str, INET_ADDRSTRLEN);
     return {str};
 }
 
-ReaderSocketClient::ReaderSocketClient(const sockaddr_in &toAddr) {
-    sockfd = socket(PF_INET, SOCK_DGRAM, 0);
+ReaderSocketClient::ReaderSocketClient(const sockaddr_in &toAddr, int port)
+    : m_lastHeard{std::chrono::steady_clock::now().time_since_epoch().count()} {
+    sockfd = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
     memset(&m_toAddr, '\0', sizeof(m_toAddr));
     m_toAddr.sin_family = AF_INET;
-    m_toAddr.sin_port = htons(5578);
+    m_toAddr.sin_port = htons(port);
     m_toAddr.sin_addr.s_addr = toAddr.sin_addr.s_addr;
+    if(connect(sockfd, (struct sockaddr*)&m_toAddr, sizeof(m_toAddr)) != 0) {
+        spdlog::warn("Failed to connect to client: {}, errno: {}", ipForSin(m_toAddr), errno);
+    }
+}
+
+ReaderSocketClient::~ReaderSocketClient() {
+    close(sockfd);
+}
+
+ssize_t ReaderSocketClient::sendBuffer(const char *buffer, std::size_t bufferSize) {
+    auto bytesSent = send(sockfd, buffer, bufferSize, 0);
+    GWIDI_PROBE3(send, buffer, bufferSize, bytesSent);
+    if(bytesSent < 0 && errno == ECONNREFUSED) {
+        markDead();
+    }
+    else if(bytesSent < 0) {
+        metrics::count(metrics::Counter::SEND_ERRORS);
+        GWIDI_LOG_EVERY_MS(SPDLOG_WARN, 1000, "Failed to send to client: {}, errno: {}", ipForSin(m_toAddr), errno);
+    }
+    else {
+        metrics::count(metrics::Counter::DATAGRAMS_OUT);
+        metrics::count(metrics::Counter::BYTES_OUT, bytesSent);
+    }
+    SPDLOG_TRACE("Sent {} bytes of data", bytesSent);
+    return bytesSent;
+}
+
+void ReaderSocketClient::markDead() {
+    if(!m_dead.exchange(true)) {
+        metrics::count(metrics::Counter::PEERS_DEAD);
+        spdlog::info("Client: {}, port: {} is gone, not sending to it until it says hello again", ipForSin(m_toAddr),
+                     ntohs(m_toAddr.sin_port));
+    }
+}
+
+bool ReaderSocketClient::heartbeatIfQuiet(std::chrono::steady_clock::time_point now) {
+    // The port unreachable for our last send is queued on the socket, no need to wait for the next send to see it
+    int error = 0;
+    socklen_t errorSize = sizeof(error);
+    if(getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &errorSize) == 0 && error == ECONNREFUSED) {
+        markDead();
+    }
+    if(!isAlive()) {
+        return false;
+    }
+
+    auto lastHeard = std::chrono::steady_clock::time_point{std::chrono::steady_clock::duration{m_lastHeard.load(std::memory_order_relaxed)}};
+    if(lastHeard >= m_lastHeartbeat) {
+        // It talked since our last heartbeat, start over at the shortest interval
+        m_heartbeatInterval = HEARTBEAT_MIN;
+    }
+    // We are called every HEARTBEAT_MIN, one call landing a hair early still counts as due
+    if(now - std::max(lastHeard, m_lastHeartbeat) + HEARTBEAT_MIN / 2 < m_heartbeatInterval) {
+        return true;
+    }
+
+    m_lastHeartbeat = now;
+    m_heartbeatInterval = std::min(m_heartbeatInterval * 2, HEARTBEAT_MAX);
+    metrics::count(metrics::Counter::HEARTBEATS_OUT);
+    sendHeartbeat();
+    return isAlive();
+}
+
+void ReaderSocketClient::sendHeartbeat() {
+    int msg_type = static_cast<int>(ServerEventType::EVENT_HEARTBEAT);
+    sendBuffer(reinterpret_cast<const char*>(&msg_type), sizeof(int));
 }
 
 void ReaderSocketClient::sendKeyEvent(const KeyEvent &event) {
-    auto toIp = ipForSin(m_toAddr);
-    spdlog::info("Sending KeyEvent[ code: {}, eventType: {} ] to client: {}, port: {}", event.code, event.eventType, toIp,
-                 ntohs(m_toAddr.sin_port));
+    SPDLOG_DEBUG("Sending KeyEvent[ code: {}, eventType: {} ] to client: {}, port: {}", event.code, event.eventType,
+                 ipForSin(m_toAddr), ntohs(m_toAddr.sin_port));
 
-    auto eventBuffer = EventBuilder::eventFor(ServerEventType::EVENT_KEY)
-            .withKeyCode(event.code)
-            .withKeyEventType(event.eventType)
-            .build();
+    // Hot path, encoded on the stack rather than through EventBuilder's heap buffer
+    char buffer[3 * sizeof(int)];
+    int msg_type = static_cast<int>(ServerEventType::EVENT_KEY);
+    memcpy(buffer, &msg_type, sizeof(int));
+    memcpy(buffer + sizeof(int), &event.code, sizeof(int));
+    memcpy(buffer + 2 * sizeof(int), &event.eventType, sizeof(int));
+    GWIDI_PROBE3(encode, msg_type, event.code, sizeof(buffer));
+
+    sendBuffer(buffer, sizeof(buffer));
+    GWIDI_TRACE_EVENT(logging::TraceKind::DATAGRAM_OUT, ServerEventType::EVENT_KEY, event.code);
+}
+
+void ReaderSocketClient::sendKeyHeldEvent(const KeyHeldEvent &event) {
+    char buffer[2 * sizeof(int) + sizeof(std::uint32_t)];
+    int msg_type = static_cast<int>(ServerEventType::EVENT_KEY_HELD);
+    memcpy(buffer, &msg_type, sizeof(int));
+    memcpy(buffer + sizeof(int), &event.code, sizeof(int));
+    memcpy(buffer + 2 * sizeof(int), &event.heldMs, sizeof(std::uint32_t));
+    GWIDI_PROBE3(encode, msg_type, event.code, sizeof(buffer));
 
-    auto bytesSent = sendto(sockfd, eventBuffer.buffer, eventBuffer.bufferSize, 0, (struct sockaddr*)&m_toAddr, sizeof(m_toAddr));
-    spdlog::info("Sent {} bytes of data", bytesSent);
+    sendBuffer(buffer, sizeof(buffer));
+    GWIDI_TRACE_EVENT(logging::TraceKind::DATAGRAM_OUT, ServerEventType::EVENT_KEY_HELD, event.code);
 }
 
 void ReaderSocketClient::sendWindowFocusEvent(const std::string &windowName, bool hasFocus) {
-    auto toIp = ipForSin(m_toAddr);
-    spdlog::info("Sending FocusEvent[ windowName: {}, hasFocus: {} ] to client: {}, port: {}", windowName, hasFocus, toIp,
-                 ntohs(m_toAddr.sin_port));
+    spdlog::info("Sending FocusEvent[ windowName: {}, hasFocus: {} ] to client: {}, port: {}", windowName, hasFocus,
+                 ipForSin(m_toAddr), ntohs(m_toAddr.sin_port));
 
     auto eventBuffer = EventBuilder::eventFor(ServerEventType::EVENT_FOCUS)
             .withFocusWindowName(windowName)
             .withFocusHasFocus(hasFocus)
             .build();
 
-    auto bytesSent = sendto(sockfd, eventBuffer.buffer, eventBuffer.bufferSize, 0, (struct sockaddr*)&m_toAddr, sizeof(m_toAddr));
-    spdlog::info("Sent {} bytes of data", bytesSent);
+    sendBuffer(eventBuffer.buffer, eventBuffer.bufferSize);
 }
 
-void ReaderSocketClient::sendHello() {
-    auto toIp = ipForSin(m_toAddr);
+void ReaderSocketClient::sendKeyStateEvent(const KeyStateEvent &event) {
+    // Any sender can ask for one with EVENT_KEYSTATE_REQUEST, so this is per packet
+    SPDLOG_DEBUG("Sending KeyStateEvent[ hasFocus: {} ] to client: {}, port: {}", event.hasFocus, ipForSin(m_toAddr),
+                 ntohs(m_toAddr.sin_port));
+
+    auto eventBuffer = EventBuilder::eventFor(ServerEventType::EVENT_KEYSTATE)
+            .withKeyState(event)
+            .build();
+
+    sendBuffer(eventBuffer.buffer, eventBuffer.bufferSize);
+}
+
+void ReaderSocketClient::sendStats(const std::vector<metrics::Sample> &samples) {
+    // [type][size_t count] followed by [size_t nameSize][name][bool isCounter][uint64 value] per sample
+    std::string buffer;
+    auto append = [&buffer](const void* data, std::size_t size) {
+        buffer.append(reinterpret_cast<const char*>(data), size);
+    };
+
+    int msg_type = static_cast<int>(ServerEventType::EVENT_STATS);
+    append(&msg_type, sizeof(int));
+    std::size_t count = samples.size();
+    append(&count, sizeof(count));
+    for(auto &sample : samples) {
+        std::size_t nameSize = sample.name.size();
+        append(&nameSize, sizeof(nameSize));
+        append(sample.name.data(), nameSize);
+        append(&sample.isCounter, sizeof(bool));
+        append(&sample.value, sizeof(sample.value));
+    }
+
+    sendBuffer(buffer.data(), buffer.size());
+}
+
+void ReaderSocketClient::sendAxisEvents(const std::vector<AxisEvent> &events) {
+    char buffer[sizeof(int) + sizeof(std::uint16_t) + AXIS_EVENTS_PER_DATAGRAM * AXIS_EVENT_SIZE];
+    int msg_type = static_cast<int>(ServerEventType::EVENT_AXIS);
+    memcpy(buffer, &msg_type, sizeof(int));
+
+    for(std::size_t first = 0; first < events.size(); first += AXIS_EVENTS_PER_DATAGRAM) {
+        auto count = static_cast<std::uint16_t>(std::min(events.size() - first, AXIS_EVENTS_PER_DATAGRAM));
+        std::size_t bufferOffset = sizeof(int);
+        memcpy(buffer + bufferOffset, &count, sizeof(count));
+        bufferOffset += sizeof(count);
+        for(std::size_t i = first; i < first + count; i++) {
+            auto evType = static_cast<std::uint16_t>(events[i].evType);
+            auto code = static_cast<std::uint16_t>(events[i].code);
+            auto value = static_cast<std::int32_t>(events[i].value);
+            memcpy(buffer + bufferOffset, &evType, sizeof(evType));
+            memcpy(buffer + bufferOffset + sizeof(evType), &code, sizeof(code));
+            memcpy(buffer + bufferOffset + sizeof(evType) + sizeof(code), &value, sizeof(value));
+            bufferOffset += AXIS_EVENT_SIZE;
+        }
+        GWIDI_PROBE3(encode, msg_type, count, bufferOffset);
+        sendBuffer(buffer, bufferOffset);
+    }
+}
+
+void ReaderSocketClient::sendReconfigureAck(std::uint64_t version) {
+    char buffer[sizeof(int) + sizeof(std::uint64_t)];
+    int msg_type = static_cast<int>(ServerEventType::EVENT_RECONFIGURE_ACK);
+    memcpy(buffer, &msg_type, sizeof(int));
+    memcpy(buffer + sizeof(int), &version, sizeof(version));
+    sendBuffer(buffer, sizeof(buffer));
+}
+
+bool ReaderSocketClient::sendReliableKeyEvent(const KeyEvent &event) {
+    PendingKeyEvent pending{0, event, std::chrono::steady_clock::now(), 1};
+    bool wasIdle;
+    {
+        std::lock_guard<std::mutex> lock(m_unackedMutex);
+        pending.seq = m_nextSeq++;
+        wasIdle = m_unackedSize == 0;
+        if(m_unackedSize == UNACKED_CAPACITY) {
+            // The client has stopped acking, the oldest event is lost and a snapshot has to make up for it
+            metrics::count(metrics::Counter::DELIVERY_FAILURES);
+            m_resyncDue |= !m_unacked[m_unackedHead].isKeyState;
+            m_unackedHead = (m_unackedHead + 1) % UNACKED_CAPACITY;
+            m_unackedSize--;
+        }
+        m_unacked[(m_unackedHead + m_unackedSize) % UNACKED_CAPACITY] = pending;
+        m_unackedSize++;
+    }
+
+    SPDLOG_DEBUG("Sending reliable KeyEvent[ seq: {}, code: {}, eventType: {} ] to client: {}", pending.seq, event.code,
+                 event.eventType, ipForSin(m_toAddr));
+    sendPending(pending);
+    GWIDI_TRACE_EVENT(logging::TraceKind::DATAGRAM_OUT, ServerEventType::EVENT_KEY_RELIABLE, event.code);
+    return wasIdle;
+}
+
+void ReaderSocketClient::sendReliableKeyState(const std::function<KeyStateEvent()> &snapshot) {
+    PendingKeyEvent pending{0, {}, std::chrono::steady_clock::now(), 1, true};
+    {
+        std::lock_guard<std::mutex> lock(m_unackedMutex);
+        // Whatever was still outstanding is superseded, the snapshot covers it
+        pending.seq = m_nextSeq++;
+        pending.keyState = snapshot();
+        m_unackedHead = 0;
+        m_unackedSize = 1;
+        m_unacked[0] = pending;
+        m_resyncDue = false;
+    }
+
+    SPDLOG_DEBUG("Sending reliable KeyStateEvent[ seq: {} ] to client: {}", pending.seq, ipForSin(m_toAddr));
+    sendPending(pending);
+    GWIDI_TRACE_EVENT(logging::TraceKind::DATAGRAM_OUT, ServerEventType::EVENT_KEYSTATE_RELIABLE, 0);
+}
+
+void ReaderSocketClient::sendPending(const PendingKeyEvent &pending) {
+    if(pending.isKeyState) {
+        // [type][seq] in front of what EventBuilder encodes for EVENT_KEYSTATE
+        auto eventBuffer = EventBuilder::eventFor(ServerEventType::EVENT_KEYSTATE).withKeyState(pending.keyState).build();
+        char buffer[sizeof(int) + sizeof(std::uint32_t) + sizeof(std::size_t) + KEYSTATE_BITS_SIZE + sizeof(bool)];
+        int msg_type = static_cast<int>(ServerEventType::EVENT_KEYSTATE_RELIABLE);
+        memcpy(buffer, &msg_type, sizeof(int));
+        memcpy(buffer + sizeof(int), &pending.seq, sizeof(std::uint32_t));
+        memcpy(buffer + sizeof(int) + sizeof(std::uint32_t), eventBuffer.buffer + sizeof(int), eventBuffer.bufferSize - sizeof(int));
+        GWIDI_PROBE3(encode, msg_type, 0, sizeof(buffer));
+        sendBuffer(buffer, sizeof(buffer));
+        return;
+    }
+
+    char buffer[sizeof(int) + sizeof(std::uint32_t) + 2 * sizeof(int)];
+    int msg_type = static_cast<int>(ServerEventType::EVENT_KEY_RELIABLE);
+    std::size_t bufferOffset = 0;
+    memcpy(buffer + bufferOffset, &msg_type, sizeof(int));
+    bufferOffset += sizeof(int);
+    memcpy(buffer + bufferOffset, &pending.seq, sizeof(std::uint32_t));
+    bufferOffset += sizeof(std::uint32_t);
+    memcpy(buffer + bufferOffset, &pending.event.code, sizeof(int));
+    bufferOffset += sizeof(int);
+    memcpy(buffer + bufferOffset, &pending.event.eventType, sizeof(int));
+    GWIDI_PROBE3(encode, msg_type, pending.event.code, sizeof(buffer));
+    sendBuffer(buffer, sizeof(buffer));
+}
+
+void ReaderSocketClient::acknowledge(std::uint32_t seq) {
+    std::lock_guard<std::mutex> lock(m_unackedMutex);
+    // Cumulative: everything up to and including seq has arrived (compared modulo 2^32)
+    while(m_unackedSize > 0 && static_cast<std::int32_t>(m_unacked[m_unackedHead].seq - seq) <= 0) {
+        m_unackedHead = (m_unackedHead + 1) % UNACKED_CAPACITY;
+        m_unackedSize--;
+    }
+}
+
+bool ReaderSocketClient::retransmitExpired(std::chrono::steady_clock::time_point now, std::chrono::milliseconds timeout) {
+    // Sent after unlocking, a send that blocks must not hold up sendReliableKeyEvent() on the reader thread
+    m_retransmitting.clear();
+    auto outstanding = collectExpired(now, timeout);
+    for(auto &pending : m_retransmitting) {
+        metrics::count(metrics::Counter::RETRANSMITS);
+        sendPending(pending);
+    }
+    return outstanding;
+}
+
+bool ReaderSocketClient::collectExpired(std::chrono::steady_clock::time_point now, std::chrono::milliseconds timeout) {
+    std::lock_guard<std::mutex> lock(m_unackedMutex);
+    for(std::size_t i = 0; i < m_unackedSize; i++) {
+        auto &pending = m_unacked[(m_unackedHead + i) % UNACKED_CAPACITY];
+        if(now - pending.sentAt < timeout) {
+            continue;
+        }
+        if(pending.attempts >= MAX_ATTEMPTS) {
+            continue;
+        }
+        pending.attempts++;
+        pending.sentAt = now;
+        m_retransmitting.push_back(pending);
+    }
+
+    // Giving up on the oldest leaves a gap the client would wait at forever, so everything outstanding goes with it.
+    // A key state snapshot takes their place unless they were all snapshots themselves.
+    if(m_unackedSize > 0 && m_unacked[m_unackedHead].attempts >= MAX_ATTEMPTS && now - m_unacked[m_unackedHead].sentAt >= timeout) {
+        GWIDI_LOG_EVERY_MS(SPDLOG_WARN, 1000, "Giving up on key event seq: {} and {} after it to client: {}",
+                           m_unacked[m_unackedHead].seq, m_unackedSize - 1, ipForSin(m_toAddr));
+        for(std::size_t i = 0; i < m_unackedSize; i++) {
+            metrics::count(metrics::Counter::DELIVERY_FAILURES);
+            m_resyncDue |= !m_unacked[(m_unackedHead + i) % UNACKED_CAPACITY].isKeyState;
+        }
+        m_unackedSize = 0;
+    }
+    return m_unackedSize > 0 || m_resyncDue;
+}
+
+bool ReaderSocketClient::resyncDue() {
+    std::lock_guard<std::mutex> lock(m_unackedMutex);
+    return m_resyncDue;
+}
+
+std::size_t ReaderSocketClient::unackedCount() {
+    std::lock_guard<std::mutex> lock(m_unackedMutex);
+    return m_unackedSize;
+}
+
+void ReaderSocketClient::sendPong(std::uint64_t token) {
+    char buffer[sizeof(int) + sizeof(std::uint64_t)];
+    int msg_type = static_cast<int>(ServerEventType::EVENT_PONG);
+    memcpy(buffer, &msg_type, sizeof(int));
+    memcpy(buffer + sizeof(int), &token, sizeof(token));
+    sendBuffer(buffer, sizeof(buffer));
+}
 
+void ReaderSocketClient::sendHello() {
     char* buffer = new char[1024];
     memset(buffer, '\0', sizeof(char) * 1024);
 
     std::size_t bufferOffset = 0;
 
-    std::string msg = "msg_helloback";
+    std::string msg = HELLO_REPLY;
     std::size_t msg_size = msg.size();
     int msg_type = static_cast<int>(ServerEventType::EVENT_HELLO);
 
@@ -68,164 +377,863 @@ void ReaderSocketClient::sendHello() {
     memcpy(buffer + bufferOffset, &(msg[0]), sizeof(char) * msg_size);
     bufferOffset += sizeof(char) * msg_size;
 
-    auto bytesSent = sendto(sockfd, buffer, 1024, 0, (struct sockaddr*)&m_toAddr, sizeof(m_toAddr));
-    spdlog::info("Sent {} bytes of data", bytesSent);
+    sendBuffer(buffer, 1024);
 
     delete[] buffer;
 }
 
-void ReaderSocketServer::beginListening() {
-    if(m_thAlive.load()) {
-        return;
+int ReaderSocketServer::openSocket() {
+    if(!m_sockfds.empty()) {
+        return m_sockfds.front();
     }
 
-    m_thAlive.store(true);
-
-    m_th = std::make_shared<std::thread>([this] {
-        // For now, port is here
-        int port = 5577;
-        int sockfd;
-        struct sockaddr_in socketIn_server, socketIn_client;
-        char buffer[1024];  // probably too big for our needs
-        socklen_t addr_size;
-
-        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in socketIn_server;
+    memset(&socketIn_server, '\0', sizeof(socketIn_server));
+    socketIn_server.sin_family = AF_INET;
+    socketIn_server.sin_port = htons(m_options.port);
+    if(inet_pton(AF_INET, m_options.bindAddress.c_str(), &socketIn_server.sin_addr) != 1) {
+        spdlog::warn("Invalid bind address: {}", m_options.bindAddress);
+        return -1;
+    }
 
-        memset(&socketIn_server, '\0', sizeof(socketIn_server));
-        socketIn_server.sin_family = AF_INET;
-        socketIn_server.sin_port = htons(port);
-        socketIn_server.sin_addr.s_addr = inet_addr("127.0.0.1");   // local listening server
+    auto shards = std::max(1, m_options.listenerShards);
+    for(auto i = 0; i < shards; i++) {
+        auto sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+        if(shards > 1) {
+            int reuse = 1;
+            setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+        }
 
         auto bindStatus = bind(sockfd, (struct sockaddr*)&socketIn_server, sizeof(socketIn_server));
         if(bindStatus != 0) {
-            spdlog::warn("Failed to bind listening socket!");
-            m_thAlive.store(false);
+            spdlog::warn("Failed to bind listening socket to {}:{}, errno: {}", m_options.bindAddress, m_options.port, errno);
+            close(sockfd);
+            closeSocket();
+            return -1;
+        }
+        m_sockfds.emplace_back(sockfd);
+        m_keyLanePollFds.push_back({sockfd, POLLIN, 0});
+    }
+
+    m_retransmitFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    // Ticks at the shortest heartbeat interval, quiet clients back off from there on their own
+    m_heartbeatFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    itimerspec spec{};
+    auto tickMs = ReaderSocketClient::HEARTBEAT_MIN.count();
+    spec.it_interval.tv_sec = tickMs / 1000;
+    spec.it_interval.tv_nsec = (tickMs % 1000) * 1000000;
+    spec.it_value = spec.it_interval;
+    timerfd_settime(m_heartbeatFd, 0, &spec, nullptr);
+
+    m_controlFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    auto &metrics = metrics::Metrics::instance();
+    m_laneGaugeIds = {
+            metrics.registerGauge("gwidi_key_lane_depth", "Most key lane datagrams found waiting at once since the last read",
+                                  [this]() { return m_keyLanePeak.exchange(0); }),
+            metrics.registerGauge("gwidi_control_lane_depth", "Control lane datagrams queued but not handled yet",
+                                  [this]() {
+                                      std::lock_guard<std::mutex> lock(m_controlMutex);
+                                      return m_controlLane.size();
+                                  }),
+    };
+    return m_sockfds.front();
+}
+
+void ReaderSocketServer::closeSocket() {
+    for(auto sockfd : m_sockfds) {
+        close(sockfd);
+    }
+    m_sockfds.clear();
+    m_keyLanePollFds.clear();
+    if(m_retransmitFd >= 0) {
+        close(m_retransmitFd);
+        m_retransmitFd = -1;
+    }
+    if(m_heartbeatFd >= 0) {
+        close(m_heartbeatFd);
+        m_heartbeatFd = -1;
+    }
+    if(m_controlFd >= 0) {
+        close(m_controlFd);
+        m_controlFd = -1;
+    }
+    for(auto id : m_laneGaugeIds) {
+        metrics::Metrics::instance().unregisterGauge(id);
+    }
+    m_laneGaugeIds.clear();
+    {
+        std::lock_guard<std::mutex> lock(m_controlMutex);
+        m_controlLane.clear();
+    }
+    std::lock_guard<std::mutex> lock(m_subscribersMutex);
+    m_subscribers.publish({});
+}
+
+std::size_t ReaderSocketServer::receiveBatch(int fd) {
+    char buffers[RECEIVE_BATCH][MAX_DATAGRAM_SIZE];
+    sockaddr_in from[RECEIVE_BATCH];
+    iovec iovs[RECEIVE_BATCH];
+    mmsghdr msgs[RECEIVE_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for(std::size_t i = 0; i < RECEIVE_BATCH; i++) {
+        iovs[i] = {buffers[i], MAX_DATAGRAM_SIZE};
+        msgs[i].msg_hdr.msg_name = &from[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    auto received = recvmmsg(fd, msgs, RECEIVE_BATCH, MSG_DONTWAIT, nullptr);
+    if(received <= 0) {
+        return 0;
+    }
+    auto count = static_cast<std::size_t>(received);
+    metrics::count(metrics::Counter::DATAGRAMS_IN, count);
+
+    // TODO: Probably do some type of shared secret thing where we only accept clients we trust
+    // TODO: For now, just look for a header message first to determine this is our client
+    bool keyLane[RECEIVE_BATCH];
+    std::size_t keys = 0;
+    for(std::size_t i = 0; i < count; i++) {
+        auto size = msgs[i].msg_len;
+        GWIDI_PROBE1(recv, size);
+        metrics::count(metrics::Counter::BYTES_IN, size);
+        SPDLOG_DEBUG("Received {} byte message from client: {}", size, ipForSin(from[i]));
+        GWIDI_TRACE_EVENT(logging::TraceKind::DATAGRAM_IN, 0, static_cast<int>(size));
+        keyLane[i] = onKeyLane(buffers[i], size);
+        keys += keyLane[i];
+    }
+
+    // Strict priority: every key in the batch is handled before any control datagram is even copied out.
+    // The depth is sampled now, before draining, sampling it afterwards would only ever see an empty lane.
+    auto depth = m_keyLaneDepth.fetch_add(keys) + keys;
+    auto peak = m_keyLanePeak.load(std::memory_order_relaxed);
+    while(depth > peak && !m_keyLanePeak.compare_exchange_weak(peak, depth, std::memory_order_relaxed)) {}
+    for(std::size_t i = 0; i < count; i++) {
+        if(keyLane[i]) {
+            processEvent(buffers[i], msgs[i].msg_len, from[i]);
+            m_keyLaneDepth.fetch_sub(1);
+        }
+    }
+    for(std::size_t i = 0; i < count; i++) {
+        if(!keyLane[i]) {
+            queueControl(buffers[i], msgs[i].msg_len, from[i]);
+        }
+    }
+    return count;
+}
+
+void ReaderSocketServer::handleReadable(int fd) {
+    while(receiveBatch(fd) > 0) {}
+    m_keyLaneDrained.notify_all();
+}
+
+void ReaderSocketServer::queueControl(const char *buffer, std::size_t size, const sockaddr_in &from) {
+    {
+        std::lock_guard<std::mutex> lock(m_controlMutex);
+        if(m_controlLane.size() >= CONTROL_LANE_CAPACITY) {
+            metrics::count(metrics::Counter::CONTROL_DROPPED);
             return;
         }
+        auto &datagram = m_controlLane.emplace_back();
+        memcpy(datagram.buffer.data(), buffer, size);
+        datagram.size = size;
+        datagram.from = from;
+    }
+    uint64_t one = 1;
+    write(m_controlFd, &one, sizeof(one));
+}
 
-        addr_size = sizeof(socketIn_client);
-        while(m_thAlive.load()) {
-            memset(buffer, '\0', sizeof(buffer));
-            recvfrom(sockfd, buffer, 1024, 0, (struct sockaddr*)&socketIn_client, &addr_size);  // Should loop this to continue receiving messages
-            spdlog::info("Received message from client: {}, message: {}", ipForSin(socketIn_client), buffer);
-            // TODO: Probably do some type of shared secret thing where we only accept clients we trust
-            // TODO: For now, just look for a header message first to determine this is our client (assign only a single client at a time)
+bool ReaderSocketServer::keyLanePending() {
+    if(m_keyLaneDepth.load() > 0) {
+        return true;
+    }
+    // Anything unread on any shard counts, the type of what is queued can't be seen without reading it
+    return poll(m_keyLanePollFds.data(), m_keyLanePollFds.size(), 0) > 0;
+}
+
+bool ReaderSocketServer::handleControl(bool yieldToKeyLane) {
+    uint64_t value;
+    while(read(m_controlFd, &value, sizeof(value)) == sizeof(value)) {}
 
-            processEvent(buffer, socketIn_client);
+    ControlDatagram datagram;
+    while(true) {
+        if(yieldToKeyLane && keyLanePending()) {
+            // Come back once the sockets are drained, the eventfd stays readable until then
+            uint64_t one = 1;
+            write(m_controlFd, &one, sizeof(one));
+            return true;
         }
-        m_socketClient = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_controlMutex);
+            if(m_controlLane.empty()) {
+                return false;
+            }
+            datagram = m_controlLane.front();
+            m_controlLane.pop_front();
+        }
+        processEvent(datagram.buffer.data(), datagram.size, datagram.from);
+    }
+}
 
-        m_thAlive.store(false);
-    });
-    m_th->detach();
+void ReaderSocketServer::armRetransmit() {
+    // One-shot, handleRetransmit() re-arms it for as long as events are outstanding
+    itimerspec spec{};
+    spec.it_value.tv_sec = RETRANSMIT_TIMEOUT.count() / 1000;
+    spec.it_value.tv_nsec = (RETRANSMIT_TIMEOUT.count() % 1000) * 1000000;
+    timerfd_settime(m_retransmitFd, 0, &spec, nullptr);
+}
+
+void ReaderSocketServer::handleRetransmit() {
+    uint64_t expirations;
+    while(read(m_retransmitFd, &expirations, sizeof(expirations)) == sizeof(expirations)) {}
+
+    auto now = std::chrono::steady_clock::now();
+    auto outstanding = false;
+    auto list = subscribers();
+    for(auto &subscriber : list->value) {
+        auto &socketClient = *subscriber.client;
+        if(!socketClient.isAlive()) {
+            continue;
+        }
+        outstanding |= socketClient.retransmitExpired(now, RETRANSMIT_TIMEOUT);
+        if(socketClient.resyncDue()) {
+            auto profile = subscriber.profileIndex;
+            socketClient.sendReliableKeyState([this, profile] {
+                return m_keyStateCb ? m_keyStateCb(profile) : KeyStateEvent{};
+            });
+        }
+    }
+    if(outstanding) {
+        armRetransmit();
+    }
+}
+
+void ReaderSocketServer::handleHeartbeat() {
+    uint64_t expirations;
+    while(read(m_heartbeatFd, &expirations, sizeof(expirations)) == sizeof(expirations)) {}
+
+    auto now = std::chrono::steady_clock::now();
+    auto anyDead = false;
+    {
+        auto list = subscribers();
+        for(auto &subscriber : list->value) {
+            anyDead |= !subscriber.client->heartbeatIfQuiet(now);
+        }
+    }
+    if(!anyDead) {
+        return;
+    }
+
+    // Dead clients are already skipped by every send, this only stops carrying them around
+    std::lock_guard<std::mutex> lock(m_subscribersMutex);
+    auto list = subscribers()->value;
+    list.erase(std::remove_if(list.begin(), list.end(), [](auto &subscriber) { return !subscriber.client->isAlive(); }), list.end());
+    m_subscribers.publish(std::move(list));
+}
+
+void ReaderSocketServer::beginListening() {
+    if(m_thAlive.load()) {
+        return;
+    }
+
+    if(openSocket() < 0) {
+        return;
+    }
+    m_thAlive.store(true);
+
+    // Retransmits and heartbeats are driven from the first listener only, so they are never sent twice
+    m_th.clear();
+    for(std::size_t i = 0; i < m_sockfds.size(); i++) {
+        m_th.emplace_back(std::make_shared<std::thread>([this, fd = m_sockfds[i], handlesTimers = i == 0] {
+            listen(fd, handlesTimers);
+        }));
+    }
+    m_th.emplace_back(std::make_shared<std::thread>([this] {
+        serveControl();
+    }));
+}
+
+void ReaderSocketServer::serveControl() {
+    pollfd pfd{m_controlFd, POLLIN, 0};
+    while(m_thAlive.load()) {
+        poll(&pfd, 1, 500);
+        if((pfd.revents & POLLIN) && handleControl(true)) {
+            // Strict priority on this thread too: let the listeners drain the key lane instead of spinning on the eventfd
+            std::unique_lock<std::mutex> lock(m_keyLaneMutex);
+            m_keyLaneDrained.wait_for(lock, KEY_LANE_BACKOFF);
+        }
+    }
+}
+
+void ReaderSocketServer::listen(int fd, bool handlesTimers) {
+    pollfd pfds[] = {
+            {fd, POLLIN, 0},
+            {m_retransmitFd, POLLIN, 0},
+            {m_heartbeatFd, POLLIN, 0},
+    };
+    while(m_thAlive.load()) {
+        poll(pfds, handlesTimers ? 3 : 1, 500);
+        if(pfds[0].revents & POLLIN) {
+            handleReadable(fd);
+        }
+        if(handlesTimers && (pfds[1].revents & POLLIN)) {
+            handleRetransmit();
+        }
+        if(handlesTimers && (pfds[2].revents & POLLIN)) {
+            handleHeartbeat();
+        }
+    }
 }
 
 void ReaderSocketServer::stopListening() {
     m_thAlive.store(false);
+    if(m_controlFd >= 0) {
+        uint64_t one = 1;
+        write(m_controlFd, &one, sizeof(one));
+    }
+    for(auto &th : m_th) {
+        if(th->joinable() && th->get_id() != std::this_thread::get_id()) {
+            th->join();
+        }
+    }
 }
 
 ReaderSocketServer::~ReaderSocketServer() {
-    if(m_thAlive.load() && m_th->joinable()) {
-        m_thAlive.store(false);
-        m_th->join();
+    // Whoever sends key events (and arms the retransmit timer with them) is stopped by now, so the sockets and timers
+    // can go. They stay open across stopListening() for exactly that reason.
+    stopListening();
+    closeSocket();
+}
+
+void ReaderSocketServer::sendKeyEvent(const KeyEvent &event, int profile) {
+    if(!m_reliableKeyEvents.load()) {
+        forEachSubscriber(profile, [&event](ReaderSocketClient &socketClient) {
+            socketClient.sendKeyEvent(event);
+        });
+        return;
     }
-    else {
-        m_thAlive.store(false);
+
+    auto wasIdle = false;
+    forEachSubscriber(profile, [&event, &wasIdle](ReaderSocketClient &socketClient) {
+        wasIdle |= socketClient.sendReliableKeyEvent(event);
+    });
+    if(wasIdle) {
+        armRetransmit();
     }
 }
 
-void ReaderSocketServer::sendKeyEvent(const KeyEvent &event) {
-    if(m_socketClient) {
-        m_socketClient->sendKeyEvent(event);
+void ReaderSocketServer::sendKeyHeldEvent(const KeyHeldEvent &event, int profile) {
+    forEachSubscriber(profile, [&event](ReaderSocketClient &socketClient) {
+        socketClient.sendKeyHeldEvent(event);
+    });
+}
+
+void ReaderSocketServer::sendWindowFocusEvent(const std::string &windowName, bool hasFocus, int profile) {
+    forEachSubscriber(profile, [&windowName, hasFocus](ReaderSocketClient &socketClient) {
+        socketClient.sendWindowFocusEvent(windowName, hasFocus);
+    });
+}
+
+void ReaderSocketServer::sendAxisEvents(const std::vector<AxisEvent> &events, int profile) {
+    forEachSubscriber(profile, [&events](ReaderSocketClient &socketClient) {
+        socketClient.sendAxisEvents(events);
+    });
+}
+
+void ReaderSocketServer::sendKeyStateEvent(const KeyStateEvent &event, int profile) {
+    forEachSubscriber(profile, [&event](ReaderSocketClient &socketClient) {
+        socketClient.sendKeyStateEvent(event);
+    });
+}
+
+void ReaderSocketServer::setProfiles(std::vector<std::string> names) {
+    std::lock_guard<std::mutex> lock(m_subscribersMutex);
+    if(names == m_profileNames) {
+        return;
     }
+    m_profileNames = std::move(names);
+
+    auto list = subscribers()->value;
+    for(auto &subscriber : list) {
+        subscriber.profileIndex = profileIndexLocked(subscriber.profile);
+    }
+    m_subscribers.publish(std::move(list));
 }
 
-void ReaderSocketServer::sendWindowFocusEvent(const std::string &windowName, bool hasFocus) {
-    if(m_socketClient) {
-        m_socketClient->sendWindowFocusEvent(windowName, hasFocus);
+int ReaderSocketServer::profileIndexLocked(const std::string &profile) const {
+    auto it = std::find(m_profileNames.begin(), m_profileNames.end(), profile);
+    return it == m_profileNames.end() ? -1 : static_cast<int>(it - m_profileNames.begin());
+}
+
+const ReaderSocketServer::Subscriber* ReaderSocketServer::subscriberFor(const SubscriberList &list, const sockaddr_in &from) const {
+    auto it = std::find_if(list.begin(), list.end(), [&from](auto &subscriber) { return subscriber.matches(from); });
+    return it == list.end() ? nullptr : &*it;
+}
+
+void ReaderSocketServer::subscribe(const sockaddr_in &from, std::string profile) {
+    // Profile subscribers are told apart by port, so several of them can share a host
+    in_port_t port = profile.empty() ? 0 : from.sin_port;
+    auto socketClient = std::make_shared<ReaderSocketClient>(from, port == 0 ? m_options.clientPort : ntohs(port));
+
+    int profileIndex;
+    {
+        std::lock_guard<std::mutex> lock(m_subscribersMutex);
+        auto list = subscribers()->value;
+        auto it = std::find_if(list.begin(), list.end(), [&from, port](auto &subscriber) {
+            return subscriber.address == from.sin_addr.s_addr && subscriber.port == port;
+        });
+        if(it != list.end()) {
+            // Always take a new hello in case the client restarted
+            metrics::count(metrics::Counter::RECONNECTS);
+            list.erase(it);
+        }
+        else if(list.size() == MAX_SUBSCRIBERS) {
+            spdlog::warn("Too many clients, dropping the oldest: {}", ipForSin(from));
+            list.erase(list.begin());
+        }
+
+        profileIndex = profileIndexLocked(profile);
+        if(profileIndex < 0) {
+            spdlog::warn("Client: {} subscribed to unknown profile: {}", ipForSin(from), profile);
+        }
+        list.push_back({socketClient, from.sin_addr.s_addr, port, std::move(profile), profileIndex});
+        m_subscribers.publish(std::move(list));
+    }
+    socketClient->sendHello();
+
+    // A (re)connecting client knows nothing about keys that are already down
+    if(m_keyStateCb && profileIndex >= 0) {
+        socketClient->sendKeyStateEvent(m_keyStateCb(profileIndex));
     }
 }
 
-void ReaderSocketServer::processEvent(char *buffer, struct sockaddr_in socketIn_client) {
+void ReaderSocketServer::processEvent(char *buffer, std::size_t bufferSize, struct sockaddr_in socketIn_client) {
     // The message we expect to receive is of the format: [{msg_type}{size}{message}]
     std::size_t bufferOffset = 0;
     int msg_type;
+    if(bufferSize < sizeof(int)) {
+        metrics::count(metrics::Counter::PARSE_FAILURES);
+        return;
+    }
     memcpy(&msg_type, buffer, sizeof(int));
     bufferOffset += sizeof(int);
+    GWIDI_PROBE2(dispatch, msg_type, bufferSize);
+
+    // Anything from a subscribed client shows it is still there
+    auto list = subscribers();
+    auto subscriber = subscriberFor(list->value, socketIn_client);
+    if(subscriber) {
+        subscriber->client->heard(std::chrono::steady_clock::now());
+    }
+
+    // Subscribed clients are answered through their own socket, anyone else through a throwaway one
+    auto reply = [&](auto &&fn) {
+        if(subscriber && subscriber->client->isAlive()) {
+            fn(*subscriber->client);
+        }
+        else {
+            ReaderSocketClient socketClient{socketIn_client, m_options.clientPort};
+            fn(socketClient);
+        }
+    };
+
+    // Reads a size_t length prefix and checks that `elementSize` * length bytes of payload actually follow it
+    auto readSize = [&](std::size_t &out, std::size_t elementSize) {
+        if(bufferSize - bufferOffset < sizeof(std::size_t)) {
+            return false;
+        }
+        memcpy(&out, buffer + bufferOffset, sizeof(std::size_t));
+        bufferOffset += sizeof(std::size_t);
+        return out <= (bufferSize - bufferOffset) / elementSize;
+    };
 
     switch(static_cast<ServerEventType>(msg_type)) {
         case ServerEventType::EVENT_HELLO: {
             std::size_t msgSize;
-            memcpy(&msgSize, buffer + bufferOffset, sizeof(std::size_t));
-            bufferOffset += sizeof(std::size_t);
-
-            // We probably shouldn't cap here, but this is trying to catch cases where junk data still matches our event type
-            if(msgSize >= 1024) {
-                msgSize = 1024;
+            if(!readSize(msgSize, sizeof(char))) {
+                metrics::count(metrics::Counter::PARSE_FAILURES);
+                break;
             }
-            char* msg = new char[msgSize];
-            memcpy(&msg[0], buffer + bufferOffset, msgSize);
-            bufferOffset += msgSize;
 
             // verify our hello string
-            auto helloMsgPre = "msg_hello";
-            auto selectionMessageMatched = strncmp(helloMsgPre, msg, strlen(helloMsgPre)) == 0;
+            auto helloMsgPre = HELLO_MESSAGE;
+            auto selectionMessageMatched = msgSize >= strlen(helloMsgPre) && strncmp(helloMsgPre, buffer + bufferOffset, strlen(helloMsgPre)) == 0;
+            bufferOffset += msgSize;
 
-            // Always accept a new client in case we dc or restart the client (we only accept one client at a time, currently)
-            if(selectionMessageMatched) {
-                m_socketClient = std::make_shared<ReaderSocketClient>(socketIn_client);
-                m_socketClient->sendHello();
+            // Optional profile name, older clients end the hello here
+            std::string profile{DEFAULT_PROFILE};
+            std::size_t profileSize;
+            if(bufferSize - bufferOffset >= sizeof(std::size_t) && readSize(profileSize, sizeof(char))) {
+                profile.assign(buffer + bufferOffset, profileSize);
+                bufferOffset += profileSize;
             }
 
-            delete[] msg;
+            if(selectionMessageMatched) {
+                subscribe(socketIn_client, std::move(profile));
+            }
 
             break;
         }
         case ServerEventType::EVENT_WATCHEDKEYS_RECONFIGURE: {
-            // Parse out the data
+            // Legacy form of EVENT_RECONFIGURE carrying only the key list, it is not acknowledged
             std::size_t listSize;
-            memcpy(&listSize, buffer + bufferOffset, sizeof(std::size_t));
-            bufferOffset += sizeof(std::size_t);
-
-            // TODO: Want to make sure we delete this list of keys after use
-            int* keys = new int[listSize];
-            for(auto i = 0; i < listSize; i++) {
-                int key;
-                memcpy(&key, buffer + bufferOffset, sizeof(int));
-                keys[i] = key;
-                bufferOffset += sizeof(int);
+            if(!readSize(listSize, sizeof(int))) {
+                metrics::count(metrics::Counter::PARSE_FAILURES);
+                break;
             }
-            // Pass the data to the input reader
-            if(m_eventCb) {
-                m_eventCb(ServerEventType::EVENT_WATCHEDKEYS_RECONFIGURE, {.watchedKeysReconfigEvent{listSize, keys}});
+
+            ReconfigureRequest request;
+            request.watchedKeys.emplace(listSize);
+            memcpy(request.watchedKeys->data(), buffer + bufferOffset, listSize * sizeof(int));
+            bufferOffset += listSize * sizeof(int);
+
+            if(m_reconfigureCb) {
+                m_reconfigureCb(request);
+            }
+            break;
+        }
+        case ServerEventType::EVENT_RECONFIGURE: {
+            ReconfigureRequest request;
+            if(!parseReconfigure(buffer + bufferOffset, bufferSize - bufferOffset, request)) {
+                metrics::count(metrics::Counter::PARSE_FAILURES);
+                break;
+            }
+
+            if(m_reconfigureCb) {
+                auto version = m_reconfigureCb(request);
+                reply([version](ReaderSocketClient &socketClient) {
+                    socketClient.sendReconfigureAck(version);
+                });
             }
             break;
         }
         case ServerEventType::EVENT_SENDINPUT: {
             // Parse out the data
             std::size_t keyNameSize;
-            memcpy(&keyNameSize, buffer + bufferOffset, sizeof(std::size_t));
-            bufferOffset += sizeof(std::size_t);
+            if(!readSize(keyNameSize, sizeof(char))) {
+                metrics::count(metrics::Counter::PARSE_FAILURES);
+                break;
+            }
 
-            char* keyName = new char[keyNameSize];
-            memcpy(&keyName[0], buffer + bufferOffset, keyNameSize);
+            std::string keyName{buffer + bufferOffset, keyNameSize};
             bufferOffset += keyNameSize;
 
             // Pass the data to the input reader
-            if(m_sendInput) {
-                m_sendInput->sendInput(std::string{keyName});
+            if(auto sendInput = m_sendInput.load()) {
+                GWIDI_TRACE_EVENT(logging::TraceKind::INJECT, 0, static_cast<int>(keyNameSize));
+                sendInput->sendInput(keyName);
+            }
+            break;
+        }
+        case ServerEventType::EVENT_KEY_ACK: {
+            std::uint32_t seq;
+            if(bufferSize - bufferOffset < sizeof(seq)) {
+                metrics::count(metrics::Counter::PARSE_FAILURES);
+                break;
+            }
+            memcpy(&seq, buffer + bufferOffset, sizeof(seq));
+            metrics::count(metrics::Counter::ACKS_IN);
+
+            if(subscriber) {
+                subscriber->client->acknowledge(seq);
+            }
+            break;
+        }
+        case ServerEventType::EVENT_KEYSTATE_REQUEST: {
+            auto profile = subscriber ? subscriber->profileIndex : 0;
+            if(m_keyStateCb && profile >= 0) {
+                auto keyState = m_keyStateCb(profile);
+                reply([&keyState](ReaderSocketClient &socketClient) {
+                    socketClient.sendKeyStateEvent(keyState);
+                });
+            }
+            break;
+        }
+        case ServerEventType::EVENT_PING: {
+            std::uint64_t token;
+            if(bufferSize - bufferOffset < sizeof(token)) {
+                metrics::count(metrics::Counter::PARSE_FAILURES);
+                break;
             }
+            memcpy(&token, buffer + bufferOffset, sizeof(token));
+            reply([token](ReaderSocketClient &socketClient) {
+                socketClient.sendPong(token);
+            });
+            break;
+        }
+        case ServerEventType::EVENT_STATS: {
+            // Answer whoever asked, it does not have to be a subscribed client
+            auto samples = metrics::Metrics::instance().snapshot();
+            reply([&samples](ReaderSocketClient &socketClient) {
+                socketClient.sendStats(samples);
+            });
             break;
         }
         default: {
-            spdlog::warn("Message type not supported, message: {}", buffer);
+            metrics::count(metrics::Counter::UNKNOWN_TYPES);
+            GWIDI_LOG_EVERY_MS(SPDLOG_WARN, 1000, "Message type not supported: {}", msg_type);
             break;
         }
     }
 }
 
-ReaderSocketServer::ReaderSocketServer() {
-    m_sendInput = std::make_unique<SendInput>();
+bool ReaderSocketServer::parseReconfigure(const char *buffer, std::size_t bufferSize, ReconfigureRequest &out) {
+    std::size_t bufferOffset = 0;
+    auto read = [&](void* dst, std::size_t size) {
+        if(bufferSize - bufferOffset < size) {
+            return false;
+        }
+        memcpy(dst, buffer + bufferOffset, size);
+        bufferOffset += size;
+        return true;
+    };
+
+    std::size_t fieldCount;
+    if(!read(&fieldCount, sizeof(fieldCount))) {
+        return false;
+    }
+
+    for(std::size_t i = 0; i < fieldCount; i++) {
+        int field;
+        std::size_t size;
+        if(!read(&field, sizeof(int)) || !read(&size, sizeof(size)) || size > bufferSize - bufferOffset) {
+            return false;
+        }
+
+        switch(static_cast<ReconfigureField>(field)) {
+            case ReconfigureField::RECONFIGURE_WATCHED_KEYS: {
+                out.watchedKeys.emplace(size / sizeof(int));
+                memcpy(out.watchedKeys->data(), buffer + bufferOffset, out.watchedKeys->size() * sizeof(int));
+                break;
+            }
+            case ReconfigureField::RECONFIGURE_WINDOW_NAME: {
+                out.windowName.emplace(buffer + bufferOffset, size);
+                break;
+            }
+            case ReconfigureField::RECONFIGURE_WINDOW_CLASS: {
+                out.windowClass.emplace(buffer + bufferOffset, size);
+                break;
+            }
+            case ReconfigureField::RECONFIGURE_FORWARDING_MODE: {
+                int mode;
+                if(size != sizeof(int)) {
+                    return false;
+                }
+                memcpy(&mode, buffer + bufferOffset, sizeof(int));
+                out.forwardingMode = static_cast<ForwardingMode>(mode);
+                break;
+            }
+            case ReconfigureField::RECONFIGURE_MACRO_SET: {
+                MacroDefinition macro;
+                if(!parseMacro(buffer + bufferOffset, size, macro)) {
+                    return false;
+                }
+                out.setMacros.emplace_back(std::move(macro));
+                break;
+            }
+            case ReconfigureField::RECONFIGURE_MACRO_REMOVE: {
+                int id;
+                if(size != sizeof(int)) {
+                    return false;
+                }
+                memcpy(&id, buffer + bufferOffset, sizeof(int));
+                out.removeMacros.emplace_back(id);
+                break;
+            }
+            case ReconfigureField::RECONFIGURE_MACRO_ENABLE: {
+                int id;
+                bool enabled;
+                if(size != sizeof(int) + sizeof(bool)) {
+                    return false;
+                }
+                memcpy(&id, buffer + bufferOffset, sizeof(int));
+                memcpy(&enabled, buffer + bufferOffset + sizeof(int), sizeof(bool));
+                out.enableMacros.emplace_back(id, enabled);
+                break;
+            }
+            case ReconfigureField::RECONFIGURE_AXES: {
+                AxisSettings axes;
+                if(!parseAxes(buffer + bufferOffset, size, axes)) {
+                    return false;
+                }
+                out.axes = std::move(axes);
+                break;
+            }
+            case ReconfigureField::RECONFIGURE_PROFILES: {
+                std::vector<Profile> profiles;
+                if(!parseProfiles(buffer + bufferOffset, size, profiles)) {
+                    return false;
+                }
+                out.profiles = std::move(profiles);
+                break;
+            }
+            case ReconfigureField::RECONFIGURE_REPEATS: {
+                std::vector<RepeatRule> repeats;
+                if(!parseRepeats(buffer + bufferOffset, size, repeats)) {
+                    return false;
+                }
+                out.repeats = std::move(repeats);
+                break;
+            }
+            default: {
+                // Unknown fields are skipped so newer clients can talk to older servers
+                break;
+            }
+        }
+        bufferOffset += size;
+    }
+    return true;
+}
+
+bool ReaderSocketServer::parseMacro(const char *buffer, std::size_t bufferSize, MacroDefinition &out) {
+    std::size_t bufferOffset = 0;
+    auto read = [&](void* dst, std::size_t size) {
+        if(bufferSize - bufferOffset < size) {
+            return false;
+        }
+        memcpy(dst, buffer + bufferOffset, size);
+        bufferOffset += size;
+        return true;
+    };
+
+    std::size_t modifierCount;
+    if(!read(&out.id, sizeof(int)) || !read(&out.trigger, sizeof(int)) || !read(&modifierCount, sizeof(modifierCount)) ||
+            modifierCount > (bufferSize - bufferOffset) / sizeof(int)) {
+        return false;
+    }
+    out.modifiers.resize(modifierCount);
+    read(out.modifiers.data(), modifierCount * sizeof(int));
+
+    std::size_t stepCount;
+    if(!read(&out.focusOnly, sizeof(bool)) || !read(&out.consumeTrigger, sizeof(bool)) || !read(&out.enabled, sizeof(bool)) ||
+            !read(&stepCount, sizeof(stepCount))) {
+        return false;
+    }
+
+    constexpr std::size_t stepSize = 2 * sizeof(int) + sizeof(std::uint32_t);
+    if(stepCount > (bufferSize - bufferOffset) / stepSize) {
+        return false;
+    }
+    out.steps.resize(stepCount);
+    for(auto &step : out.steps) {
+        int action;
+        read(&step.code, sizeof(int));
+        read(&action, sizeof(int));
+        read(&step.delayMs, sizeof(std::uint32_t));
+        step.action = static_cast<MacroAction>(action);
+    }
+    return true;
+}
+
+bool ReaderSocketServer::parseAxes(const char *buffer, std::size_t bufferSize, AxisSettings &out) {
+    constexpr std::size_t ruleSize = 5 * sizeof(int) + sizeof(std::uint32_t);
+    std::size_t ruleCount;
+    if(bufferSize < sizeof(bool) + sizeof(ruleCount)) {
+        return false;
+    }
+    memcpy(&out.enabled, buffer, sizeof(bool));
+    memcpy(&ruleCount, buffer + sizeof(bool), sizeof(ruleCount));
+
+    std::size_t bufferOffset = sizeof(bool) + sizeof(ruleCount);
+    if(ruleCount > (bufferSize - bufferOffset) / ruleSize) {
+        return false;
+    }
+    out.rules.resize(ruleCount);
+    for(auto &rule : out.rules) {
+        int fields[5];
+        memcpy(fields, buffer + bufferOffset, sizeof(fields));
+        memcpy(&rule.minIntervalMs, buffer + bufferOffset + sizeof(fields), sizeof(std::uint32_t));
+        bufferOffset += ruleSize;
+        rule.evType = fields[0];
+        rule.code = fields[1];
+        rule.center = fields[2];
+        rule.deadband = fields[3];
+        rule.quantum = fields[4];
+    }
+    return true;
+}
+
+bool ReaderSocketServer::parseProfiles(const char *buffer, std::size_t bufferSize, std::vector<Profile> &out) {
+    std::size_t bufferOffset = 0;
+    auto readSize = [&](std::size_t &size, std::size_t elementSize) {
+        if(bufferSize - bufferOffset < sizeof(size)) {
+            return false;
+        }
+        memcpy(&size, buffer + bufferOffset, sizeof(size));
+        bufferOffset += sizeof(size);
+        return size <= (bufferSize - bufferOffset) / elementSize;
+    };
+    auto readString = [&](std::string &str) {
+        std::size_t size;
+        if(!readSize(size, sizeof(char))) {
+            return false;
+        }
+        str.assign(buffer + bufferOffset, size);
+        bufferOffset += size;
+        return true;
+    };
+
+    std::size_t profileCount;
+    if(!readSize(profileCount, 4 * sizeof(std::size_t))) {
+        return false;
+    }
+    out.resize(profileCount);
+    for(auto &profile : out) {
+        std::size_t keyCount;
+        if(!readString(profile.name) || !readString(profile.windowName) || !readString(profile.windowClass) ||
+                !readSize(keyCount, sizeof(int))) {
+            return false;
+        }
+        profile.watchedKeys.resize(keyCount);
+        memcpy(profile.watchedKeys.data(), buffer + bufferOffset, keyCount * sizeof(int));
+        bufferOffset += keyCount * sizeof(int);
+    }
+    return true;
+}
+
+bool ReaderSocketServer::parseRepeats(const char *buffer, std::size_t bufferSize, std::vector<RepeatRule> &out) {
+    constexpr std::size_t ruleSize = 2 * sizeof(int) + sizeof(std::uint32_t);
+    std::size_t ruleCount;
+    if(bufferSize < sizeof(ruleCount)) {
+        return false;
+    }
+    memcpy(&ruleCount, buffer, sizeof(ruleCount));
+
+    std::size_t bufferOffset = sizeof(ruleCount);
+    if(ruleCount > (bufferSize - bufferOffset) / ruleSize) {
+        return false;
+    }
+    out.resize(ruleCount);
+    for(auto &rule : out) {
+        int mode;
+        memcpy(&rule.code, buffer + bufferOffset, sizeof(int));
+        memcpy(&mode, buffer + bufferOffset + sizeof(int), sizeof(int));
+        memcpy(&rule.intervalMs, buffer + bufferOffset + 2 * sizeof(int), sizeof(std::uint32_t));
+        bufferOffset += ruleSize;
+        if(mode < REPEAT_OFF || mode > REPEAT_HELD) {
+            return false;
+        }
+        rule.mode = static_cast<RepeatMode>(mode);
+    }
+    return true;
+}
+
+ReaderSocketServer::ReaderSocketServer() : ReaderSocketServer(std::make_unique<SendInput>()) {
+}
+
+ReaderSocketServer::ReaderSocketServer(std::unique_ptr<SendInput> sendInput, ListenOptions options) : m_options{std::move(options)} {
+    setSendInput(std::move(sendInput));
+}
+
+void ReaderSocketServer::setSendInput(std::unique_ptr<SendInput> sendInput) {
+    if(m_sendInputOwner) {
+        spdlog::warn("Ignoring SendInput, one is already set");
+        return;
+    }
+    m_sendInputOwner = std::move(sendInput);
+    m_sendInput.store(m_sendInputOwner.get());
 }
 
 
@@ -239,6 +1247,10 @@ EventBuilder::EventBuilder(gwidi::udpsocket::ServerEventType type) : m_type{type
             m_serverEvent = { .focusEvent{} };
             break;
         }
+        case ServerEventType::EVENT_KEYSTATE: {
+            m_serverEvent = { .keyStateEvent{} };
+            break;
+        }
     }
 }
 
@@ -275,6 +1287,13 @@ EventBuilder &EventBuilder::withFocusHasFocus(bool hasFocus) {
     return *this;
 }
 
+EventBuilder &EventBuilder::withKeyState(const KeyStateEvent &keyState) {
+    if(m_type == ServerEventType::EVENT_KEYSTATE) {
+        m_serverEvent.keyStateEvent = keyState;
+    }
+    return *this;
+}
+
 EventBuffer EventBuilder::build() const {
     EventBuffer ret {
         new char[1024],
@@ -311,8 +1330,22 @@ EventBuffer EventBuilder::build() const {
             bufferOffset += sizeof(bool);
             break;
         }
+        case ServerEventType::EVENT_KEYSTATE: {
+            std::size_t bitsSize = KEYSTATE_BITS_SIZE;
+            memcpy(ret.buffer + bufferOffset, &bitsSize, sizeof(bitsSize));
+            bufferOffset += sizeof(bitsSize);
+
+            memcpy(ret.buffer + bufferOffset, &(m_serverEvent.keyStateEvent.keyBits[0]), bitsSize);
+            bufferOffset += bitsSize;
+
+            memcpy(ret.buffer + bufferOffset, &(m_serverEvent.keyStateEvent.hasFocus), sizeof(bool));
+            bufferOffset += sizeof(bool);
+            break;
+        }
     }
 
+    // Only send what was encoded, not the whole scratch buffer
+    ret.bufferSize = bufferOffset;
     return ret;
 }
 
@@ -7,10 +7,16 @@ if(NOT TARGET linux_sendinput)
     find_package(linux_sendinput REQUIRED)
 endif()
 
+# Log sites below this level are compiled out (SPDLOG_DEBUG / SPDLOG_TRACE are used for anything per-event)
+if(NOT GWIDI_LOG_LEVEL)
+    set(GWIDI_LOG_LEVEL "$<IF:$<CONFIG:Debug>,SPDLOG_LEVEL_DEBUG,SPDLOG_LEVEL_INFO>")
+endif()
+
 add_library(gwidi_socketserver)
-target_sources(gwidi_socketserver PUBLIC ${CMAKE_CURRENT_LIST_DIR}/GwidiSocketServer.cc)
+target_sources(gwidi_socketserver PUBLIC ${CMAKE_CURRENT_LIST_DIR}/GwidiSocketServer.cc ${CMAKE_CURRENT_LIST_DIR}/GwidiLogging.cc ${CMAKE_CURRENT_LIST_DIR}/GwidiMetrics.cc)
 target_link_libraries(gwidi_socketserver PUBLIC spdlog::spdlog ${linux_sendinput_LIBRARIES})
 target_include_directories(gwidi_socketserver PUBLIC ${CMAKE_CURRENT_LIST_DIR}/include ${linux_sendinput_INCLUDE_DIRS})
+target_compile_definitions(gwidi_socketserver PUBLIC SPDLOG_ACTIVE_LEVEL=${GWIDI_LOG_LEVEL})
 
 set(gwidi_socketserver_INCLUDE_DIRS ${CMAKE_CURRENT_LIST_DIR}/include)
 set(gwidi_socketserver_LIBRARIES gwidi_socketserver)
@@ -0,0 +1,97 @@
+#ifndef GWIDI_INPUTSERVER_GWIDILOGGING_H
+#define GWIDI_INPUTSERVER_GWIDILOGGING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <spdlog/spdlog.h>
+
+// Per-event log sites use the SPDLOG_DEBUG / SPDLOG_TRACE macros so they compile away entirely when the build's
+// SPDLOG_ACTIVE_LEVEL (see GWIDI_LOG_LEVEL in cmake) is above them. Sites that can fire on every packet but still
+// matter in production (malformed input, send failures) are rate limited per call site instead.
+#define GWIDI_LOG_EVERY_MS(LOG_MACRO, intervalMs, ...) \
+    do { \
+        static ::gwidi::logging::RateLimiter gwidiRateLimiter_{std::chrono::milliseconds{intervalMs}}; \
+        if(gwidiRateLimiter_.allow()) { \
+            LOG_MACRO(__VA_ARGS__); \
+        } \
+    } while(0)
+
+#define GWIDI_LOG_EVERY_N(LOG_MACRO, n, ...) \
+    do { \
+        static std::atomic<std::uint64_t> gwidiSampleCount_{0}; \
+        if(gwidiSampleCount_.fetch_add(1, std::memory_order_relaxed) % (n) == 0) { \
+            LOG_MACRO(__VA_ARGS__); \
+        } \
+    } while(0)
+
+#define GWIDI_TRACE_EVENT(kind, code, value) \
+    do { \
+        if(::gwidi::logging::EventTrace::instance().enabled()) { \
+            ::gwidi::logging::EventTrace::instance().record((kind), (code), (value)); \
+        } \
+    } while(0)
+
+namespace gwidi::logging {
+
+// Replaces the default logger with an async one backed by a preallocated queue. Producers never block: when the
+// queue is full the oldest message is overwritten.
+void initAsyncLogging(std::size_t queueSize = 8192);
+
+class RateLimiter {
+public:
+    explicit RateLimiter(std::chrono::milliseconds interval) : m_intervalNs{std::chrono::nanoseconds{interval}.count()} {}
+
+    // True at most once per interval, lock-free and safe to share between threads
+    bool allow();
+
+private:
+    std::int64_t m_intervalNs;
+    std::atomic<std::int64_t> m_nextNs{0};
+};
+
+enum class TraceKind : std::uint16_t {
+    DATAGRAM_IN = 0,
+    DATAGRAM_OUT = 1,
+    KEY_READ = 2,
+    KEY_FORWARDED = 3,
+    FOCUS = 4,
+    INJECT = 5,
+};
+
+// Compact binary alternative to text logs: fixed 16 byte records in a preallocated ring, written with one atomic
+// increment and dumped to a file on demand (oldest record first).
+class EventTrace {
+public:
+    struct Record {
+        std::uint64_t timestampNs;  // CLOCK_MONOTONIC
+        std::uint16_t kind;
+        std::uint16_t code;
+        std::int32_t value;
+    };
+
+    static EventTrace& instance();
+
+    // capacity is rounded up to a power of two
+    void enable(std::size_t capacity = 1 << 16);
+
+    inline bool enabled() const {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    void record(TraceKind kind, int code, int value);
+    bool dump(const std::string& path);
+
+private:
+    std::atomic_bool m_enabled{false};
+    std::unique_ptr<Record[]> m_records;
+    std::size_t m_mask{0};
+    std::atomic<std::uint64_t> m_next{0};
+};
+
+}
+
+#endif //GWIDI_INPUTSERVER_GWIDILOGGING_H
@@ -0,0 +1,133 @@
+#ifndef GWIDI_INPUTSERVER_GWIDIMETRICS_H
+#define GWIDI_INPUTSERVER_GWIDIMETRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gwidi::metrics {
+
+enum class Counter : std::size_t {
+    DATAGRAMS_IN = 0,
+    DATAGRAMS_OUT,
+    BYTES_IN,
+    BYTES_OUT,
+    SEND_ERRORS,
+    PARSE_FAILURES,
+    UNKNOWN_TYPES,
+    EVDEV_EVENTS_READ,
+    EVDEV_EVENTS_FILTERED,
+    KEYS_FORWARDED,
+    RECONNECTS,
+    RETRANSMITS,
+    ACKS_IN,
+    DELIVERY_FAILURES,
+    MACROS_FIRED,
+    AXIS_EVENTS_FORWARDED,
+    AXIS_EVENTS_SUPPRESSED,
+    KEYS_SWALLOWED,
+    PASSTHROUGH_FRAMES,
+    PASSTHROUGH_LATENCY_US,
+    PASSTHROUGH_SLOW_FRAMES,
+    PEERS_DEAD,
+    HEARTBEATS_OUT,
+    REPEATS_COALESCED,
+    CONTROL_DROPPED,
+    COUNT
+};
+
+struct Sample {
+    std::string name;
+    std::string help;
+    bool isCounter;
+    std::uint64_t value;
+};
+
+// Counters are bumped through a block owned by the calling thread, so an increment is a plain relaxed load/store with
+// no contention. Blocks outlive their threads and are only summed when someone asks for a snapshot.
+class Metrics {
+public:
+    using GaugeFn = std::function<std::uint64_t()>;
+
+    static Metrics& instance();
+
+    inline void add(Counter counter, std::uint64_t n = 1) {
+        auto &value = localBlock().values[static_cast<std::size_t>(counter)];
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // Gauges are sampled on demand, the returned id removes the gauge again
+    int registerGauge(const std::string& name, const std::string& help, GaugeFn fn);
+    void unregisterGauge(int id);
+
+    std::vector<Sample> snapshot();
+    std::string prometheusText();
+
+private:
+    struct CounterBlock {
+        std::atomic<std::uint64_t> values[static_cast<std::size_t>(Counter::COUNT)]{};
+    };
+
+    struct Gauge {
+        int id;
+        std::string name;
+        std::string help;
+        GaugeFn fn;
+    };
+
+    CounterBlock& localBlock();
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<CounterBlock>> m_blocks;
+    std::vector<Gauge> m_gauges;
+    int m_nextGaugeId{0};
+};
+
+inline void count(Counter counter, std::uint64_t n = 1) {
+    Metrics::instance().add(counter, n);
+}
+
+// Serves Metrics::prometheusText() on a local Unix stream socket, answering every connection with a minimal HTTP/1.0
+// response so both `curl --unix-socket <path> http://localhost/metrics` and a plain socket reader work. Always served
+// from a thread of its own: a scraper that connects and never sends anything holds a connection open for a while, that
+// must never be the key path's time.
+class PrometheusExporter {
+public:
+    explicit PrometheusExporter(std::string socketPath);
+    ~PrometheusExporter();
+
+    void beginListening();
+    void stopListening();
+
+private:
+    int openSocket();
+    void closeSocket();
+    void acceptConnections();
+    void respond(int conn);
+    void serve();
+
+    // Connections waiting for their request, all polled together so a silent one only delays itself
+    struct Pending {
+        int fd;
+        std::chrono::steady_clock::time_point deadline;
+    };
+    std::vector<Pending> m_pending;     // exporter thread only
+    static constexpr std::size_t MAX_PENDING = 32;
+    static constexpr std::chrono::milliseconds REQUEST_TIMEOUT{100};
+
+    std::string m_socketPath;
+    int m_sockfd{-1};
+
+    std::atomic_bool m_thAlive{false};
+    std::shared_ptr<std::thread> m_th;
+};
+
+}
+
+#endif //GWIDI_INPUTSERVER_GWIDIMETRICS_H
@@ -0,0 +1,282 @@
+#ifndef GWIDI_INPUTSERVER_GWIDIPROTOCOL_H
+#define GWIDI_INPUTSERVER_GWIDIPROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Wire format shared by the server and gwidi_socketclient. Every datagram starts with an int ServerEventType, all
+// values are in host byte order (both ends live on the same machine).
+namespace gwidi::udpsocket {
+
+static constexpr int SERVER_PORT = 5577;    // the server listens here
+static constexpr int CLIENT_PORT = 5578;    // and sends everything to the client's address on this port
+
+static constexpr const char* HELLO_MESSAGE = "msg_hello";
+static constexpr const char* HELLO_REPLY = "msg_helloback";
+
+// A client's EVENT_HELLO is [type][size_t n][HELLO_MESSAGE], optionally followed by [size_t n][profile name] to
+// subscribe to that profile instead of the default one (DEFAULT_PROFILE)
+static constexpr const char* DEFAULT_PROFILE = "";
+
+enum ServerEventType {
+    EVENT_HELLO = 0,
+    EVENT_KEY = 1,
+    EVENT_FOCUS = 2,
+    EVENT_WATCHEDKEYS_RECONFIGURE = 3,
+    EVENT_SENDINPUT = 4,
+    EVENT_KEYSTATE = 5,
+    EVENT_STATS = 6,
+    EVENT_RECONFIGURE = 7,
+    EVENT_RECONFIGURE_ACK = 8,
+    EVENT_KEY_RELIABLE = 9,     // [type][uint32 seq][int code][int eventType]
+    EVENT_KEY_ACK = 10,         // client -> server: [type][uint32 highest seq received without gaps]
+    EVENT_KEYSTATE_REQUEST = 11,// client -> server: [type], answered with EVENT_KEYSTATE
+    EVENT_PING = 12,            // client -> server: [type][uint64 token]
+    EVENT_PONG = 13,            // [type][uint64 token] echoed back to whoever pinged
+    EVENT_AXIS = 14,            // [type][uint16 count] then count * [uint16 evType][uint16 code][int32 value]
+    EVENT_HEARTBEAT = 15,       // [type] to clients the server hasn't heard from lately, nothing to answer: if no one
+                                // is listening the kernel's port unreachable tells the server so
+    EVENT_KEY_HELD = 16,        // [type][int code][uint32 heldMs], see REPEAT_HELD
+    EVENT_KEYSTATE_RELIABLE = 17// [type][uint32 seq] then an EVENT_KEYSTATE payload. Sent in sequence with
+                                // EVENT_KEY_RELIABLE once the server gave up on delivering some of them, it supersedes
+                                // every event before seq and is acked like one
+};
+
+// EVENT_RECONFIGURE is [type][size_t fieldCount] followed by [int field][size_t size][payload] per field
+enum ReconfigureField {
+    RECONFIGURE_WATCHED_KEYS = 0,   // payload: int[]
+    RECONFIGURE_WINDOW_NAME = 1,    // payload: chars
+    RECONFIGURE_WINDOW_CLASS = 2,   // payload: chars
+    RECONFIGURE_FORWARDING_MODE = 3,// payload: int (ForwardingMode)
+    RECONFIGURE_MACRO_SET = 4,      // payload: [int id][int trigger][size_t n][int modifiers[n]][bool focusOnly]
+                                    //          [bool consumeTrigger][bool enabled][size_t m] then m * [int code][int action][uint32 delayMs]
+    RECONFIGURE_MACRO_REMOVE = 5,   // payload: int id
+    RECONFIGURE_MACRO_ENABLE = 6,   // payload: [int id][bool enabled]
+    RECONFIGURE_AXES = 7,           // payload: [bool enabled][size_t n] then n * [int evType][int code][int center]
+                                    //          [int deadband][int quantum][uint32 minIntervalMs]
+    RECONFIGURE_PROFILES = 8,       // payload: [size_t n] then n * [size_t][name][size_t][windowName][size_t][windowClass]
+                                    //          [size_t k][int watchedKeys[k]], replacing every named profile
+    RECONFIGURE_REPEATS = 9         // payload: [size_t n] then n * [int code][int mode][uint32 intervalMs], replacing
+                                    //          every repeat rule
+};
+
+enum ForwardingMode {
+    FORWARD_ALWAYS = 0,
+    FORWARD_FOCUS_GATED = 1
+};
+
+// The reader only forwards key codes below 0x100, so key state fits in a fixed 32 byte bitset
+static constexpr std::size_t KEYSTATE_BITS_SIZE = 0x100 / 8;
+
+struct KeyEvent {
+    int code;
+    int eventType;  // 0 == release, 1 == pressed, 2 == autorepeat (see RepeatMode)
+};
+
+struct KeyHeldEvent {
+    int code;
+    std::uint32_t heldMs;   // since the press, by the kernel's event timestamps
+};
+
+// What happens to the kernel's autorepeats of a watched key
+enum RepeatMode {
+    REPEAT_OFF = 0,         // dropped, the client sees the press and the release only
+    REPEAT_ALL = 1,         // every one is forwarded as eventType 2
+    REPEAT_THROTTLED = 2,   // forwarded as eventType 2, at most once per intervalMs
+    REPEAT_HELD = 3         // coalesced into an EVENT_KEY_HELD at most once per intervalMs
+};
+
+struct RepeatRule {
+    int code;               // -1 applies to every key without a rule of its own
+    RepeatMode mode;
+    std::uint32_t intervalMs{0};
+};
+
+struct WindowFocusEvent {
+    std::size_t windowNameSize;
+    const char* windowName;
+    bool hasFocus;
+};
+
+struct KeyStateEvent {
+    unsigned char keyBits[KEYSTATE_BITS_SIZE];  // bit (code % 8) of byte (code / 8) is set while the key is down
+    bool hasFocus;
+};
+
+// EV_ABS / EV_REL value, the server sends every axis that changed within one evdev frame (SYN_REPORT) together
+struct AxisEvent {
+    int evType;
+    int code;
+    int value;
+};
+
+static constexpr std::size_t AXIS_EVENT_SIZE = 2 * sizeof(std::uint16_t) + sizeof(std::int32_t);
+static constexpr std::size_t AXIS_EVENTS_PER_DATAGRAM = 64;
+
+// How the server shapes one axis before forwarding it. Absolute values within `deadband` of `center` snap to the
+// center and are rounded to multiples of `quantum` from it, unchanged results are not sent. Any axis is sent at most
+// once per `minIntervalMs`, the latest value (or for EV_REL the summed motion) goes out when the interval is up.
+// Relative axes ignore center, deadband and quantum.
+struct AxisRule {
+    int evType;
+    int code;               // -1 applies to every code of evType without a rule of its own
+    int center{0};
+    int deadband{0};
+    int quantum{1};
+    std::uint32_t minIntervalMs{0};
+};
+
+struct AxisSettings {
+    bool enabled{false};    // off: only EV_KEY is read and forwarded
+    std::vector<AxisRule> rules;
+};
+
+enum MacroAction {
+    MACRO_TAP = 0,
+    MACRO_PRESS = 1,
+    MACRO_RELEASE = 2
+};
+
+struct MacroStep {
+    int code;
+    MacroAction action;
+    std::uint32_t delayMs;  // waited before this step runs
+};
+
+// Pressing `trigger` while every modifier is held injects `steps` through the server's uinput device
+struct MacroDefinition {
+    int id;
+    int trigger;
+    std::vector<int> modifiers;
+    std::vector<MacroStep> steps;
+    bool focusOnly{true};       // only fires while the watched window has focus, losing it cancels pending steps
+    bool consumeTrigger{false}; // the trigger press/release is not forwarded to the client when the macro fires
+    bool enabled{true};
+};
+
+// A window and the keys forwarded to the clients subscribed to it while it has focus. The unnamed default profile is
+// made of the top level watched window and keys, named ones come on top of it.
+struct Profile {
+    std::string name;
+    std::string windowName;
+    std::string windowClass;        // takes precedence over the name when set
+    std::vector<int> watchedKeys;   // empty forwards every key
+};
+
+// Field by field, a reconfigure only republishes what actually changed
+inline bool operator==(const RepeatRule& a, const RepeatRule& b) {
+    return std::tie(a.code, a.mode, a.intervalMs) == std::tie(b.code, b.mode, b.intervalMs);
+}
+
+inline bool operator==(const AxisRule& a, const AxisRule& b) {
+    return std::tie(a.evType, a.code, a.center, a.deadband, a.quantum, a.minIntervalMs) ==
+           std::tie(b.evType, b.code, b.center, b.deadband, b.quantum, b.minIntervalMs);
+}
+
+inline bool operator==(const AxisSettings& a, const AxisSettings& b) {
+    return a.enabled == b.enabled && a.rules == b.rules;
+}
+
+inline bool operator==(const MacroStep& a, const MacroStep& b) {
+    return std::tie(a.code, a.action, a.delayMs) == std::tie(b.code, b.action, b.delayMs);
+}
+
+inline bool operator==(const MacroDefinition& a, const MacroDefinition& b) {
+    return std::tie(a.id, a.trigger, a.modifiers, a.steps, a.focusOnly, a.consumeTrigger, a.enabled) ==
+           std::tie(b.id, b.trigger, b.modifiers, b.steps, b.focusOnly, b.consumeTrigger, b.enabled);
+}
+
+inline bool operator==(const Profile& a, const Profile& b) {
+    return std::tie(a.name, a.windowName, a.windowClass, a.watchedKeys) ==
+           std::tie(b.name, b.windowName, b.windowClass, b.watchedKeys);
+}
+
+// Only the fields present in the message are set
+struct ReconfigureRequest {
+    std::optional<std::vector<int>> watchedKeys;
+    std::optional<std::string> windowName;
+    std::optional<std::string> windowClass;
+    std::optional<ForwardingMode> forwardingMode;
+    std::vector<MacroDefinition> setMacros;     // added, or replacing the macro with the same id
+    std::vector<int> removeMacros;
+    std::vector<std::pair<int, bool>> enableMacros;
+    std::optional<AxisSettings> axes;
+    std::optional<std::vector<Profile>> profiles;
+    std::optional<std::vector<RepeatRule>> repeats;
+};
+
+// Receiver side of EVENT_KEY_RELIABLE: hands events over in sequence order, holding back any that arrive ahead of a gap
+// until it is filled, drops retransmits of events already seen and tracks the cumulative ack to send back. Sequence
+// numbers restart at 1 whenever the server answers a hello.
+template<typename T>
+class SequenceWindow {
+public:
+    static constexpr std::int32_t CAPACITY = 64;
+
+    // Calls deliver(item) for this event and everything it unblocked, in order. Events too far ahead to hold are
+    // dropped without being acked, the server retransmits them. Returns false if the event was not taken.
+    template<typename Deliver>
+    inline bool accept(std::uint32_t seq, const T& item, Deliver&& deliver) {
+        auto distance = static_cast<std::int32_t>(seq - m_cumulative);
+        if(distance <= 0 || distance > CAPACITY) {
+            return false;
+        }
+
+        auto bit = std::uint64_t{1} << (distance - 1);
+        if(m_held & bit) {
+            return false;
+        }
+        m_held |= bit;
+        m_items[seq % CAPACITY] = item;
+        release(deliver);
+        return true;
+    }
+
+    // EVENT_KEYSTATE_RELIABLE: the state at `seq` supersedes every event before it, whether it arrived or not. Calls
+    // apply() and then deliver() for whatever was held back behind it. Returns false if it is stale.
+    template<typename Apply, typename Deliver>
+    inline bool resync(std::uint32_t seq, Apply&& apply, Deliver&& deliver) {
+        auto distance = static_cast<std::int32_t>(seq - m_cumulative);
+        if(distance <= 0) {
+            return false;
+        }
+
+        m_held = distance < CAPACITY ? m_held >> distance : 0;
+        m_cumulative = seq;
+        apply();
+        release(deliver);
+        return true;
+    }
+
+    inline std::uint32_t cumulativeAck() const {
+        return m_cumulative;
+    }
+
+    inline void reset() {
+        m_cumulative = 0;
+        m_held = 0;
+    }
+
+private:
+    template<typename Deliver>
+    inline void release(Deliver& deliver) {
+        while(m_held & 1) {
+            m_held >>= 1;
+            m_cumulative++;
+            deliver(m_items[m_cumulative % CAPACITY]);
+        }
+    }
+
+    std::uint32_t m_cumulative{0};
+    std::uint64_t m_held{0};    // bit i set: m_cumulative + 1 + i arrived and waits in m_items
+    T m_items[CAPACITY]{};      // by seq % CAPACITY
+};
+
+}
+
+#endif //GWIDI_INPUTSERVER_GWIDIPROTOCOL_H
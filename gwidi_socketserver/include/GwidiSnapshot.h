@@ -0,0 +1,242 @@
+#ifndef GWIDI_INPUTSERVER_GWIDISNAPSHOT_H
+#define GWIDI_INPUTSERVER_GWIDISNAPSHOT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace gwidi {
+
+template<typename T>
+struct Snapshot {
+    std::uint64_t version;
+    T value;
+};
+
+// Epoch based reclamation for SnapshotStore. A reading thread pins itself to the global epoch, the epoch only moves
+// on once every pinned thread has seen it, and whatever was retired two epochs back can't be in anyone's hands any
+// more. Readers never lock or wait, writers never wait for readers: they free what has become safe on their next
+// publish. Pins nest and only the outermost one costs a fence, a read loop pins once and all stages below it read for
+// the price of a counter.
+class SnapshotEpoch {
+public:
+    static constexpr std::uint64_t IDLE = std::numeric_limits<std::uint64_t>::max();
+
+    static inline void pin() {
+        auto &slot = local();
+        if(slot.depth++ == 0) {
+            slot.epoch.store(s_epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    static inline void unpin() {
+        auto &slot = local();
+        if(--slot.depth == 0) {
+            slot.epoch.store(IDLE, std::memory_order_release);
+        }
+    }
+
+    // Moves the epoch on if every pinned thread has caught up with it, returns the epoch as it is now
+    static std::uint64_t tryAdvance() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto epoch = s_epoch.load(std::memory_order_relaxed);
+        for(auto slot = s_slots.load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+            auto pinned = slot->epoch.load(std::memory_order_acquire);
+            if(pinned != IDLE && pinned != epoch) {
+                return epoch;
+            }
+        }
+        if(s_epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst)) {
+            return epoch + 1;
+        }
+        return epoch;
+    }
+
+    static inline std::uint64_t current() {
+        return s_epoch.load(std::memory_order_seq_cst);
+    }
+
+private:
+    // One per thread that ever read a snapshot, reused once the thread exits. Never freed, the list only grows to the
+    // most threads alive at once.
+    struct Slot {
+        std::atomic<std::uint64_t> epoch{IDLE};
+        std::atomic_bool used{true};
+        unsigned depth{0};          // owning thread only
+        Slot* next{nullptr};
+    };
+
+    // Hands the slot back when the thread exits
+    struct Release {
+        Slot* slot{nullptr};
+
+        ~Release() {
+            if(slot != nullptr) {
+                slot->depth = 0;
+                slot->epoch.store(IDLE, std::memory_order_release);
+                slot->used.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    // A plain thread_local pointer keeps the hot path free of the lazy-init guard, the Release only exists once claimed
+    static inline Slot& local() {
+        if(t_slot == nullptr) {
+            static thread_local Release release;
+            t_slot = claim();
+            release.slot = t_slot;
+        }
+        return *t_slot;
+    }
+
+    static Slot* claim() {
+        for(auto slot = s_slots.load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+            auto used = false;
+            if(!slot->used.load(std::memory_order_relaxed) && slot->used.compare_exchange_strong(used, true)) {
+                return slot;
+            }
+        }
+        auto slot = new Slot;
+        slot->next = s_slots.load(std::memory_order_relaxed);
+        while(!s_slots.compare_exchange_weak(slot->next, slot, std::memory_order_release, std::memory_order_relaxed)) {}
+        return slot;
+    }
+
+    static inline std::atomic<std::uint64_t> s_epoch{1};
+    static inline std::atomic<Slot*> s_slots{nullptr};
+    static inline thread_local Slot* t_slot{nullptr};
+};
+
+// Keeps the calling thread pinned for a scope, every snapshot read inside it is then just a load
+struct SnapshotPin {
+    SnapshotPin() {
+        SnapshotEpoch::pin();
+    }
+    ~SnapshotPin() {
+        SnapshotEpoch::unpin();
+    }
+    SnapshotPin(const SnapshotPin&) = delete;
+    SnapshotPin& operator=(const SnapshotPin&) = delete;
+};
+
+// Immutable, versioned snapshots published with a single atomic store. Readers on any thread call current() and keep
+// the returned Ptr for as long as they use the value, they never lock or wait on a writer; writers are serialized.
+// Replaced snapshots are retired and freed by a later publish once no reader can still hold them (see
+// SnapshotEpoch), reconfiguring in a loop doesn't accumulate anything.
+template<typename T>
+class SnapshotStore {
+public:
+    // Keeps its thread pinned while held, so it must be released on the thread that took it
+    class Ptr {
+    public:
+        Ptr() = default;
+        Ptr(const Ptr& other) : m_snapshot(other.m_snapshot) {
+            if(m_snapshot != nullptr) {
+                SnapshotEpoch::pin();
+            }
+        }
+        Ptr(Ptr&& other) noexcept : m_snapshot(std::exchange(other.m_snapshot, nullptr)) {}
+        Ptr& operator=(Ptr other) noexcept {
+            std::swap(m_snapshot, other.m_snapshot);
+            return *this;
+        }
+        ~Ptr() {
+            if(m_snapshot != nullptr) {
+                SnapshotEpoch::unpin();
+            }
+        }
+
+        inline const Snapshot<T>* get() const {
+            return m_snapshot;
+        }
+        inline const Snapshot<T>* operator->() const {
+            return m_snapshot;
+        }
+        inline const Snapshot<T>& operator*() const {
+            return *m_snapshot;
+        }
+        inline explicit operator bool() const {
+            return m_snapshot != nullptr;
+        }
+
+    private:
+        friend class SnapshotStore;
+        // The caller has pinned already
+        explicit Ptr(const Snapshot<T>* snapshot) : m_snapshot(snapshot) {}
+
+        const Snapshot<T>* m_snapshot{nullptr};
+    };
+
+    explicit SnapshotStore(T initial = T{}) {
+        publish(std::move(initial));
+    }
+
+    SnapshotStore(const SnapshotStore&) = delete;
+    SnapshotStore& operator=(const SnapshotStore&) = delete;
+
+    ~SnapshotStore() {
+        delete m_current.load(std::memory_order_relaxed);
+        for(auto &retired : m_retired) {
+            delete retired.snapshot;
+        }
+    }
+
+    inline Ptr current() const {
+        SnapshotEpoch::pin();
+        return Ptr(m_current.load(std::memory_order_acquire));
+    }
+
+    Ptr publish(T value) {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        return publishLocked(std::move(value));
+    }
+
+    // Copies the current value, lets `fn` modify the copy and publishes it as the next version
+    template<typename Fn>
+    Ptr update(Fn&& fn) {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        T value = current()->value;
+        fn(value);
+        return publishLocked(std::move(value));
+    }
+
+private:
+    struct Retired {
+        std::uint64_t epoch;
+        const Snapshot<T>* snapshot;
+    };
+
+    Ptr publishLocked(T value) {
+        auto snapshot = new Snapshot<T>{++m_version, std::move(value)};
+        SnapshotEpoch::pin();
+        auto previous = m_current.exchange(snapshot, std::memory_order_seq_cst);
+        if(previous != nullptr) {
+            m_retired.push_back({SnapshotEpoch::current(), previous});
+        }
+
+        auto epoch = SnapshotEpoch::tryAdvance();
+        auto freed = std::remove_if(m_retired.begin(), m_retired.end(), [epoch](const Retired& retired) {
+            if(retired.epoch + 2 > epoch) {
+                return false;
+            }
+            delete retired.snapshot;
+            return true;
+        });
+        m_retired.erase(freed, m_retired.end());
+        return Ptr(snapshot);
+    }
+
+    std::atomic<const Snapshot<T>*> m_current{nullptr};
+    std::mutex m_writeMutex;
+    std::uint64_t m_version{0};
+    std::vector<Retired> m_retired;     // writer only
+};
+
+}
+
+#endif //GWIDI_INPUTSERVER_GWIDISNAPSHOT_H
@@ -7,38 +7,24 @@
 #include <memory>
 #include <functional>
 #include <string>
+#include <vector>
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <deque>
+#include <condition_variable>
+#include <sys/poll.h>
 #include "LinuxSendInput.h"
+#include "GwidiMetrics.h"
+#include "GwidiProtocol.h"
+#include "GwidiSnapshot.h"
 
 namespace gwidi::udpsocket {
 
-enum ServerEventType {
-    EVENT_HELLO = 0,
-    EVENT_KEY = 1,
-    EVENT_FOCUS = 2,
-    EVENT_WATCHEDKEYS_RECONFIGURE = 3,
-    EVENT_SENDINPUT = 4
-};
-
-struct KeyEvent {
-    int code;
-    int eventType;  // 0 == release, 1 == pressed
-};
-
-struct WindowFocusEvent {
-    std::size_t windowNameSize;
-    const char* windowName;
-    bool hasFocus;
-};
-
-struct WatchedKeysReconfigEvent {
-    std::size_t watchedKeysSize;
-    int* watchedKeysList;
-};
-
 union ServerEvent {
     KeyEvent keyEvent;
     WindowFocusEvent focusEvent;
-    WatchedKeysReconfigEvent watchedKeysReconfigEvent;
+    KeyStateEvent keyStateEvent;
 };
 
 struct EventBuffer {
@@ -59,6 +45,7 @@ public:
     EventBuilder& withKeyEventType(int eventType);
     EventBuilder& withFocusWindowName(const std::string &windowName);
     EventBuilder& withFocusHasFocus(bool hasFocus);
+    EventBuilder& withKeyState(const KeyStateEvent &keyState);
 
     [[nodiscard]] EventBuffer build() const;
 
@@ -69,51 +56,300 @@ private:
     ServerEventType m_type;
 };
 
+// Where the server listens and where it sends to. Clients are answered at their own address, on clientPort unless
+// they subscribed to a profile, those are answered at the port they said hello from.
+struct ListenOptions {
+    std::string bindAddress{"127.0.0.1"};
+    int port{SERVER_PORT};
+    int clientPort{CLIENT_PORT};
+
+    // More than one opens that many SO_REUSEPORT sockets on the same port, each served by its own thread. The kernel
+    // hashes every client's address to one of them, so a single client's datagrams stay in order.
+    int listenerShards{1};
+};
+
 class ReaderSocketClient {
 public:
     ReaderSocketClient() = delete;
-    explicit ReaderSocketClient(const sockaddr_in& toAddr);
+    // The socket is connect()ed to the client, so sends skip the per-datagram route lookup and an ICMP port
+    // unreachable from the client's host comes back to us as ECONNREFUSED
+    explicit ReaderSocketClient(const sockaddr_in& toAddr, int port = CLIENT_PORT);
+    ReaderSocketClient(const ReaderSocketClient&) = delete;
+    ReaderSocketClient& operator=(const ReaderSocketClient&) = delete;
+    ~ReaderSocketClient();
     void sendKeyEvent(const KeyEvent& event);
+    void sendKeyHeldEvent(const KeyHeldEvent& event);
     void sendWindowFocusEvent(const std::string &windowName, bool hasFocus);
+    void sendKeyStateEvent(const KeyStateEvent &event);
+    // As few EVENT_AXIS datagrams as possible, AXIS_EVENTS_PER_DATAGRAM each
+    void sendAxisEvents(const std::vector<AxisEvent> &events);
+    void sendStats(const std::vector<metrics::Sample> &samples);
+    void sendReconfigureAck(std::uint64_t version);
+    void sendPong(std::uint64_t token);
     void sendHello();
+    void sendHeartbeat();
+
+    // False once a send was refused, nothing listens at the client's port any more. A new hello subscribes a fresh
+    // client, this one is never revived.
+    inline bool isAlive() const {
+        return !m_dead.load(std::memory_order_relaxed);
+    }
+
+    // Call with the arrival time of anything received from the client
+    inline void heard(std::chrono::steady_clock::time_point now) {
+        m_lastHeard.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+    // Picks up a refusal left by the last send, then sends a heartbeat if the client has been quiet for the current
+    // interval. The interval doubles up to HEARTBEAT_MAX for as long as the client stays quiet. Call from one thread
+    // only, returns isAlive().
+    bool heartbeatIfQuiet(std::chrono::steady_clock::time_point now);
+
+    static constexpr std::chrono::milliseconds HEARTBEAT_MIN{1000};
+    static constexpr std::chrono::milliseconds HEARTBEAT_MAX{32000};
+
+    // Sends in one datagram like sendKeyEvent and keeps the event until it is acked. Returns true if nothing else was
+    // outstanding, i.e. the caller has to arm the retransmit timer.
+    bool sendReliableKeyEvent(const KeyEvent& event);
+    void acknowledge(std::uint32_t seq);
+    // Resends events unacked for at least `timeout`. The client delivers in order and can't get past an event we stop
+    // resending, so once one has been sent MAX_ATTEMPTS times everything outstanding is dropped and resyncDue() is
+    // set. Returns true while any event is still outstanding or a resync is due.
+    bool retransmitExpired(std::chrono::steady_clock::time_point now, std::chrono::milliseconds timeout);
+    std::size_t unackedCount();
+
+    // Key events were dropped undelivered, the client is owed sendReliableKeyState()
+    bool resyncDue();
+    // EVENT_KEYSTATE_RELIABLE, sequenced, acked and retransmitted like a key event and superseding every one sent
+    // before it. `snapshot` is called once its sequence number is taken, so the state includes every earlier event.
+    void sendReliableKeyState(const std::function<KeyStateEvent()>& snapshot);
+
+    static constexpr std::size_t UNACKED_CAPACITY = 256;
+    static constexpr int MAX_ATTEMPTS = 5;
 private:
+    struct PendingKeyEvent {
+        std::uint32_t seq;
+        KeyEvent event;
+        std::chrono::steady_clock::time_point sentAt;
+        int attempts;
+        bool isKeyState{false};     // keyState is sent instead of event
+        KeyStateEvent keyState{};
+    };
+
+    ssize_t sendBuffer(const char* buffer, std::size_t bufferSize);
+    void sendPending(const PendingKeyEvent& pending);
+    // Bumps the attempts of what is due and copies it to m_retransmitting, gives up as retransmitExpired() describes
+    bool collectExpired(std::chrono::steady_clock::time_point now, std::chrono::milliseconds timeout);
+    void markDead();
+
     int sockfd;
     struct sockaddr_in m_toAddr;
+
+    std::atomic_bool m_dead{false};
+    std::atomic<std::chrono::steady_clock::rep> m_lastHeard;
+    std::chrono::steady_clock::time_point m_lastHeartbeat{};
+    std::chrono::milliseconds m_heartbeatInterval{HEARTBEAT_MIN};
+
+    std::mutex m_unackedMutex;
+    std::array<PendingKeyEvent, UNACKED_CAPACITY> m_unacked{};
+    std::size_t m_unackedHead{0};
+    std::size_t m_unackedSize{0};
+    std::uint32_t m_nextSeq{1};
+    bool m_resyncDue{false};
+    std::vector<PendingKeyEvent> m_retransmitting;  // retransmitExpired() only, copied out so it sends unlocked
 };
 
 class ReaderSocketServer {
 public:
     using EventCb = std::function<void(ServerEventType, ServerEvent)>;
+    // Applies the request and returns the configuration version it produced, which is acknowledged to the sender
+    using ReconfigureCb = std::function<std::uint64_t(const ReconfigureRequest&)>;
+    // Current watched key state of a profile and focus, sent after every hello and on EVENT_KEYSTATE_REQUEST
+    using KeyStateCb = std::function<KeyStateEvent(int profile)>;
+
+    // Pushed events go to the clients subscribed to one profile, by its index in setProfiles(), or to every client
+    static constexpr int ALL_PROFILES = -1;
+    // Oldest subscriber is dropped to make room beyond this
+    static constexpr std::size_t MAX_SUBSCRIBERS = 16;
 
     void beginListening();
+    // Joins the listener threads. The sockets and timers stay open until closeSocket() or destruction, key events may
+    // still be sent (and arm the retransmit timer) until the reader feeding them has stopped too.
     void stopListening();
 
+    // Inbound datagrams are split into two lanes. The key lane (EVENT_SENDINPUT, EVENT_KEY_ACK, EVENT_PING) is handled
+    // by whoever reads the socket, as soon as it is read. Everything else (hellos, reconfigures, key state and stats
+    // requests) is queued on the control lane and handled by a thread of its own, so it never delays a key.
+    static constexpr std::size_t CONTROL_LANE_CAPACITY = 64;   // newer control datagrams are dropped beyond this
+
+    // Reactor integration: bind without starting a thread and call handleReadable(fd) whenever one of sockets() is
+    // readable. openSocket() returns the first socket, or -1 if binding failed.
+    int openSocket();
+    // Only once nothing sends key events any more
+    void closeSocket();
+    inline const std::vector<int>& sockets() const {
+        return m_sockfds;
+    }
+    void handleReadable(int fd);
+    // Timer fd created by openSocket(), call handleRetransmit() whenever it is readable
+    inline int retransmitFd() const {
+        return m_retransmitFd;
+    }
+    void handleRetransmit();
+    // Periodic timer fd created by openSocket(), call handleHeartbeat() whenever it is readable
+    inline int heartbeatFd() const {
+        return m_heartbeatFd;
+    }
+    void handleHeartbeat();
+    // Eventfd created by openSocket(), call handleControl() whenever it is readable. With yieldToKeyLane it returns
+    // true early (and stays readable) while a key lane datagram is waiting or being handled, so control traffic only
+    // runs once the key lane is empty. The reactor loop and the control thread both serve it that way.
+    inline int controlFd() const {
+        return m_controlFd;
+    }
+    bool handleControl(bool yieldToKeyLane);
+
+    // Key events are sent as EVENT_KEY_RELIABLE and retransmitted until the client acks them
+    inline void setReliableKeyEvents(bool reliable) {
+        m_reliableKeyEvents.store(reliable);
+    }
+
+    static constexpr std::chrono::milliseconds RETRANSMIT_TIMEOUT{20};
+
     inline bool isAlive() {
         return m_thAlive.load();
     }
 
     inline bool isClientConnected() {
-        return m_socketClient != nullptr;
+        return !subscribers()->value.empty();
+    }
+
+    inline std::size_t clientCount() {
+        return subscribers()->value.size();
+    }
+
+    // Profile names in index order, DEFAULT_PROFILE first. Clients are matched to them by the name they said hello
+    // with, a name that isn't listed receives nothing until it is.
+    void setProfiles(std::vector<std::string> names);
+
+    inline const ListenOptions& listenOptions() const {
+        return m_options;
     }
 
     inline void setEventCb(EventCb cb) {
         m_eventCb = std::move(cb);
     }
 
-    void processEvent(char* buffer, struct sockaddr_in socketIn_client);
-    void sendKeyEvent(const KeyEvent &event);
-    void sendWindowFocusEvent(const std::string &windowName, bool hasFocus);
+    inline void setReconfigureCb(ReconfigureCb cb) {
+        m_reconfigureCb = std::move(cb);
+    }
+
+    inline void setKeyStateCb(KeyStateCb cb) {
+        m_keyStateCb = std::move(cb);
+    }
+
+    // The uinput device EVENT_SENDINPUT injects through, shared with anything else in the process that injects keys.
+    // Null until one has been handed over.
+    inline SendInput* sendInput() {
+        return m_sendInput.load();
+    }
+
+    // Hands over the uinput device once it is set up, may be called while listening but only once
+    void setSendInput(std::unique_ptr<SendInput> sendInput);
+
+    void processEvent(char* buffer, std::size_t bufferSize, struct sockaddr_in socketIn_client);
+    void sendKeyEvent(const KeyEvent &event, int profile = ALL_PROFILES);
+    void sendKeyHeldEvent(const KeyHeldEvent &event, int profile = ALL_PROFILES);
+    void sendWindowFocusEvent(const std::string &windowName, bool hasFocus, int profile = ALL_PROFILES);
+    void sendKeyStateEvent(const KeyStateEvent &event, int profile = ALL_PROFILES);
+    void sendAxisEvents(const std::vector<AxisEvent> &events, int profile = ALL_PROFILES);
 
     ReaderSocketServer();
+    // Takes a device that is already set up, or none (EVENT_SENDINPUT is dropped until setSendInput())
+    explicit ReaderSocketServer(std::unique_ptr<SendInput> sendInput, ListenOptions options = {});
     ~ReaderSocketServer();
 
 private:
+    struct Subscriber {
+        std::shared_ptr<ReaderSocketClient> client;
+        in_addr_t address;
+        in_port_t port;         // network order, 0 for clients answered on clientPort, which may send from any port
+        std::string profile;
+        int profileIndex;
+
+        inline bool matches(const sockaddr_in& from) const {
+            return address == from.sin_addr.s_addr && (port == 0 || port == from.sin_port);
+        }
+    };
+    using SubscriberList = std::vector<Subscriber>;
+
+    static constexpr std::size_t MAX_DATAGRAM_SIZE = 1024;
+    static constexpr std::size_t RECEIVE_BATCH = 16;     // datagrams per recvmmsg()
+    // The control thread waits at most this long for the key lane to drain before it looks again
+    static constexpr std::chrono::milliseconds KEY_LANE_BACKOFF{1};
+
+    struct ControlDatagram {
+        std::array<char, MAX_DATAGRAM_SIZE> buffer;
+        std::size_t size;
+        sockaddr_in from;
+    };
+
+    std::size_t receiveBatch(int fd);
+    void queueControl(const char* buffer, std::size_t size, const sockaddr_in& from);
+    bool keyLanePending();
+    void listen(int fd, bool handlesTimers);
+    void serveControl();
+
+    // Every listener thread may subscribe clients on hello while the reader thread sends through the list, so it is
+    // copied on write and published whole, senders read it without locking
+    inline gwidi::SnapshotStore<SubscriberList>::Ptr subscribers() const {
+        return m_subscribers.current();
+    }
+    const Subscriber* subscriberFor(const SubscriberList& list, const sockaddr_in& from) const;
+    void subscribe(const sockaddr_in& from, std::string profile);
+    int profileIndexLocked(const std::string& profile) const;
+
+    template<typename Fn>
+    inline void forEachSubscriber(int profile, Fn&& fn) const {
+        auto list = subscribers();
+        for(auto &subscriber : list->value) {
+            if((profile == ALL_PROFILES || subscriber.profileIndex == profile) && subscriber.client->isAlive()) {
+                fn(*subscriber.client);
+            }
+        }
+    }
+    bool parseReconfigure(const char* buffer, std::size_t bufferSize, ReconfigureRequest &out);
+    bool parseMacro(const char* buffer, std::size_t bufferSize, MacroDefinition &out);
+    bool parseAxes(const char* buffer, std::size_t bufferSize, AxisSettings &out);
+    bool parseProfiles(const char* buffer, std::size_t bufferSize, std::vector<Profile> &out);
+    bool parseRepeats(const char* buffer, std::size_t bufferSize, std::vector<RepeatRule> &out);
+    void armRetransmit();
+
     EventCb m_eventCb;
+    ReconfigureCb m_reconfigureCb;
+    KeyStateCb m_keyStateCb;
+    ListenOptions m_options;
+    std::vector<int> m_sockfds;
+    int m_retransmitFd{-1};
+    int m_heartbeatFd{-1};
+    int m_controlFd{-1};
+    std::mutex m_controlMutex;
+    std::deque<ControlDatagram> m_controlLane;
+    std::atomic<std::size_t> m_keyLaneDepth{0};    // read by a listener, not handled yet
+    std::atomic<std::size_t> m_keyLanePeak{0};     // deepest the key lane was found before draining, since last read
+    std::vector<pollfd> m_keyLanePollFds;           // every shard, for whoever serves the control lane
+    std::mutex m_keyLaneMutex;
+    std::condition_variable m_keyLaneDrained;       // a listener emptied its socket
+    std::vector<int> m_laneGaugeIds;
+    std::atomic_bool m_reliableKeyEvents{false};
 
     std::atomic_bool m_thAlive{false};
-    std::shared_ptr<std::thread> m_th;
-    std::shared_ptr<ReaderSocketClient> m_socketClient{nullptr};
-    std::unique_ptr<SendInput> m_sendInput;
+    std::vector<std::shared_ptr<std::thread>> m_th;
+    std::mutex m_subscribersMutex;      // serializes writers of m_subscribers and guards m_profileNames
+    std::vector<std::string> m_profileNames{DEFAULT_PROFILE};
+    gwidi::SnapshotStore<SubscriberList> m_subscribers;
+    std::unique_ptr<SendInput> m_sendInputOwner;
+    std::atomic<SendInput*> m_sendInput{nullptr};
 };
 
 }
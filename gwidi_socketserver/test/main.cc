@@ -1,8 +1,11 @@
 #include "GwidiSocketServer.h"
+#include <cstring>
 
-int main() {
+int main(int argc, char** argv) {
 
     auto server = gwidi::udpsocket::ReaderSocketServer();
+    // --reliable: key events are sequenced and retransmitted until the client acks them
+    server.setReliableKeyEvents(argc > 1 && strcmp(argv[1], "--reliable") == 0);
     server.beginListening();
 
     // Server starts and waits for client connection (first message from client: 'msg_hello')
@@ -19,6 +22,10 @@ int main() {
                 16,
                 1
             });
+            server.sendKeyEvent({
+                16,
+                0
+            });
 
             server.sendWindowFocusEvent("Test Window", true);
         }
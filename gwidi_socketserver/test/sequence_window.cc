@@ -0,0 +1,118 @@
+#include "GwidiProtocol.h"
+#include <spdlog/spdlog.h>
+#include <cstdint>
+#include <vector>
+
+// Feeds SequenceWindow the arrival orders lossy UDP produces and checks what a client would hand to its callbacks.
+// Exits non-zero on the first mismatch.
+namespace {
+
+using gwidi::udpsocket::KeyEvent;
+using gwidi::udpsocket::SequenceWindow;
+
+// What the client saw: key codes in delivery order, -1 for a key state snapshot
+struct Client {
+    SequenceWindow<KeyEvent> window;
+    std::vector<int> seen;
+
+    bool key(std::uint32_t seq, int code) {
+        return window.accept(seq, KeyEvent{code, 1}, [this](const KeyEvent &event) {
+            seen.push_back(event.code);
+        });
+    }
+
+    bool keyState(std::uint32_t seq) {
+        return window.resync(seq, [this] {
+            seen.push_back(-1);
+        }, [this](const KeyEvent &event) {
+            seen.push_back(event.code);
+        });
+    }
+};
+
+int failures = 0;
+
+void expect(const char* name, bool ok) {
+    if(!ok) {
+        spdlog::error("FAILED: {}", name);
+        failures++;
+    }
+    else {
+        spdlog::info("ok: {}", name);
+    }
+}
+
+}
+
+int main() {
+    {
+        Client client;
+        client.key(1, 10);
+        client.key(2, 11);
+        client.key(3, 12);
+        expect("in order", client.seen == std::vector<int>{10, 11, 12} && client.window.cumulativeAck() == 3);
+    }
+    {
+        // Press 1 is lost, release 2 and 3 arrive first: nothing may overtake 1
+        Client client;
+        client.key(2, 11);
+        client.key(3, 12);
+        expect("held behind a gap", client.seen.empty() && client.window.cumulativeAck() == 0);
+        client.key(1, 10);
+        expect("reordered", client.seen == std::vector<int>{10, 11, 12} && client.window.cumulativeAck() == 3);
+    }
+    {
+        Client client;
+        client.key(1, 10);
+        client.key(3, 12);
+        auto delivered = client.key(1, 10);
+        auto held = client.key(3, 12);
+        expect("duplicates dropped", !delivered && !held && client.seen == std::vector<int>{10});
+        client.key(2, 11);
+        expect("duplicate not delivered twice", client.seen == std::vector<int>{10, 11, 12});
+    }
+    {
+        // Beyond the window: dropped and not acked, the server retransmits it
+        Client client;
+        auto taken = client.key(SequenceWindow<KeyEvent>::CAPACITY + 1, 10);
+        expect("too far ahead", !taken && client.seen.empty() && client.window.cumulativeAck() == 0);
+        client.key(SequenceWindow<KeyEvent>::CAPACITY, 11);
+        expect("edge of the window held", client.seen.empty());
+    }
+    {
+        // The server gave up on 2, its snapshot at 4 supersedes 2 and the held 3, 5 is behind it
+        Client client;
+        client.key(1, 10);
+        client.key(3, 12);
+        client.key(5, 14);
+        client.keyState(4);
+        expect("gap replaced by key state", client.seen == std::vector<int>{10, -1, 14} && client.window.cumulativeAck() == 5);
+        auto stale = client.keyState(4);
+        auto late = client.key(2, 11);
+        expect("stale key state and late event dropped", !stale && !late && client.seen.size() == 3);
+    }
+    {
+        // A snapshot can be further ahead than the window, it is what clears a gap too big to hold
+        Client client;
+        client.keyState(1000);
+        client.key(1001, 10);
+        expect("key state far ahead", client.seen == std::vector<int>{-1, 10} && client.window.cumulativeAck() == 1001);
+    }
+    {
+        // Sequence numbers wrap around, compared modulo 2^32 like the server's acks (getting there takes two jumps)
+        Client client;
+        client.keyState(0x7fffffff);
+        client.keyState(0xfffffffe);
+        client.key(1, 12);
+        client.key(0, 11);
+        client.key(0xffffffff, 10);
+        expect("wraps", client.seen == std::vector<int>{-1, -1, 10, 11, 12} && client.window.cumulativeAck() == 1);
+    }
+
+    if(failures > 0) {
+        spdlog::error("{} failed", failures);
+        return 1;
+    }
+    spdlog::info("All passed");
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include "GwidiSnapshot.h"
+#include <spdlog/spdlog.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Readers hammer a SnapshotStore while a writer republishes it as fast as it can. Every snapshot a reader sees has
+// to be whole (all of its entries equal its version) and the replaced ones have to be freed as the writer goes on.
+// Exits non-zero on the first torn read or if retired snapshots pile up. Worth running under -fsanitize=address.
+namespace {
+
+std::atomic<long> live{0};
+
+struct Value {
+    std::vector<std::uint64_t> entries;
+
+    Value() {
+        live++;
+    }
+    explicit Value(std::uint64_t version) : entries(64, version) {
+        live++;
+    }
+    Value(const Value& other) : entries(other.entries) {
+        live++;
+    }
+    Value(Value&& other) noexcept : entries(std::move(other.entries)) {
+        live++;
+    }
+    ~Value() {
+        live--;
+    }
+};
+
+}
+
+int main(int argc, char** argv) {
+    auto publishes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000UL;
+    std::atomic_bool done{false};
+    std::atomic<long> torn{0};
+    std::atomic<long> reads{0};
+    long peak = 0;
+
+    {
+        gwidi::SnapshotStore<Value> store{Value{1}};
+
+        std::vector<std::thread> readers;
+        for(int i = 0; i < 3; i++) {
+            readers.emplace_back([&, i] {
+                while(!done.load()) {
+                    // Half the readers pin around a batch, like the read loop, the others pay for every read
+                    auto batch = [&] {
+                        auto snapshot = store.current();
+                        for(auto entry : snapshot->value.entries) {
+                            if(entry != snapshot->version) {
+                                torn++;
+                            }
+                        }
+                        reads++;
+                    };
+                    if(i % 2 == 0) {
+                        gwidi::SnapshotPin pin;
+                        for(int j = 0; j < 16; j++) {
+                            batch();
+                        }
+                    }
+                    else {
+                        batch();
+                    }
+                }
+            });
+        }
+
+        for(std::uint64_t version = 2; version <= publishes; version++) {
+            store.publish(Value{version});
+            peak = std::max(peak, live.load());
+        }
+        done.store(true);
+        for(auto &reader : readers) {
+            reader.join();
+        }
+
+        // Nothing pinned any more, one more publish frees all but the current snapshot and its predecessor
+        store.publish(Value{publishes + 1});
+        store.publish(Value{publishes + 2});
+        spdlog::info("{} publishes, {} reads, {} values alive at peak, {} now", publishes, reads.load(), peak,
+                     live.load());
+        if(live.load() > 3) {
+            spdlog::error("FAILED: retired snapshots were not freed");
+            return 1;
+        }
+    }
+
+    if(torn.load() > 0 || live.load() != 0) {
+        spdlog::error("FAILED: {} torn reads, {} values leaked", torn.load(), live.load());
+        return 1;
+    }
+    spdlog::info("All passed");
+    return 0;
+}
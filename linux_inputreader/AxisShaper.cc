@@ -0,0 +1,149 @@
+#include "AxisShaper.h"
+#include "GwidiMetrics.h"
+
+#include <cstdlib>
+
+namespace gwidi::input {
+
+void AxisShaper::setSettings(const gwidi::udpsocket::AxisSettings &settings) {
+    Rules rules;
+    rules.enabled = settings.enabled;
+    for(auto code = 0; code < ABS_CNT; code++) {
+        rules.abs[code] = {EV_ABS, code};
+    }
+    for(auto code = 0; code < REL_CNT; code++) {
+        rules.rel[code] = {EV_REL, code};
+    }
+
+    // Catch-all rules first so a rule for a specific code always wins
+    for(auto pass = 0; pass < 2; pass++) {
+        for(auto &rule : settings.rules) {
+            if((rule.code < 0) != (pass == 0)) {
+                continue;
+            }
+            auto apply = [&rule](gwidi::udpsocket::AxisRule &target) {
+                auto code = target.code;
+                target = rule;
+                target.code = code;
+                target.quantum = std::max(1, rule.quantum);
+            };
+            if(rule.evType == EV_ABS && rule.code < ABS_CNT) {
+                for(auto code = rule.code < 0 ? 0 : rule.code; code < (rule.code < 0 ? ABS_CNT : rule.code + 1); code++) {
+                    apply(rules.abs[code]);
+                }
+            }
+            else if(rule.evType == EV_REL && rule.code < REL_CNT) {
+                for(auto code = rule.code < 0 ? 0 : rule.code; code < (rule.code < 0 ? REL_CNT : rule.code + 1); code++) {
+                    apply(rules.rel[code]);
+                }
+            }
+        }
+    }
+    m_rules.publish(rules);
+}
+
+void AxisShaper::offer(int evType, int code, int value, Clock::time_point now, Events &out) {
+    auto snapshot = m_rules.current();
+    auto &rules = snapshot->value;
+    if(evType == EV_ABS && code >= 0 && code < ABS_CNT) {
+        auto &rule = rules.abs[code];
+        auto &state = m_abs[code];
+
+        auto offset = value - rule.center;
+        if(std::abs(offset) <= rule.deadband) {
+            offset = 0;
+        }
+        if(rule.quantum > 1) {
+            auto steps = (std::abs(offset) + rule.quantum / 2) / rule.quantum;
+            offset = (offset < 0 ? -steps : steps) * rule.quantum;
+        }
+        auto shaped = rule.center + offset;
+
+        if(state.pending) {
+            // Already waiting for the interval to end, the latest value is what goes out then
+            state.pendingValue = shaped;
+            metrics::count(metrics::Counter::AXIS_EVENTS_SUPPRESSED);
+            return;
+        }
+        if(state.sent && shaped == state.lastSent) {
+            metrics::count(metrics::Counter::AXIS_EVENTS_SUPPRESSED);
+            return;
+        }
+        auto interval = std::chrono::milliseconds{rule.minIntervalMs};
+        if(state.sent && now - state.lastSentAt < interval) {
+            hold(state, shaped, state.lastSentAt + interval);
+            return;
+        }
+        send(evType, code, shaped, state, now, out);
+    }
+    else if(evType == EV_REL && code >= 0 && code < REL_CNT && value != 0) {
+        auto &rule = rules.rel[code];
+        auto &state = m_rel[code];
+
+        if(state.pending) {
+            state.pendingValue += value;
+            metrics::count(metrics::Counter::AXIS_EVENTS_SUPPRESSED);
+            return;
+        }
+        auto interval = std::chrono::milliseconds{rule.minIntervalMs};
+        if(state.sent && now - state.lastSentAt < interval) {
+            hold(state, value, state.lastSentAt + interval);
+            return;
+        }
+        send(evType, code, value, state, now, out);
+    }
+}
+
+void AxisShaper::send(int evType, int code, int value, State &state, Clock::time_point now, Events &out) {
+    out.push_back({evType, code, value});
+    state.sent = true;
+    state.lastSent = value;
+    state.lastSentAt = now;
+    metrics::count(metrics::Counter::AXIS_EVENTS_FORWARDED);
+}
+
+void AxisShaper::hold(State &state, int value, Clock::time_point deadline) {
+    state.pending = true;
+    state.pendingValue = value;
+    metrics::count(metrics::Counter::AXIS_EVENTS_SUPPRESSED);
+    if(!m_nextDeadline || deadline < *m_nextDeadline) {
+        m_nextDeadline = deadline;
+    }
+}
+
+void AxisShaper::flushDue(Clock::time_point now, Events &out) {
+    if(!m_nextDeadline || now < *m_nextDeadline) {
+        return;
+    }
+    m_nextDeadline.reset();
+
+    auto snapshot = m_rules.current();
+    auto &rules = snapshot->value;
+    auto flush = [&](int evType, auto &states, auto &axisRules) {
+        for(std::size_t code = 0; code < states.size(); code++) {
+            auto &state = states[code];
+            if(!state.pending) {
+                continue;
+            }
+            auto deadline = state.lastSentAt + std::chrono::milliseconds{axisRules[code].minIntervalMs};
+            if(deadline > now) {
+                if(!m_nextDeadline || deadline < *m_nextDeadline) {
+                    m_nextDeadline = deadline;
+                }
+                continue;
+            }
+
+            state.pending = false;
+            // Swinging back to the value last sent within one interval is not a change; summed motion can cancel out
+            auto unchanged = evType == EV_ABS ? state.pendingValue == state.lastSent : state.pendingValue == 0;
+            if(rules.enabled && !unchanged) {
+                // Count the held value as an update, the suppressed counter already has it once
+                send(evType, static_cast<int>(code), state.pendingValue, state, now, out);
+            }
+        }
+    };
+    flush(EV_ABS, m_abs, rules.abs);
+    flush(EV_REL, m_rel, rules.rel);
+}
+
+}
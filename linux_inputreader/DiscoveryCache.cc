@@ -0,0 +1,121 @@
+#include "DiscoveryCache.h"
+
+#include <spdlog/spdlog.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace gwidi::input {
+
+namespace {
+
+constexpr const char* CACHE_HEADER = "gwidi-discovery 1";
+
+// Tab separated, the name and phys of a device may contain spaces
+std::vector<std::string> fields(const std::string& line) {
+    std::vector<std::string> out;
+    std::stringstream stream{line};
+    std::string field;
+    while(std::getline(stream, field, '\t')) {
+        out.emplace_back(std::move(field));
+    }
+    // getline doesn't report an empty last field
+    if(!line.empty() && line.back() == '\t') {
+        out.emplace_back();
+    }
+    return out;
+}
+
+// Highest code first, like std::bitset::to_string() but a nibble per character
+std::string keysToHex(const std::bitset<0x100> &keys) {
+    std::string hex;
+    for(auto nibble = static_cast<int>(keys.size() / 4) - 1; nibble >= 0; nibble--) {
+        auto value = 0;
+        for(auto bit = 3; bit >= 0; bit--) {
+            value = (value << 1) | keys.test(nibble * 4 + bit);
+        }
+        hex += "0123456789abcdef"[value];
+    }
+    return hex;
+}
+
+std::bitset<0x100> keysFromHex(const std::string &hex) {
+    if(hex.size() != 0x100 / 4) {
+        throw std::invalid_argument("key bits");
+    }
+    std::bitset<0x100> keys;
+    for(std::size_t i = 0; i < hex.size(); i++) {
+        auto value = std::stoi(hex.substr(i, 1), nullptr, 16);
+        auto nibble = hex.size() - 1 - i;
+        for(auto bit = 0; bit < 4; bit++) {
+            keys.set(nibble * 4 + bit, (value >> bit) & 1);
+        }
+    }
+    return keys;
+}
+
+}
+
+std::optional<DiscoveryCache> DiscoveryCache::load(const std::string &path) {
+    std::ifstream in{path};
+    std::string line;
+    if(!in || !std::getline(in, line) || line != CACHE_HEADER) {
+        return std::nullopt;
+    }
+
+    DiscoveryCache cache;
+    while(std::getline(in, line)) {
+        auto entry = fields(line);
+        try {
+            // device <path> <bustype> <vendor> <product> <version> <key bits> <phys> <name>
+            if(entry.size() == 9 && entry[0] == "device") {
+                DeviceInfo info;
+                info.path = entry[1];
+                info.id.bustype = static_cast<__u16>(std::stoul(entry[2], nullptr, 16));
+                info.id.vendor = static_cast<__u16>(std::stoul(entry[3], nullptr, 16));
+                info.id.product = static_cast<__u16>(std::stoul(entry[4], nullptr, 16));
+                info.id.version = static_cast<__u16>(std::stoul(entry[5], nullptr, 16));
+                info.keys = keysFromHex(entry[6]);
+                info.phys = entry[7];
+                info.name = entry[8];
+                cache.devices.emplace_back(std::move(info));
+            }
+            // window <pid> <class>
+            else if(entry.size() == 3 && entry[0] == "window") {
+                cache.window = WindowHint{entry[2], static_cast<std::uint32_t>(std::stoul(entry[1]))};
+            }
+        }
+        catch(const std::exception &e) {
+            spdlog::warn("Ignoring discovery cache {}, it is malformed: {}", path, e.what());
+            return std::nullopt;
+        }
+    }
+    return cache;
+}
+
+bool DiscoveryCache::save(const std::string &path) const {
+    auto tmpPath = path + ".tmp";
+    {
+        std::ofstream out{tmpPath, std::ios::trunc};
+        out << CACHE_HEADER << '\n';
+        for(auto &info : devices) {
+            out << fmt::format("device\t{}\t{:04x}\t{:04x}\t{:04x}\t{:04x}\t{}\t{}\t{}\n", info.path, info.id.bustype,
+                               info.id.vendor, info.id.product, info.id.version, keysToHex(info.keys), info.phys, info.name);
+        }
+        if(window) {
+            out << fmt::format("window\t{}\t{}\n", window->pid, window->wmClass);
+        }
+        if(!out.flush()) {
+            spdlog::warn("Unable to write discovery cache {}", tmpPath);
+            return false;
+        }
+    }
+    if(std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        spdlog::warn("Unable to replace discovery cache {}", path);
+        return false;
+    }
+    return true;
+}
+
+}
@@ -1,6 +1,7 @@
 #include <csignal>
 #include "LinuxInputReader.h"
-#include <spdlog/spdlog.h>
+#include "GwidiLogging.h"
+#include "GwidiProbes.h"
 #include <filesystem>
 #include <linux/input.h>
 
@@ -9,9 +10,16 @@
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <sys/eventfd.h>
 
-#include <X11/Xlib.h>
-#include <X11/Xatom.h>
+#include <algorithm>
+#include <iterator>
+#include <unordered_set>
+#include <cassert>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
 
 #define MAXSTR 1000
 
@@ -20,46 +28,244 @@ namespace gwidi::input {
 
 int LinuxInputReader::m_timeoutMs{5000};
 
-bool supports_key_events(const int &fd) {
+// Keyboards, plus anything with axes (gamepads, mice) so they can be forwarded when enabled
+bool supports_input_events(const int &fd) {
     unsigned long evbit = 0;
     ioctl(fd, EVIOCGBIT(0, sizeof(evbit)), &evbit);
-    return (evbit & (1 << EV_KEY));
+    return (evbit & ((1 << EV_KEY) | (1 << EV_ABS) | (1 << EV_REL)));
 }
 
-void LinuxInputReader::findInputDevices() {
-    // Requires root
-    auto uid = getuid();
-    if(uid != 0) {
-        spdlog::warn("User is not root, cross-process hotkeys may not function!");
+// Empty if it isn't an evdev node at all
+std::optional<DeviceInfo> identify_device(const int &fd, const std::string &path) {
+    DeviceInfo info;
+    info.path = path;
+    if(ioctl(fd, EVIOCGID, &info.id) < 0) {
+        return std::nullopt;
     }
+    char buffer[256]{};
+    ioctl(fd, EVIOCGPHYS(sizeof(buffer) - 1), buffer);
+    info.phys = buffer;
+    memset(buffer, 0, sizeof(buffer));
+    ioctl(fd, EVIOCGNAME(sizeof(buffer) - 1), buffer);
+    info.name = buffer;
+    return info;
+}
+
+void read_key_capabilities(const int &fd, DeviceInfo &info) {
+    unsigned long keyBits[KEY_MAX / (8 * sizeof(unsigned long)) + 1]{};
+    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keyBits)), keyBits);
+    for(std::size_t code = 0; code < info.keys.size(); code++) {
+        info.keys.set(code, (keyBits[code / (8 * sizeof(unsigned long))] >> (code % (8 * sizeof(unsigned long)))) & 1);
+    }
+}
 
+// Our own clones carry nothing the grabbed originals didn't, reading them would only see it twice
+bool is_passthrough_clone(const DeviceInfo &info) {
+    return info.name.compare(0, strlen(SendInput::CLONE_NAME_PREFIX), SendInput::CLONE_NAME_PREFIX) == 0;
+}
+
+// Opens and probes every event node not in `skip`, returns the ones worth reading
+std::vector<std::pair<int, DeviceInfo>> scan_input_devices(const std::unordered_set<std::string> &skip) {
     char eventPathStart[] = "/dev/input/event";
-    m_inputDevices.clear();
-    for (auto &i : std::filesystem::directory_iterator("/dev/input")) {
+    std::vector<std::pair<int, DeviceInfo>> found;
+    std::error_code ec;
+    std::filesystem::directory_iterator inputDir("/dev/input", ec);
+    if(ec) {
+        spdlog::warn("Unable to list /dev/input: {}", ec.message());
+        return found;
+    }
+    for (auto &i : inputDir) {
         if(i.is_character_file()) {
             std::string view(i.path());
-            if (view.compare(0, sizeof(eventPathStart)-1, eventPathStart) == 0) {
+            if (view.compare(0, sizeof(eventPathStart)-1, eventPathStart) == 0 && skip.count(view) == 0) {
                 int evfile = open(view.c_str(), O_RDONLY | O_NONBLOCK);
-                if(supports_key_events(evfile)) {
+                if(evfile < 0) {
+                    continue;
+                }
+                auto info = identify_device(evfile, view);
+                if(info && supports_input_events(evfile) && !is_passthrough_clone(*info)) {
                     spdlog::debug("Adding {}", i.path().c_str());
-                    m_inputDevices.push_back({evfile, POLLIN, 0});
+                    read_key_capabilities(evfile, *info);
+                    found.emplace_back(evfile, std::move(*info));
                 } else {
                     close(evfile);
                 }
             }
         }
     }
+    return found;
+}
+
+void LinuxInputReader::grabKeyboard(int fd) {
+    // Without a clone to re-emit through, grabbing would take the keyboard away from everyone
+    auto clone = SendInput::cloneOf(fd);
+    if(!clone) {
+        spdlog::warn("Unable to create a uinput clone of fd {}, not grabbing it", fd);
+        return;
+    }
+    if(ioctl(fd, EVIOCGRAB, 1) != 0) {
+        spdlog::warn("Unable to grab fd {}: {}", fd, strerror(errno));
+        return;
+    }
+    // Kernel timestamps on the same clock as steady_clock, for the passthrough latency
+    int clockId = CLOCK_MONOTONIC;
+    ioctl(fd, EVIOCSCLOCKID, &clockId);
+
+    auto &passthrough = m_passthrough[fd];
+    passthrough.clone = std::move(clone);
+    passthrough.frame.reserve(16);
+    spdlog::info("Grabbed keyboard on fd {}, unclaimed keys pass through", fd);
+}
+
+void LinuxInputReader::addInputDevice(int fd, DeviceInfo info) {
+    if(m_exclusiveGrab && info.isKeyboard()) {
+        grabKeyboard(fd);
+    }
+    m_inputDevices.push_back({fd, POLLIN, 0});
+    m_deviceInfo.emplace(fd, std::move(info));
+}
+
+void LinuxInputReader::findInputDevices() {
+    // Requires root
+    auto uid = getuid();
+    if(uid != 0) {
+        spdlog::warn("User is not root, cross-process hotkeys may not function!");
+    }
+
+    std::lock_guard<std::mutex> lock(m_inputDevicesMutex);
+    m_inputDevices.clear();
+    m_deviceInfo.clear();
+    m_inputDevicesOpened = true;
+    for(auto &[fd, info] : scan_input_devices({})) {
+        addInputDevice(fd, std::move(info));
+    }
+}
+
+const std::vector<pollfd> &LinuxInputReader::openInputDevices(const std::vector<DeviceInfo> &known) {
+    {
+        std::lock_guard<std::mutex> lock(m_inputDevicesMutex);
+        m_inputDevices.clear();
+        m_deviceInfo.clear();
+        m_inputDevicesOpened = true;
+        for(auto &cached : known) {
+            int evfile = open(cached.path.c_str(), O_RDONLY | O_NONBLOCK);
+            if(evfile < 0) {
+                continue;
+            }
+            // Capabilities don't change while the device is the same one, they are taken from the cache as they are
+            auto info = identify_device(evfile, cached.path);
+            if(!info || !info->sameDevice(cached)) {
+                spdlog::debug("{} is no longer {}, skipping it", cached.path, cached.name);
+                close(evfile);
+                continue;
+            }
+            info->keys = cached.keys;
+            addInputDevice(evfile, std::move(*info));
+        }
+        spdlog::info("Opened {} of {} cached input devices", m_inputDevices.size(), known.size());
+    }
+    resyncKeyState();
+    return m_inputDevices;
+}
+
+std::vector<DeviceInfo> LinuxInputReader::confirmInputDevices() {
+    std::unordered_set<std::string> open;
+    std::vector<DeviceInfo> devices;
+    {
+        std::lock_guard<std::mutex> lock(m_inputDevicesMutex);
+        for(auto &[fd, info] : m_deviceInfo) {
+            open.insert(info.path);
+            devices.push_back(info);
+        }
+    }
+
+    auto found = scan_input_devices(open);
+    if(found.empty()) {
+        return devices;
+    }
+    for(auto &entry : found) {
+        devices.push_back(entry.second);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_inputDevicesMutex);
+        std::move(found.begin(), found.end(), std::back_inserter(m_discovered));
+    }
+    uint64_t one = 1;
+    write(m_discoveredFd, &one, sizeof(one));
+    return devices;
+}
+
+std::vector<int> LinuxInputReader::adoptDiscoveredDevices() {
+    uint64_t value;
+    while(read(m_discoveredFd, &value, sizeof(value)) == sizeof(value)) {}
+
+    std::vector<int> fds;
+    {
+        std::lock_guard<std::mutex> lock(m_inputDevicesMutex);
+        for(auto &[fd, info] : m_discovered) {
+            fds.push_back(fd);
+            addInputDevice(fd, std::move(info));
+        }
+        m_discovered.clear();
+    }
+    if(!fds.empty()) {
+        spdlog::info("Added {} input devices the cache didn't know", fds.size());
+        resyncKeyState();
+    }
+    return fds;
+}
+
+void LinuxInputReader::resyncKeyState() {
+    std::uint64_t words[0x100 / 64]{};
+    unsigned char keyBits[KEY_MAX / 8 + 1];
+    {
+        std::lock_guard<std::mutex> lock(m_inputDevicesMutex);
+        for(auto &pfd : m_inputDevices) {
+            memset(keyBits, 0, sizeof(keyBits));
+            if(ioctl(pfd.fd, EVIOCGKEY(sizeof(keyBits)), keyBits) < 0) {
+                continue;
+            }
+            for(auto code = 0; code < 0x100; code++) {
+                if(keyBits[code / 8] & (1 << (code % 8))) {
+                    words[code / 64] |= std::uint64_t{1} << (code % 64);
+                }
+            }
+        }
+    }
+    for(std::size_t i = 0; i < 0x100 / 64; i++) {
+        m_pressedKeys[i].store(words[i], std::memory_order_relaxed);
+    }
+}
+
+void LinuxInputReader::setKeyPressed(int code, bool pressed) {
+    auto bit = std::uint64_t{1} << (code % 64);
+    if(pressed) {
+        m_pressedKeys[code / 64].fetch_or(bit, std::memory_order_relaxed);
+    }
+    else {
+        m_pressedKeys[code / 64].fetch_and(~bit, std::memory_order_relaxed);
+    }
 }
 
 void LinuxInputReader::beginListening() {
+    startThread([this](int fd) {
+        handleReadable(fd);
+    });
+}
+
+void LinuxInputReader::startThread(std::function<void(int)> onReadable) {
     if(m_thAlive.load()) {
         return;
     }
 
     m_thAlive.store(true);
 
-    m_th = std::make_shared<std::thread>([this] {
-        findInputDevices();
+    m_th = std::make_shared<std::thread>([this, onReadable = std::move(onReadable)] {
+        // The server opens the devices up front so the scan overlaps with the rest of its startup
+        if(!m_inputDevicesOpened) {
+            findInputDevices();
+            resyncKeyState();
+        }
 
         // Requires root
         auto uid = getuid();
@@ -67,230 +273,739 @@ void LinuxInputReader::beginListening() {
             spdlog::warn("User is not root, cross-process hotkeys may not function!");
         }
 
-        input_event ev{};
         while(m_thAlive.load()) {
-            poll(m_inputDevices.data(), m_inputDevices.size(), m_timeoutMs);
-            for (auto &pfd : m_inputDevices) {
-                if (pfd.revents & POLLIN) {
-                    if(read(pfd.fd, &ev, sizeof(ev)) == sizeof(ev)) {
-                        // value: or 0 for EV_KEY for release, 1 for keypress and 2 for autorepeat
-                        if(ev.type == EV_KEY && ev.code < 0x100 && ev.value >= 0 && ev.value <= 1) {
-                            if(keyWatched(ev.code)) {
-                                if((ev.value == 0 || ev.value == 1) && m_watchedKeyCb) {
-                                    spdlog::info("sending key: {}, {}", ev.code, ev.value);
-                                    m_watchedKeyCb(ev.code, ev.value);
-                                }
-                            }
-                        }
-                    }
+            // Grabbed keyboards have to keep passing through while paused
+            if(m_paused.load() && m_passthrough.empty()) {
+                std::unique_lock<std::mutex> lock(m_pauseMutex);
+                m_pauseCv.wait(lock, [this] { return !m_paused.load() || !m_thAlive.load(); });
+                lock.unlock();
+
+                // Anything typed while we were paused went to another application
+                drainInputDevices();
+                continue;
+            }
+
+            // Wake up in time for axis values held back by rate limiting
+            auto timeoutMs = m_timeoutMs;
+            if(auto deadline = m_axes.nextDeadline()) {
+                auto untilDeadline = std::chrono::ceil<std::chrono::milliseconds>(*deadline - AxisShaper::Clock::now());
+                timeoutMs = std::clamp(static_cast<int>(untilDeadline.count()), 0, m_timeoutMs);
+            }
+
+            // The discovered fd goes first, devices a background scan found join the set as soon as it fires
+            if(m_pollFds.size() != m_inputDevices.size() + 1) {
+                m_pollFds.assign({{m_discoveredFd, POLLIN, 0}});
+                m_pollFds.insert(m_pollFds.end(), m_inputDevices.begin(), m_inputDevices.end());
+            }
+            poll(m_pollFds.data(), m_pollFds.size(), timeoutMs);
+            for (std::size_t i = 1; i < m_pollFds.size(); i++) {
+                if (m_pollFds[i].revents & POLLIN) {
+                    onReadable(m_pollFds[i].fd);
                 }
             }
+            if(m_pollFds.front().revents & POLLIN) {
+                adoptDiscoveredDevices();
+            }
+            flushAxes();
         }
 
-        for(auto &pfd : m_inputDevices) {
-            close(pfd.fd);
-        }
+        closeInputDevices();
     });
-    m_th->detach();
 }
 
-void LinuxInputReader::stopListening() {
-    m_thAlive.store(false);
+const std::vector<pollfd> &LinuxInputReader::openInputDevices() {
+    findInputDevices();
+    resyncKeyState();
+    return m_inputDevices;
 }
 
-bool LinuxInputReader::keyWatched(int code) {
-    // There is a special case for when we have an empty list -- we just allow all keys
-    if(m_watchedKeys.empty()) {
-        return true;
+void LinuxInputReader::closeInputDevices() {
+    std::lock_guard<std::mutex> lock(m_inputDevicesMutex);
+    for(auto &pfd : m_inputDevices) {
+        if(isGrabbed(pfd.fd)) {
+            ioctl(pfd.fd, EVIOCGRAB, 0);
+        }
+        close(pfd.fd);
     }
-    return std::find(m_watchedKeys.begin(), m_watchedKeys.end(), code) != m_watchedKeys.end();
+    for(auto &entry : m_discovered) {
+        close(entry.first);
+    }
+    m_inputDevices.clear();
+    m_deviceInfo.clear();
+    m_discovered.clear();
+    m_passthrough.clear();
+    m_inputDevicesOpened = false;
 }
 
-LinuxInputReader::~LinuxInputReader() {
-    if(m_thAlive.load() && m_th->joinable()) {
-        m_thAlive.store(false);
-        m_th->join();
+void LinuxInputReader::handleOtherEvent(Passthrough *passthrough, const input_event &ev, bool paused) {
+    if(paused) {
+        // Only grabbed keyboards are read while paused, nothing new is claimed then
+        if(passthrough && !claimKey(*passthrough, ev, false)) {
+            passthroughEvent(*passthrough, ev);
+        }
+        return;
+    }
+
+    if(passthrough && !claimKey(*passthrough, ev, false)) {
+        passthroughEvent(*passthrough, ev);
+    }
+
+    if((ev.type == EV_ABS || ev.type == EV_REL) && m_axes.enabled()) {
+        m_axes.offer(ev.type, ev.code, ev.value, AxisShaper::Clock::now(), m_axisFrame);
+    }
+    else if(ev.type == EV_SYN && ev.code == SYN_REPORT && !m_axisFrame.empty()) {
+        if(m_axisCb) {
+            m_axisCb(m_axisFrame);
+        }
+        m_axisFrame.clear();
+    }
+}
+
+bool LinuxInputReader::claimKey(Passthrough &passthrough, const input_event &ev, bool claimed) {
+    if(ev.type != EV_KEY || ev.code >= 0x100) {
+        return false;
+    }
+    // Repeats and the release go wherever the press went, whatever the server thinks of the key by now
+    if(ev.value == 1) {
+        passthrough.claimed.set(ev.code, claimed);
     }
     else {
+        claimed = passthrough.claimed.test(ev.code);
+        if(ev.value == 0) {
+            passthrough.claimed.reset(ev.code);
+        }
+    }
+    if(claimed) {
+        metrics::count(metrics::Counter::KEYS_SWALLOWED);
+    }
+    return claimed;
+}
+
+void LinuxInputReader::passthroughEvent(Passthrough &passthrough, const input_event &ev) {
+    if(ev.type != EV_SYN) {
+        if(!passthrough.dropping) {
+            passthrough.frame.push_back(ev);
+        }
+        return;
+    }
+    if(ev.code == SYN_DROPPED) {
+        // The kernel lost events, the partial frame is meaningless
+        passthrough.frame.clear();
+        passthrough.dropping = true;
+        return;
+    }
+    if(ev.code != SYN_REPORT) {
+        return;
+    }
+    passthrough.dropping = false;
+
+    // Frames that only held claimed keys (or just a MSC_SCAN for one) leave nothing for the clone
+    auto hasChange = std::any_of(passthrough.frame.begin(), passthrough.frame.end(), [](const input_event& e) {
+        return e.type != EV_MSC;
+    });
+    if(hasChange) {
+        passthrough.frame.push_back(ev);
+        passthrough.clone->sendFrame(passthrough.frame.data(), passthrough.frame.size());
+
+        timespec now{};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        auto latencyUs = (now.tv_sec - ev.time.tv_sec) * 1000000L + now.tv_nsec / 1000 - ev.time.tv_usec;
+        GWIDI_PROBE3(passthrough, passthrough.frame.size(), latencyUs, passthrough.frame.front().code);
+        metrics::count(metrics::Counter::PASSTHROUGH_FRAMES);
+        metrics::count(metrics::Counter::PASSTHROUGH_LATENCY_US, latencyUs > 0 ? latencyUs : 0);
+        if(latencyUs >= 1000) {
+            metrics::count(metrics::Counter::PASSTHROUGH_SLOW_FRAMES);
+        }
+    }
+    passthrough.frame.clear();
+}
+
+void LinuxInputReader::flushAxes() {
+    m_axes.flushDue(AxisShaper::Clock::now(), m_axisFrame);
+    if(!m_axisFrame.empty()) {
+        if(m_axisCb) {
+            m_axisCb(m_axisFrame);
+        }
+        m_axisFrame.clear();
+    }
+}
+
+void LinuxInputReader::stopListening() {
+    {
+        std::lock_guard<std::mutex> lock(m_pauseMutex);
         m_thAlive.store(false);
     }
+    m_pauseCv.notify_all();
+
+    // The thread calls into whatever it was started with, it has to be gone before the caller tears that down
+    if(m_th && m_th->joinable() && m_th->get_id() != std::this_thread::get_id()) {
+        m_th->join();
+    }
 }
 
+void LinuxInputReader::setPaused(bool paused) {
+    // Nothing updated the key state while we were paused, have it current before anyone asks for a snapshot
+    if(!paused && m_paused.load()) {
+        resyncKeyState();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_pauseMutex);
+        m_paused.store(paused);
+    }
+    m_pauseCv.notify_all();
+}
 
-std::string InputFocusDetector::currentFocusedWindowName() {
-    auto window = getWindowProperty(m_rootWindow, m_display, "_NET_ACTIVE_WINDOW");
-    auto windowName = getStringProperty(window, m_display, "_NET_WM_NAME");
-    auto ret = std::string{reinterpret_cast<char*>(windowName)};
-    XFree(windowName);
+void LinuxInputReader::drainInputDevices() {
+    input_event ev{};
+    for(auto &pfd : m_inputDevices) {
+        // Grabbed keyboards were read all along, whatever is queued there is meant for the game
+        if(isGrabbed(pfd.fd)) {
+            continue;
+        }
+        while(read(pfd.fd, &ev, sizeof(ev)) == sizeof(ev)) {}
+    }
+    resyncKeyState();
+}
+
+std::bitset<0x100> LinuxInputReader::pressedKeys() {
+    std::bitset<0x100> ret;
+    for(std::size_t i = 0; i < 0x100 / 64; i++) {
+        ret |= std::bitset<0x100>{m_pressedKeys[i].load(std::memory_order_relaxed)} << (i * 64);
+    }
     return ret;
 }
 
-unsigned long InputFocusDetector::getWindowProperty(unsigned long window, Display* display, const char *propName) {
-    auto prop = getStringProperty(window, display, propName);
-    unsigned long long_property = prop[0] + (prop[1]<<8) + (prop[2]<<16) + (prop[3]<<24);
-    XFree(prop);
-    return long_property;
+std::bitset<0x100> LinuxInputReader::pressedWatchedKeys() {
+    auto snapshot = m_watchedKeys.current();
+    auto &filter = snapshot->value;
+    auto pressed = pressedKeys();
+    return filter.allowAll ? pressed : pressed & filter.keys;
+}
+
+KeyFilter KeyFilter::of(const std::vector<int> &codes) {
+    KeyFilter filter;
+    // There is a special case for when we have an empty list -- we just allow all keys
+    filter.allowAll = codes.empty();
+    for(auto code : codes) {
+        if(code >= 0 && code < static_cast<int>(filter.keys.size())) {
+            filter.keys.set(code);
+        }
+    }
+    return filter;
+}
+
+RepeatTable RepeatTable::of(const std::vector<gwidi::udpsocket::RepeatRule> &rules) {
+    // The catch-all rule first, so rules for specific keys override it whatever their order
+    RepeatTable table;
+    for(auto catchAll : {true, false}) {
+        for(auto &rule : rules) {
+            if((rule.code == -1) != catchAll || rule.code < -1 || rule.code >= static_cast<int>(table.keys.size())) {
+                continue;
+            }
+            Entry entry{rule.mode, static_cast<std::int64_t>(rule.intervalMs) * 1000};
+            if(catchAll) {
+                table.keys.fill(entry);
+            }
+            else {
+                table.keys[rule.code] = entry;
+            }
+        }
+    }
+    return table;
+}
+
+void LinuxInputReader::setWatchedKeys(const std::vector<int> &watchedKeys) {
+    m_watchedKeys.publish(KeyFilter::of(watchedKeys));
 }
 
-unsigned char *InputFocusDetector::getStringProperty(unsigned long window, Display* display, const char* propName) {
-    Atom actual_type, filter_atom;
-    int actual_format, status;
-    unsigned long nitems, bytes_after;
+bool LinuxInputReader::keyWatched(int code) {
+    return m_watchedKeys.current()->value.allows(code);
+}
 
-    unsigned char* prop;
+LinuxInputReader::LinuxInputReader() {
+    m_discoveredFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
 
-    filter_atom = XInternAtom(display, propName, True);
-    status = XGetWindowProperty(display, window, filter_atom, 0, MAXSTR, False, AnyPropertyType,
-                                &actual_type, &actual_format, &nitems, &bytes_after, &prop);
-    statusCheck(status, window);
-    return prop;
+LinuxInputReader::~LinuxInputReader() {
+    // The loop still reads members after a callback returns, so the reader can't be destroyed from one of them. If it
+    // were, the thread would be left joinable and std::thread terminates rather than run on freed memory.
+    assert(!m_th || m_th->get_id() != std::this_thread::get_id());
+    stopListening();
+    close(m_discoveredFd);
 }
 
-void InputFocusDetector::statusCheck(int status, unsigned long window) {
-    if (status == BadWindow) {
-        spdlog::error("window id # {} does not exist!", window);
+
+// Every window we track reports structure and property changes, which is what keeps the index current
+static constexpr uint32_t kTrackedEventMask = XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY | XCB_EVENT_MASK_PROPERTY_CHANGE;
+
+static std::string propertyString(xcb_get_property_reply_t* reply) {
+    if(reply == nullptr || reply->type == XCB_ATOM_NONE) {
+        return {};
     }
+    auto len = xcb_get_property_value_length(reply);
+    auto value = reinterpret_cast<const char*>(xcb_get_property_value(reply));
+    // Trim at the first NUL, WM_CLASS is "instance\0class\0" and is handled separately
+    return {value, strnlen(value, len)};
+}
 
-    if (status != Success) {
-        spdlog::error("XGetWindowProperty failed!");
+static std::string wmClassString(xcb_get_property_reply_t* reply) {
+    if(reply == nullptr || reply->type == XCB_ATOM_NONE) {
+        return {};
+    }
+    auto len = static_cast<std::size_t>(xcb_get_property_value_length(reply));
+    auto value = reinterpret_cast<const char*>(xcb_get_property_value(reply));
+    auto instanceLen = strnlen(value, len);
+    if(instanceLen + 1 < len) {
+        return {value + instanceLen + 1, strnlen(value + instanceLen + 1, len - instanceLen - 1)};
     }
+    return {value, instanceLen};
 }
 
-std::map<std::string, std::string> InputFocusDetector::windowStats() {
-    auto window = getWindowProperty(m_rootWindow, m_display, "_NET_ACTIVE_WINDOW");
+static uint32_t propertyCardinal(xcb_get_property_reply_t* reply) {
+    if(reply == nullptr || xcb_get_property_value_length(reply) < static_cast<int>(sizeof(uint32_t))) {
+        return 0;
+    }
+    uint32_t ret;
+    memcpy(&ret, xcb_get_property_value(reply), sizeof(uint32_t));
+    return ret;
+}
+
+std::string InputFocusDetector::currentFocusedWindowName() {
+    auto window = getWindowProperty(m_rootWindow, m_atoms.netActiveWindow);
+    return getStringProperty(window, m_atoms.netWmName);
+}
+
+uint32_t InputFocusDetector::getWindowProperty(xcb_window_t window, xcb_atom_t prop) {
+    if(m_connection == nullptr) {
+        return 0;
+    }
+    auto cookie = xcb_get_property(m_connection, 0, window, prop, XCB_GET_PROPERTY_TYPE_ANY, 0, 1);
+    auto reply = xcb_get_property_reply(m_connection, cookie, nullptr);
+    auto ret = propertyCardinal(reply);
+    free(reply);
+    return ret;
+}
 
-    auto windowClass = getStringProperty(window, m_display, "WM_CLASS");
-    auto windowName = getStringProperty(window, m_display, "_NET_WM_NAME");
-    auto pid = getWindowProperty(window, m_display, "_NET_WM_PID");
+std::string InputFocusDetector::getStringProperty(xcb_window_t window, xcb_atom_t prop) {
+    if(m_connection == nullptr) {
+        return {};
+    }
+    xcb_generic_error_t* error = nullptr;
+    auto cookie = xcb_get_property(m_connection, 0, window, prop, XCB_GET_PROPERTY_TYPE_ANY, 0, MAXSTR);
+    auto reply = xcb_get_property_reply(m_connection, cookie, &error);
+    if(error != nullptr) {
+        spdlog::error("xcb_get_property failed for window id # {}, error code: {}", window, error->error_code);
+        free(error);
+    }
+    auto ret = prop == m_atoms.wmClass ? wmClassString(reply) : propertyString(reply);
+    free(reply);
+    return ret;
+}
+
+std::map<std::string, std::string> InputFocusDetector::windowStats() {
+    auto window = getWindowProperty(m_rootWindow, m_atoms.netActiveWindow);
 
     std::map<std::string, std::string>  ret = {
-            {"_NET_WM_PID", fmt::format("{}", pid)},
-            {"WM_CLASS", std::string{reinterpret_cast<char*>(windowClass)}},
-            {"_NET_WM_NAME", std::string{reinterpret_cast<char*>(windowName)}},
+            {"_NET_WM_PID", fmt::format("{}", getWindowProperty(window, m_atoms.netWmPid))},
+            {"WM_CLASS", getStringProperty(window, m_atoms.wmClass)},
+            {"_NET_WM_NAME", getStringProperty(window, m_atoms.netWmName)},
     };
 
-    XFree(windowClass);
-    XFree(windowName);
-
     return ret;
 }
 
 // https://stackoverflow.com/questions/57896007/detect-window-focus-changes-with-xcb
 // https://stackoverflow.com/questions/27910906/xlib-test-window-names
 InputFocusDetector::InputFocusDetector() {
-    char* displayName = nullptr;
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    int screenNum = 0;
+    m_connection = xcb_connect(nullptr, &screenNum);
+    if (xcb_connection_has_error(m_connection)) {
+        auto displayName = getenv("DISPLAY");
+        spdlog::error("Unable to open display: {}", displayName ? displayName : "");
+        xcb_disconnect(m_connection);
+        m_connection = nullptr;
+        return;
+    }
 
-    m_display = XOpenDisplay(displayName);
-    if (m_display == nullptr) {
-        spdlog::error("Unable to open display: {}", XDisplayName(displayName));
+    auto screenIt = xcb_setup_roots_iterator(xcb_get_setup(m_connection));
+    for(auto i = 0; i < screenNum; i++) {
+        xcb_screen_next(&screenIt);
     }
-    int screen = XDefaultScreen(m_display);
-    m_rootWindow = RootWindow(m_display, screen);
+    m_rootWindow = screenIt.data->root;
 
+    internAtoms();
     getAllWindowsFromRoot(m_rootWindow);
 }
 
-// TODO: Register for focus events for a specific window instead of having to poll
-// https://tronche.com/gui/x/xlib/event-handling/selecting.html
-void InputFocusDetector::registerForWindowEvents() {
-    if(m_selectedWindowName.empty()) {
-        m_selectedWindowName = "gwidi_inputserver – LinuxInputReader.cc";
-    }
+void InputFocusDetector::internAtoms() {
+    // Send every intern request before waiting on any reply, this is a single round trip
+    const char* names[] = {"_NET_ACTIVE_WINDOW", "_NET_WM_NAME", "_NET_WM_PID"};
+    xcb_atom_t* targets[] = {&m_atoms.netActiveWindow, &m_atoms.netWmName, &m_atoms.netWmPid};
 
-    // First, ensure that we have a window
-    auto it = m_windowTree.find(m_selectedWindowName);
-    if(it != m_windowTree.end()) {
-        m_selectedWindow = it->second;
-        spdlog::info("Found window for name: {}", it->first);
+    xcb_intern_atom_cookie_t cookies[3];
+    for(auto i = 0; i < 3; i++) {
+        cookies[i] = xcb_intern_atom(m_connection, 0, strlen(names[i]), names[i]);
+    }
+    for(auto i = 0; i < 3; i++) {
+        auto reply = xcb_intern_atom_reply(m_connection, cookies[i], nullptr);
+        if(reply) {
+            *targets[i] = reply->atom;
+            free(reply);
+        }
+    }
+}
 
-        XSelectInput(m_display, it->second, FocusChangeMask);
-        XEvent nextEvent;
+void InputFocusDetector::getAllWindowsFromRoot(xcb_window_t root) {
+    // Walk the tree a level at a time so every request for a level is in flight at once, this costs one round trip
+    // per tree depth instead of several per window
+    std::vector<xcb_window_t> level{root};
+    while(!level.empty()) {
+        std::vector<xcb_query_tree_cookie_t> treeCookies;
+        treeCookies.reserve(level.size());
+        for(auto window : level) {
+            // Select before querying so a child created in between still reaches us as a CreateNotify
+            xcb_change_window_attributes(m_connection, window, XCB_CW_EVENT_MASK, &kTrackedEventMask);
+            treeCookies.emplace_back(xcb_query_tree(m_connection, window));
+        }
 
-        while(m_thAlive.load()) {
-            auto status = XNextEvent(m_display, &nextEvent);
-            if(nextEvent.type == FocusIn | nextEvent.type == FocusOut) {
-                auto event = nextEvent.xfocus;
-                auto isFocused = event.type == FocusIn;
-                spdlog::info("FocusChangeMask event notify received, has focus: {}", isFocused);
-                if(isFocused) {
-                    if(m_gainFocusCb) {
-                        m_gainFocusCb();
-                    }
-                }
-                else if(m_loseFocusCb) {
-                    m_loseFocusCb();
-                }
+        std::vector<xcb_window_t> children;
+        for(auto &cookie : treeCookies) {
+            auto reply = xcb_query_tree_reply(m_connection, cookie, nullptr);
+            if(reply == nullptr) {
+                continue;
             }
+            auto childList = xcb_query_tree_children(reply);
+            children.insert(children.end(), childList, childList + xcb_query_tree_children_length(reply));
+            free(reply);
+        }
+
+        trackWindows(children);
+        level = std::move(children);
+    }
+    xcb_flush(m_connection);
+
+    std::lock_guard<std::mutex> lock(m_windowTreeMutex);
+    spdlog::info("Indexed {} windows ({} named)", m_windows.size(), m_windowTree.size());
+}
+
+void InputFocusDetector::trackWindows(const std::vector<xcb_window_t> &windows) {
+    struct PendingWindow {
+        xcb_window_t window;
+        xcb_get_property_cookie_t name;
+        xcb_get_property_cookie_t wmClass;
+        xcb_get_property_cookie_t pid;
+    };
+
+    std::vector<PendingWindow> pending;
+    pending.reserve(windows.size());
+    for(auto window : windows) {
+        pending.push_back({
+            window,
+            xcb_get_property(m_connection, 0, window, m_atoms.netWmName, XCB_GET_PROPERTY_TYPE_ANY, 0, MAXSTR),
+            xcb_get_property(m_connection, 0, window, m_atoms.wmClass, XCB_GET_PROPERTY_TYPE_ANY, 0, MAXSTR),
+            xcb_get_property(m_connection, 0, window, m_atoms.netWmPid, XCB_GET_PROPERTY_TYPE_ANY, 0, 1),
+        });
+    }
+
+    for(auto &p : pending) {
+        auto nameReply = xcb_get_property_reply(m_connection, p.name, nullptr);
+        auto classReply = xcb_get_property_reply(m_connection, p.wmClass, nullptr);
+        auto pidReply = xcb_get_property_reply(m_connection, p.pid, nullptr);
+
+        WindowInfo info{p.window, propertyString(nameReply), wmClassString(classReply), propertyCardinal(pidReply)};
+        spdlog::debug("child window name: {}, class: {}, pid: {}", info.name, info.wmClass, info.pid);
+        indexWindow(info);
+
+        free(nameReply);
+        free(classReply);
+        free(pidReply);
+    }
+}
+
+// Drops `key` only if it is still filed under `window`, another window may have taken it over since
+template<typename Map>
+static void unfile(Map &map, const typename Map::key_type &key, xcb_window_t window) {
+    auto it = map.find(key);
+    if(it != map.end() && it->second == window) {
+        map.erase(it);
+    }
+}
+
+void InputFocusDetector::indexWindow(const WindowInfo &info) {
+    std::lock_guard<std::mutex> lock(m_windowTreeMutex);
+
+    // Re-indexing a window (a property changed) must drop the keys it was previously filed under
+    auto it = m_windows.find(info.window);
+    if(it != m_windows.end()) {
+        auto &old = it->second;
+        if(!old.name.empty()) {
+            unfile(m_windowTree, old.name, old.window);
+        }
+        if(!old.wmClass.empty()) {
+            unfile(m_windowsByClass, old.wmClass, old.window);
+        }
+        if(old.pid != 0) {
+            unfile(m_windowsByPid, old.pid, old.window);
+        }
+    }
+
+    m_windows[info.window] = info;
+    if(!info.name.empty()) {
+        m_windowTree[info.name] = info.window;
+    }
+    if(!info.wmClass.empty()) {
+        m_windowsByClass[info.wmClass] = info.window;
+    }
+    if(info.pid != 0) {
+        m_windowsByPid[info.pid] = info.window;
+    }
+}
+
+void InputFocusDetector::unindexWindow(xcb_window_t window) {
+    std::lock_guard<std::mutex> lock(m_windowTreeMutex);
+
+    auto it = m_windows.find(window);
+    if(it == m_windows.end()) {
+        return;
+    }
+    auto &info = it->second;
+    if(!info.name.empty()) {
+        unfile(m_windowTree, info.name, window);
+    }
+    if(!info.wmClass.empty()) {
+        unfile(m_windowsByClass, info.wmClass, window);
+    }
+    if(info.pid != 0) {
+        unfile(m_windowsByPid, info.pid, window);
+    }
+    m_windows.erase(it);
+}
+
+std::optional<WindowInfo> InputFocusDetector::lookup(const std::optional<xcb_window_t> &window) {
+    if(!window) {
+        return std::nullopt;
+    }
+    auto it = m_windows.find(*window);
+    if(it == m_windows.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+std::optional<WindowInfo> InputFocusDetector::findWindowByName(const std::string &windowName) {
+    std::lock_guard<std::mutex> lock(m_windowTreeMutex);
+    auto it = m_windowTree.find(windowName);
+    return lookup(it == m_windowTree.end() ? std::nullopt : std::optional{it->second});
+}
+
+std::optional<WindowInfo> InputFocusDetector::findWindowByClass(const std::string &wmClass) {
+    std::lock_guard<std::mutex> lock(m_windowTreeMutex);
+    auto it = m_windowsByClass.find(wmClass);
+    return lookup(it == m_windowsByClass.end() ? std::nullopt : std::optional{it->second});
+}
+
+std::optional<WindowInfo> InputFocusDetector::findWindowByPid(uint32_t pid) {
+    std::lock_guard<std::mutex> lock(m_windowTreeMutex);
+    auto it = m_windowsByPid.find(pid);
+    return lookup(it == m_windowsByPid.end() ? std::nullopt : std::optional{it->second});
+}
+
+std::optional<WindowInfo> InputFocusDetector::matchWindow(const WindowMatch &match) {
+    if(m_windowHint.pid != 0) {
+        auto hinted = findWindowByPid(m_windowHint.pid);
+        if(hinted && (match.wmClass.empty() ? hinted->name == match.name : hinted->wmClass == match.wmClass)) {
+            return hinted;
         }
     }
+    if(!match.wmClass.empty()) {
+        return findWindowByClass(match.wmClass);
+    }
+    return findWindowByName(match.name);
 }
 
-void InputFocusDetector::getAllWindowsFromRoot(Window root) {
-    Window root_ret;
-    Window parent_ret;
-    Window *children_ret;
-    unsigned int child_count;
+void InputFocusDetector::selectWindowIfPresent() {
+    auto matches = m_windowMatches.current();
+
+    // Retargeted since we last looked: let go of the old windows before looking for the new ones
+    auto retargeted = matches->version != m_appliedMatchVersion;
+    if(retargeted) {
+        m_appliedMatchVersion = matches->version;
+        for(auto window : m_selectedWindows) {
+            if(window != XCB_WINDOW_NONE) {
+                xcb_change_window_attributes(m_connection, window, XCB_CW_EVENT_MASK, &kTrackedEventMask);
+            }
+        }
+        m_selectedWindows.assign(matches->value.size(), XCB_WINDOW_NONE);
+        m_profileByWindow.clear();
+        notifyFocus(-1);
+    }
+
+    std::optional<xcb_window_t> activeWindow;
+    for(std::size_t profile = 0; profile < matches->value.size(); profile++) {
+        auto &match = matches->value[profile];
+        if(m_selectedWindows[profile] != XCB_WINDOW_NONE || match.empty()) {
+            continue;
+        }
 
-    auto status = XQueryTree(m_display, root, &root_ret, &parent_ret, &children_ret, &child_count);
-    for(auto i = 0; i < child_count; i++) {
-        auto child = children_ret[i];
-        auto childWinName = getStringProperty(child, m_display, "_NET_WM_NAME");
-        auto wmClass = getStringProperty(child, m_display, "WM_CLASS");
-        if(childWinName != nullptr) {
-            auto winStr = std::string{reinterpret_cast<char*>(childWinName)};
-            spdlog::info("child window name: {}", winStr);
-            m_windowTree[winStr] = child;
+        // A window matched by more than one profile belongs to the first of them
+        auto info = matchWindow(match);
+        if(!info || m_profileByWindow.count(info->window) > 0) {
+            continue;
+        }
+        m_selectedWindows[profile] = info->window;
+        m_profileByWindow[info->window] = static_cast<int>(profile);
+        spdlog::info("Found window for name: {}, class: {}, profile: {}", info->name, info->wmClass, profile);
+        if(m_windowMatchedCb) {
+            m_windowMatchedCb(static_cast<int>(profile), WindowHint{info->wmClass, info->pid});
         }
 
-        if(wmClass != nullptr) {
-            auto wmStr = std::string{reinterpret_cast<char*>(wmClass)};
-            spdlog::info("child window class: {}", wmStr);
+        uint32_t mask = kTrackedEventMask | XCB_EVENT_MASK_FOCUS_CHANGE;
+        xcb_change_window_attributes(m_connection, info->window, XCB_CW_EVENT_MASK, &mask);
+        xcb_flush(m_connection);
+
+        // We won't get a FocusIn for a window that already had focus when we selected it, however it got selected:
+        // retargeted, renamed to match while focused, or replacing a destroyed one
+        if(!activeWindow) {
+            activeWindow = getWindowProperty(m_rootWindow, m_atoms.netActiveWindow);
+        }
+        if(*activeWindow == info->window) {
+            notifyFocus(static_cast<int>(profile));
+        }
+    }
+}
+
+void InputFocusDetector::handleEvent(xcb_generic_event_t *event) {
+    switch(event->response_type & ~0x80) {
+        case XCB_CREATE_NOTIFY: {
+            auto create = reinterpret_cast<xcb_create_notify_event_t*>(event);
+            xcb_change_window_attributes(m_connection, create->window, XCB_CW_EVENT_MASK, &kTrackedEventMask);
+            trackWindows({create->window});
+            selectWindowIfPresent();
+            break;
         }
+        case XCB_DESTROY_NOTIFY: {
+            auto destroy = reinterpret_cast<xcb_destroy_notify_event_t*>(event);
+            unindexWindow(destroy->window);
+            auto it = m_profileByWindow.find(destroy->window);
+            if(it != m_profileByWindow.end()) {
+                spdlog::info("Selected window destroyed, profile: {}", it->second);
+                m_selectedWindows[it->second] = XCB_WINDOW_NONE;
+                m_profileByWindow.erase(it);
+                selectWindowIfPresent();
+            }
+            break;
+        }
+        case XCB_PROPERTY_NOTIFY: {
+            auto property = reinterpret_cast<xcb_property_notify_event_t*>(event);
+            if(property->atom == m_atoms.netWmName || property->atom == m_atoms.wmClass || property->atom == m_atoms.netWmPid) {
+                trackWindows({property->window});
+                selectWindowIfPresent();
+            }
+            break;
+        }
+        case XCB_FOCUS_IN:
+        case XCB_FOCUS_OUT: {
+            auto focus = reinterpret_cast<xcb_focus_in_event_t*>(event);
+            auto it = m_profileByWindow.find(focus->event);
+            if(it == m_profileByWindow.end()) {
+                break;
+            }
+            auto isFocused = (event->response_type & ~0x80) == XCB_FOCUS_IN;
+            spdlog::info("FocusChangeMask event notify received, profile: {}, has focus: {}", it->second, isFocused);
+            if(isFocused) {
+                notifyFocus(it->second);
+            }
+            else if(m_focusedProfile == it->second) {
+                notifyFocus(-1);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
 
-        XFree(childWinName);
-        XFree(wmClass);
+// https://tronche.com/gui/x/xlib/event-handling/selecting.html
+void InputFocusDetector::registerForWindowEvents() {
+    pollfd pfds[] = {
+            {xcb_get_file_descriptor(m_connection), POLLIN, 0},
+            {m_wakeFd, POLLIN, 0},
+    };
+    while(m_thAlive.load() && !xcb_connection_has_error(m_connection)) {
+        poll(pfds, 2, 500);
+        dispatch();
+    }
+}
+
+void InputFocusDetector::selectedWindowChanged() {
+    uint64_t one = 1;
+    write(m_wakeFd, &one, sizeof(one));
+}
 
-        getAllWindowsFromRoot(child);
+void InputFocusDetector::dispatch() {
+    uint64_t wakeups;
+    while(read(m_wakeFd, &wakeups, sizeof(wakeups)) == sizeof(wakeups)) {}
+    if(m_windowMatches.current()->version != m_appliedMatchVersion) {
+        selectWindowIfPresent();
     }
 
-    if(children_ret != nullptr) {
-        XFree(children_ret);
+    while(auto event = xcb_poll_for_event(m_connection)) {
+        handleEvent(event);
+        free(event);
     }
+    xcb_flush(m_connection);
 }
 
-void InputFocusDetector::beginListening() {
-    if(m_thAlive.load()) {
-        return;
+int InputFocusDetector::attach() {
+    if(m_thAlive.load() || m_connection == nullptr) {
+        return -1;
     }
 
     m_thAlive.store(true);
 
-    // First, send a gain focus if we are already focused when we start
-    auto curWindow = currentFocusedWindowName();
-    if(curWindow == m_selectedWindowName) {
-        if(m_gainFocusCb) {
-            m_gainFocusCb();
+    auto matches = m_windowMatches.current()->value;
+    if(std::all_of(matches.begin(), matches.end(), [](auto &match) { return match.empty(); })) {
+        if(matches.empty()) {
+            matches.emplace_back();
         }
+        matches.front() = {"gwidi_inputserver – LinuxInputReader.cc", {}};
+        m_windowMatches.publish(std::move(matches));
+    }
+
+    // The window does not have to exist yet, it is picked up from CreateNotify / PropertyNotify once it appears.
+    // If it exists and is already focused, this reports the initial gain.
+    selectWindowIfPresent();
+
+    return xcb_get_file_descriptor(m_connection);
+}
+
+void InputFocusDetector::beginListening() {
+    if(attach() < 0) {
+        return;
     }
 
     m_th = std::make_shared<std::thread>([this] {
         registerForWindowEvents();
     });
-    m_th->detach();
 }
 
 void InputFocusDetector::stopListening() {
     m_thAlive.store(false);
-}
+    selectedWindowChanged();
 
-InputFocusDetector::~InputFocusDetector() {
-    if(m_thAlive.load() && m_th->joinable()) {
-        m_thAlive.store(false);
+    // Focus callbacks run on the thread, same as the reader it must not outlive their targets
+    if(m_th && m_th->joinable() && m_th->get_id() != std::this_thread::get_id()) {
         m_th->join();
     }
-    else {
-        m_thAlive.store(false);
-    }
+}
+
+InputFocusDetector::~InputFocusDetector() {
+    // Like the reader: not from a focus callback, the loop would go on polling m_wakeFd after it is closed
+    assert(!m_th || m_th->get_id() != std::this_thread::get_id());
+    stopListening();
+    close(m_wakeFd);
 }
 
 }
\ No newline at end of file
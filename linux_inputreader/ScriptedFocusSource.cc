@@ -0,0 +1,210 @@
+#include "ScriptedFocusSource.h"
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace gwidi::input {
+
+ScriptedFocusSource::ScriptedFocusSource(const std::string &scriptPath, std::size_t repeat)
+    : ScriptedFocusSource(parseScript(scriptPath), repeat) {
+}
+
+ScriptedFocusSource::ScriptedFocusSource(std::vector<Transition> transitions, std::size_t repeat)
+    : m_transitions{std::move(transitions)}, m_repeat{repeat} {
+}
+
+std::vector<ScriptedFocusSource::Transition> ScriptedFocusSource::parseScript(const std::string &scriptPath) {
+    std::vector<Transition> ret;
+    std::ifstream in(scriptPath);
+    if(!in.is_open()) {
+        spdlog::error("Unable to open focus script: {}", scriptPath);
+        return ret;
+    }
+
+    std::string line;
+    auto lineNumber = 0;
+    while(std::getline(in, line)) {
+        lineNumber++;
+        std::istringstream ls(line);
+        long delayMs;
+        std::string action;
+        if(line.empty() || line[0] == '#' || !(ls >> delayMs >> action)) {
+            continue;
+        }
+
+        if(action == "gain" || action == "lose") {
+            ret.push_back({std::chrono::milliseconds{delayMs}, action == "gain", {}});
+        }
+        else if(action == "focus") {
+            std::string windowName;
+            std::getline(ls >> std::ws, windowName);
+            ret.push_back({std::chrono::milliseconds{delayMs}, true, windowName});
+        }
+        else {
+            spdlog::warn("Focus script {}:{} unknown action: {}", scriptPath, lineNumber, action);
+        }
+    }
+    return ret;
+}
+
+void ScriptedFocusSource::rewind() {
+    m_pass = 0;
+    m_index = 0;
+    m_focusedProfile = -1;
+    m_previousDone = Clock::now();
+    m_deadline = m_previousDone + (m_transitions.empty() ? Clock::duration::zero() : Clock::duration{m_transitions[0].delay});
+}
+
+bool ScriptedFocusSource::finished() const {
+    return m_transitions.empty() || m_pass >= m_repeat;
+}
+
+void ScriptedFocusSource::deliverNext() {
+    auto &transition = m_transitions[m_index];
+    auto deadline = m_deadline;
+
+    // Advance first so the next deadline is known even if the callback stops us
+    if(++m_index == m_transitions.size()) {
+        m_index = 0;
+        m_pass++;
+    }
+    m_deadline += m_transitions[m_index].delay;
+
+    // A 'focus' line only matters to us if it moves focus onto, off of or between the selected windows
+    auto profile = transition.hasFocus ? 0 : -1;
+    if(!transition.windowName.empty()) {
+        auto snapshot = m_windowMatches.current();
+        auto &matches = snapshot->value;
+        auto it = std::find_if(matches.begin(), matches.end(), [&transition](auto &match) {
+            return match.name == transition.windowName;
+        });
+        profile = it == matches.end() ? -1 : static_cast<int>(it - matches.begin());
+    }
+    if(profile == m_focusedProfile) {
+        return;
+    }
+    notifyFocus(profile);
+
+    // Back-to-back transitions are measured from when we were free to deliver them, not from a deadline
+    // that passed while the previous callback was still running
+    auto done = Clock::now();
+    auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(done - std::max(deadline, m_previousDone));
+    m_previousDone = done;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_stats.transitions == 0) {
+        m_firstDeadline = deadline;
+    }
+    m_stats.transitions++;
+    m_stats.totalLatency += latency;
+    m_stats.maxLatency = std::max(m_stats.maxLatency, latency);
+    m_stats.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(done - m_firstDeadline);
+}
+
+void ScriptedFocusSource::beginListening() {
+    if(m_thAlive.load()) {
+        return;
+    }
+
+    m_thAlive.store(true);
+    rewind();
+    m_th = std::make_shared<std::thread>([this] {
+        while(!finished()) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if(m_cv.wait_until(lock, m_deadline, [this] { return !m_thAlive.load(); })) {
+                    return;
+                }
+            }
+            deliverNext();
+        }
+        m_thAlive.store(false);
+        m_cv.notify_all();
+    });
+}
+
+int ScriptedFocusSource::attach() {
+    if(m_thAlive.load()) {
+        return -1;
+    }
+
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(m_timerFd < 0) {
+        spdlog::error("Unable to create focus script timer");
+        return -1;
+    }
+
+    m_thAlive.store(true);
+    rewind();
+    armTimer();
+    return m_timerFd;
+}
+
+void ScriptedFocusSource::armTimer() {
+    // steady_clock is CLOCK_MONOTONIC on Linux, so deadlines can be handed to the timerfd as-is
+    itimerspec spec{};
+    if(!finished()) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(m_deadline.time_since_epoch()).count();
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+        if(spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+            spec.it_value.tv_nsec = 1;  // an all-zero value would disarm the timer
+        }
+    }
+    timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void ScriptedFocusSource::dispatch() {
+    uint64_t expirations;
+    while(read(m_timerFd, &expirations, sizeof(expirations)) == sizeof(expirations)) {}
+
+    while(m_thAlive.load() && !finished() && m_deadline <= Clock::now()) {
+        deliverNext();
+    }
+
+    if(finished()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_thAlive.store(false);
+        }
+        m_cv.notify_all();
+    }
+    armTimer();
+}
+
+void ScriptedFocusSource::stopListening() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_thAlive.store(false);
+    }
+    m_cv.notify_all();
+}
+
+void ScriptedFocusSource::waitFinished() {
+    if(m_th && m_th->joinable()) {
+        m_th->join();
+        return;
+    }
+
+    // Attached to a reactor, the replay happens on someone else's thread
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this] { return !m_thAlive.load(); });
+}
+
+ScriptedFocusSource::Stats ScriptedFocusSource::stats() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+ScriptedFocusSource::~ScriptedFocusSource() {
+    stopListening();
+    waitFinished();
+    if(m_timerFd >= 0) {
+        close(m_timerFd);
+    }
+}
+
+}
@@ -0,0 +1,65 @@
+#ifndef GWIDI_INPUTSERVER_AXISSHAPER_H
+#define GWIDI_INPUTSERVER_AXISSHAPER_H
+
+#include <array>
+#include <chrono>
+#include <optional>
+#include <vector>
+#include <linux/input.h>
+
+#include "GwidiProtocol.h"
+#include "GwidiSnapshot.h"
+
+namespace gwidi::input {
+
+// Deadband, quantization and per-axis rate limiting for EV_ABS / EV_REL (see AxisRule). Runs on whichever thread reads
+// the devices, only the settings may be changed from elsewhere. Axes are keyed by code alone, two devices reporting
+// the same axis share its state.
+class AxisShaper {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Events = std::vector<gwidi::udpsocket::AxisEvent>;
+
+    void setSettings(const gwidi::udpsocket::AxisSettings& settings);
+
+    inline bool enabled() const {
+        return m_rules.current()->value.enabled;
+    }
+
+    // Appends the shaped value to `out` if it has to go out now, otherwise drops it or holds it back
+    void offer(int evType, int code, int value, Clock::time_point now, Events& out);
+
+    // Appends held back values whose interval is up
+    void flushDue(Clock::time_point now, Events& out);
+
+    inline std::optional<Clock::time_point> nextDeadline() const {
+        return m_nextDeadline;
+    }
+
+private:
+    struct Rules {
+        bool enabled{false};
+        std::array<gwidi::udpsocket::AxisRule, ABS_CNT> abs{};
+        std::array<gwidi::udpsocket::AxisRule, REL_CNT> rel{};
+    };
+
+    struct State {
+        bool sent{false};
+        int lastSent{0};
+        Clock::time_point lastSentAt{};
+        bool pending{false};
+        int pendingValue{0};    // latest absolute value, or the motion summed up for a relative axis
+    };
+
+    void send(int evType, int code, int value, State& state, Clock::time_point now, Events& out);
+    void hold(State& state, int value, Clock::time_point deadline);
+
+    gwidi::SnapshotStore<Rules> m_rules;
+    std::array<State, ABS_CNT> m_abs{};
+    std::array<State, REL_CNT> m_rel{};
+    std::optional<Clock::time_point> m_nextDeadline;
+};
+
+}
+
+#endif //GWIDI_INPUTSERVER_AXISSHAPER_H
@@ -0,0 +1,47 @@
+#ifndef GWIDI_INPUTSERVER_DISCOVERYCACHE_H
+#define GWIDI_INPUTSERVER_DISCOVERYCACHE_H
+
+#include <bitset>
+#include <optional>
+#include <string>
+#include <vector>
+#include <linux/input.h>
+
+#include "FocusSource.h"
+
+namespace gwidi::input {
+
+// What an evdev node was when we opened it. Nodes are renumbered across reboots and replugs, so a cached path only
+// counts as the same device while id, phys and name still match.
+struct DeviceInfo {
+    std::string path;
+    input_id id{};
+    std::string phys;
+    std::string name;
+    std::bitset<0x100> keys;    // EV_KEY capabilities, only the codes the reader forwards
+
+    inline bool sameDevice(const DeviceInfo& other) const {
+        return id.bustype == other.id.bustype && id.vendor == other.id.vendor && id.product == other.id.product &&
+               id.version == other.id.version && phys == other.phys && name == other.name;
+    }
+
+    inline bool isKeyboard() const {
+        return keys.test(KEY_A) && keys.test(KEY_Z) && keys.test(KEY_SPACE);
+    }
+};
+
+// Discovery results kept across restarts, so a warm start can open the devices it used last time without probing
+// every node in /dev/input. Stored as a small text file, one line per entry.
+struct DiscoveryCache {
+    std::vector<DeviceInfo> devices;
+    std::optional<WindowHint> window;   // the window last matched for the default profile
+
+    // Empty if there is no cache at `path` or it can't be read, which means a cold start
+    static std::optional<DiscoveryCache> load(const std::string& path);
+    // Written next to `path` and renamed over it, a crash never leaves half a cache behind
+    bool save(const std::string& path) const;
+};
+
+}
+
+#endif //GWIDI_INPUTSERVER_DISCOVERYCACHE_H
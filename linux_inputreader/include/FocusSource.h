@@ -0,0 +1,133 @@
+#ifndef GWIDI_INPUTSERVER_FOCUSSOURCE_H
+#define GWIDI_INPUTSERVER_FOCUSSOURCE_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "GwidiSnapshot.h"
+
+namespace gwidi::input {
+
+// Which window we are watching. A non-empty WM_CLASS takes precedence over the window name.
+struct WindowMatch {
+    std::string name;
+    std::string wmClass;
+
+    inline bool empty() const {
+        return name.empty() && wmClass.empty();
+    }
+};
+
+// A window matched on an earlier run. Preferred over other windows that match the same way, so the same instance is
+// picked again when several share a name or class.
+struct WindowHint {
+    std::string wmClass;
+    std::uint32_t pid{0};
+};
+
+// Anything that can tell us when one of the selected windows gains or loses focus. The X11 detector is the production
+// implementation, the scripted source replays timed transitions so the focus path can run without a display.
+class FocusSource {
+public:
+    virtual ~FocusSource() = default;
+
+    virtual void beginListening() = 0;
+    virtual void stopListening() = 0;
+
+    // Reactor integration: start without a thread of our own and return an fd to wait on (or -1 if the source could
+    // not start), then call dispatch() whenever that fd is readable
+    virtual int attach() = 0;
+    virtual void dispatch() = 0;
+
+    inline bool isAlive() {
+        return m_thAlive.load();
+    }
+
+    inline void setGainFocusCb(std::function<void()> cb) {
+        m_gainFocusCb = std::move(cb);
+    }
+
+    inline void setLoseFocusCb(std::function<void()> cb) {
+        m_loseFocusCb = std::move(cb);
+    }
+
+    // Called with the index of the selected window that has focus, or -1 once none of them has. Moving focus straight
+    // from one selected window to another reports the new index without a lose/gain in between.
+    inline void setFocusedProfileCb(std::function<void(int)> cb) {
+        m_focusedProfileCb = std::move(cb);
+    }
+
+    // Called from the source's thread with the profile index whenever one of the selected windows is found
+    inline void setWindowMatchedCb(std::function<void(int, const WindowHint&)> cb) {
+        m_windowMatchedCb = std::move(cb);
+    }
+
+    // Must be set before listening, sources that can't tell windows apart ignore it
+    inline void setWindowHint(WindowHint hint) {
+        m_windowHint = std::move(hint);
+    }
+
+    inline void setSelectedWindowName(const std::string& windowName) {
+        setSelectedWindow({windowName, {}});
+    }
+
+    inline WindowMatch selectedWindow() const {
+        auto matches = m_windowMatches.current();
+        return matches->value.empty() ? WindowMatch{} : matches->value.front();
+    }
+
+    inline std::vector<WindowMatch> selectedWindows() const {
+        return m_windowMatches.current()->value;
+    }
+
+    inline void setSelectedWindow(WindowMatch match) {
+        setSelectedWindows({std::move(match)});
+    }
+
+    // One match per profile, the focused profile is reported by its index in here. Safe to call from any thread while
+    // listening, the source retargets from its own thread.
+    inline void setSelectedWindows(std::vector<WindowMatch> matches) {
+        m_windowMatches.publish(std::move(matches));
+        selectedWindowChanged();
+    }
+
+protected:
+    virtual void selectedWindowChanged() {}
+
+    // Only called from whichever thread drives the source
+    inline void notifyFocus(int profile) {
+        if(profile == m_focusedProfile) {
+            return;
+        }
+        auto previous = m_focusedProfile;
+        m_focusedProfile = profile;
+        if(m_focusedProfileCb) {
+            m_focusedProfileCb(profile);
+        }
+
+        if(previous < 0) {
+            if(m_gainFocusCb) {
+                m_gainFocusCb();
+            }
+        }
+        else if(profile < 0 && m_loseFocusCb) {
+            m_loseFocusCb();
+        }
+    }
+
+    std::atomic_bool m_thAlive{false};
+
+    gwidi::SnapshotStore<std::vector<WindowMatch>> m_windowMatches;
+    int m_focusedProfile{-1};
+    std::function<void()> m_gainFocusCb;
+    std::function<void()> m_loseFocusCb;
+    std::function<void(int)> m_focusedProfileCb;
+    std::function<void(int, const WindowHint&)> m_windowMatchedCb;
+    WindowHint m_windowHint;
+};
+
+}
+
+#endif //GWIDI_INPUTSERVER_FOCUSSOURCE_H
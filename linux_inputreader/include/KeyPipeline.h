@@ -0,0 +1,83 @@
+#ifndef GWIDI_INPUTSERVER_KEYPIPELINE_H
+#define GWIDI_INPUTSERVER_KEYPIPELINE_H
+
+#include <functional>
+#include <tuple>
+#include <utility>
+
+#include "LinuxInputReader.h"
+#include "GwidiProbes.h"
+
+namespace gwidi::input {
+
+enum class StageResult {
+    PASS,       // on to the next stage
+    CLAIM,      // taken, later stages don't see it
+    DROP        // not for us, later stages don't see it and a grabbed keyboard passes it through
+};
+
+// Key sink for LinuxInputReader::handleReadable() built from stages run in order, each one a callable
+// `StageResult stage(int code, int value)`. The stage types are known at compile time, so the whole chain inlines into
+// the reader's loop. A key that makes it past the last stage counts as claimed.
+template<typename... Stages>
+class KeyPipeline {
+public:
+    explicit KeyPipeline(Stages... stages) : m_stages{std::move(stages)...} {
+    }
+
+    inline bool operator()(int code, int value) {
+        return run<0>(code, value);
+    }
+
+    template<std::size_t I>
+    inline auto& stage() {
+        return std::get<I>(m_stages);
+    }
+
+private:
+    template<std::size_t I>
+    inline bool run(int code, int value) {
+        if constexpr(I == sizeof...(Stages)) {
+            return true;
+        }
+        else {
+            switch(std::get<I>(m_stages)(code, value)) {
+                case StageResult::CLAIM: return true;
+                case StageResult::DROP: return false;
+                default: return run<I + 1>(code, value);
+            }
+        }
+    }
+
+    std::tuple<Stages...> m_stages;
+};
+
+// Keys outside the filter are dropped
+struct KeyFilterStage {
+    const gwidi::SnapshotStore<KeyFilter>* filter;
+
+    inline StageResult operator()(int code, int value) const {
+        if(!filter->current()->value.allows(code)) {
+            GWIDI_PROBE3(key_filter, code, value, gwidi::PROBE_FILTERED);
+            return StageResult::DROP;
+        }
+        GWIDI_PROBE3(key_filter, code, value, gwidi::PROBE_FORWARDED);
+        return StageResult::PASS;
+    }
+};
+
+// Type-erased adapter for a plain key callback, passes every key on
+struct CallbackStage {
+    std::function<void(int, int)> cb;
+
+    inline StageResult operator()(int code, int value) const {
+        if(cb) {
+            cb(code, value);
+        }
+        return StageResult::PASS;
+    }
+};
+
+}
+
+#endif //GWIDI_INPUTSERVER_KEYPIPELINE_H
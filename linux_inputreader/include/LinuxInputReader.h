@@ -2,99 +2,373 @@
 #define GWIDI_INPUTSERVER_LINUXINPUTREADER_H
 
 #include "GwidiSocketServer.h"
+#include "LinuxSendInput.h"
+#include "FocusSource.h"
+#include "GwidiSnapshot.h"
+#include "AxisShaper.h"
+#include "DiscoveryCache.h"
+#include "GwidiLogging.h"
+#include "GwidiProbes.h"
 #include <utility>
 #include <vector>
 #include <sys/poll.h>
+#include <linux/input.h>
 #include <memory>
 #include <atomic>
 #include <thread>
 #include <netinet/in.h>
-#include <X11/Xlib.h>
+#include <xcb/xcb.h>
 #include <map>
+#include <unordered_map>
+#include <mutex>
+#include <optional>
+#include <condition_variable>
+#include <bitset>
+#include <array>
 #include <functional>
+#include <unistd.h>
 
 namespace gwidi::input {
 
+struct KeyFilter {
+    std::bitset<0x100> keys;
+    bool allowAll{true};    // an empty watched key list forwards every key
+
+    static KeyFilter of(const std::vector<int>& codes);
+
+    inline bool allows(int code) const {
+        return allowAll || keys.test(code);
+    }
+};
+
+// Sink values besides the kernel's 0 (release) and 1 (press), see RepeatMode
+static constexpr int KEY_VALUE_REPEAT = 2;
+static constexpr int KEY_VALUE_HELD = 3;
+
+struct RepeatTable {
+    struct Entry {
+        gwidi::udpsocket::RepeatMode mode{gwidi::udpsocket::REPEAT_OFF};
+        std::int64_t intervalUs{0};
+    };
+    std::array<Entry, 0x100> keys;
+
+    static RepeatTable of(const std::vector<gwidi::udpsocket::RepeatRule>& rules);
+};
+
 class LinuxInputReader {
 public:
+    LinuxInputReader();
+
     void beginListening();
+
+    // Calls `sink` instead of the watched key callback, see handleReadable(int, KeySink&)
+    template<typename KeySink>
+    void beginListening(KeySink& sink) {
+        startThread([this, &sink](int fd) {
+            handleReadable(fd, sink);
+        });
+    }
     void stopListening();
 
     inline bool isAlive() {
         return m_thAlive.load();
     }
 
-    inline void setWatchedKeys(std::vector<int> watchedKeys) {
-        m_watchedKeys = std::move(watchedKeys);
+    // Publishes a new filter snapshot, the reader thread picks it up on its next event without locking
+    void setWatchedKeys(const std::vector<int>& watchedKeys);
+
+    // Autorepeats of watched keys are dropped unless a rule says otherwise
+    inline void setRepeats(const std::vector<gwidi::udpsocket::RepeatRule>& rules) {
+        m_repeats.publish(RepeatTable::of(rules));
+    }
+
+    // Reader thread only: how long `code` had been held at its last forwarded repeat, for sinks handed a
+    // KEY_VALUE_HELD
+    inline std::uint32_t heldMs(int code) const {
+        return static_cast<std::uint32_t>((m_lastRepeatUs[code] - m_pressedAtUs[code]) / 1000);
     }
 
-    inline void setWatchedKeyCb(std::function<void(int, int)> cb) {
+    // Returns true if the key was claimed (forwarded or consumed), grabbed keyboards then keep it from everyone else
+    inline void setWatchedKeyCb(std::function<bool(int, int)> cb) {
         m_watchedKeyCb = cb;
     }
 
+    // Must be set before the devices are opened. Keyboards are then grabbed (EVIOCGRAB) and every event the server
+    // doesn't claim is re-emitted, one write() per frame, through a uinput clone of the keyboard. Grabbed keyboards
+    // are read while paused too, everything passes through then.
+    inline void setExclusiveGrab(bool grab) {
+        m_exclusiveGrab = grab;
+    }
+
+    inline bool isGrabbed(int fd) const {
+        return m_passthrough.count(fd) != 0;
+    }
+
+    // Axis events are only read while enabled, shaped per AxisSettings and handed over one batch per SYN_REPORT
+    inline void setAxes(const gwidi::udpsocket::AxisSettings& settings) {
+        m_axes.setSettings(settings);
+    }
+
+    inline void setAxisCb(std::function<void(const std::vector<gwidi::udpsocket::AxisEvent>&)> cb) {
+        m_axisCb = cb;
+    }
+
+    // Sends axis values held back by rate limiting once their interval is up. Reader thread only; in reactor mode the
+    // caller arms a timer for nextAxisDeadline() after every handleReadable() and flushes when it fires.
+    void flushAxes();
+
+    inline std::optional<AxisShaper::Clock::time_point> nextAxisDeadline() const {
+        return m_axes.nextDeadline();
+    }
+
+    // While paused the reader thread sleeps instead of polling, events queued in the meantime are discarded on resume
+    void setPaused(bool paused);
+
+    inline bool isPaused() {
+        return m_paused.load();
+    }
+
+    // Keys currently held on any device. Kept up to date from the event stream and reseeded from the kernel
+    // (EVIOCGKEY) whenever devices are opened or reading resumes, so it is safe to call from any thread.
+    std::bitset<0x100> pressedKeys();
+    std::bitset<0x100> pressedWatchedKeys();
+
+    // Reactor integration: open the devices without starting a thread and call handleReadable() for each readable fd
+    const std::vector<pollfd>& openInputDevices();
+    // Warm start: opens only the known devices that are still there as they were, without probing any other node.
+    // Follow up with confirmInputDevices() to pick up whatever was plugged in since.
+    const std::vector<pollfd>& openInputDevices(const std::vector<DeviceInfo>& known);
+    // Full scan, safe to run from any thread while reading. Nodes not open yet are probed and handed over through
+    // discoveredFd(). Returns every device in use afterwards, for the next warm start.
+    std::vector<DeviceInfo> confirmInputDevices();
+    // Readable once confirmInputDevices() found new devices. The reader thread adds them on its own, in reactor mode
+    // call adoptDiscoveredDevices() and register the fds it returns.
+    inline int discoveredFd() const {
+        return m_discoveredFd;
+    }
+    std::vector<int> adoptDiscoveredDevices();
+    inline const std::vector<pollfd>& inputDevices() {
+        return m_inputDevices;
+    }
+    void closeInputDevices();
+    inline void handleReadable(int fd) {
+        auto callback = [this](int code, int value) {
+            return m_watchedKeyCb && m_watchedKeyCb(code, value);
+        };
+        handleReadable(fd, callback);
+    }
+
+    // `sink` is called for every watched key press and release as `bool sink(int code, int value)`, returning whether
+    // the key was claimed. Repeats come as KEY_VALUE_REPEAT or KEY_VALUE_HELD if the key's RepeatMode forwards them.
+    // A concrete sink type (a KeyPipeline) inlines into the read loop, the callback overload above is the type-erased one.
+    template<typename KeySink>
+    void handleReadable(int fd, KeySink& sink);
+    void drainInputDevices();
+
     ~LinuxInputReader();
 
 private:
     void findInputDevices();
+    void addInputDevice(int fd, DeviceInfo info);
     bool keyWatched(int code);
+    void setKeyPressed(int code, bool pressed);
+    void resyncKeyState();
+    void startThread(std::function<void(int)> onReadable);
+
+    static inline std::int64_t eventTimeUs(const input_event& ev) {
+        return ev.time.tv_sec * 1000000L + ev.time.tv_usec;
+    }
+    // Sink value for an autorepeat of a watched key, 0 if it isn't forwarded
+    inline int repeatValue(const input_event& ev) {
+        auto entry = m_repeats.current()->value.keys[ev.code];
+        if(entry.mode == gwidi::udpsocket::REPEAT_OFF) {
+            return 0;
+        }
+        auto now = eventTimeUs(ev);
+        if(entry.mode != gwidi::udpsocket::REPEAT_ALL && now - m_lastRepeatUs[ev.code] < entry.intervalUs) {
+            metrics::count(metrics::Counter::REPEATS_COALESCED);
+            return 0;
+        }
+        m_lastRepeatUs[ev.code] = now;
+        return entry.mode == gwidi::udpsocket::REPEAT_HELD ? KEY_VALUE_HELD : KEY_VALUE_REPEAT;
+    }
+
+    struct Passthrough {
+        std::unique_ptr<SendInput> clone;
+        std::vector<input_event> frame;     // events of the current frame not claimed, written out on SYN_REPORT
+        bool dropping{false};               // after SYN_DROPPED, until the next SYN_REPORT
+        std::bitset<0x100> claimed;         // presses kept from the clone, so their repeats and release are too
+    };
+    void grabKeyboard(int fd);
+    // For key events: records or looks up whether the press was claimed, true if the event must not pass through
+    bool claimKey(Passthrough& passthrough, const input_event& ev, bool claimed);
+    void passthroughEvent(Passthrough& passthrough, const input_event& ev);
+    // Everything but key presses and releases read while not paused
+    void handleOtherEvent(Passthrough* passthrough, const input_event& ev, bool paused);
 
     std::vector<pollfd> m_inputDevices;
+    std::mutex m_inputDevicesMutex;     // only the reader thread changes the list, it locks against resyncKeyState() and scans
+    bool m_inputDevicesOpened{false};
+    std::unordered_map<int, DeviceInfo> m_deviceInfo;           // by fd, changed with m_inputDevices
+    std::vector<std::pair<int, DeviceInfo>> m_discovered;       // opened by confirmInputDevices(), not read yet
+    int m_discoveredFd{-1};
+    std::vector<pollfd> m_pollFds;      // reader thread only: m_discoveredFd, then m_inputDevices
     static int m_timeoutMs;
+    static constexpr std::size_t EVENTS_PER_READ = 64;
+
+    std::atomic<std::uint64_t> m_pressedKeys[0x100 / 64]{};
 
     std::atomic_bool m_thAlive{false};
     std::shared_ptr<std::thread> m_th;
 
-    std::vector<int> m_watchedKeys;
-    std::function<void(int, int)> m_watchedKeyCb;
+    std::atomic_bool m_paused{false};
+    std::mutex m_pauseMutex;
+    std::condition_variable m_pauseCv;
+
+    gwidi::SnapshotStore<KeyFilter> m_watchedKeys;
+    std::function<bool(int, int)> m_watchedKeyCb;
+
+    gwidi::SnapshotStore<RepeatTable> m_repeats;
+    // Reader thread only, kernel timestamps of each key's press and of its last forwarded repeat
+    std::array<std::int64_t, 0x100> m_pressedAtUs{};
+    std::array<std::int64_t, 0x100> m_lastRepeatUs{};
+
+    bool m_exclusiveGrab{false};
+    std::unordered_map<int, Passthrough> m_passthrough;     // by source fd, changed with m_inputDevices
+
+    AxisShaper m_axes;
+    AxisShaper::Events m_axisFrame;     // reader thread only, reused for every frame
+    std::function<void(const std::vector<gwidi::udpsocket::AxisEvent>&)> m_axisCb;
 };
 
-class InputFocusDetector {
+template<typename KeySink>
+void LinuxInputReader::handleReadable(int fd, KeySink &sink) {
+    // One pin for the whole batch, the snapshot reads of every stage below are plain loads under it
+    gwidi::SnapshotPin pin;
+    auto passthroughIt = m_passthrough.find(fd);
+    auto passthrough = passthroughIt == m_passthrough.end() ? nullptr : &passthroughIt->second;
+    auto paused = m_paused.load();
+
+    // evdev only ever hands out whole events, read as many as are queued in one go
+    input_event events[EVENTS_PER_READ];
+    ssize_t bytes;
+    while((bytes = read(fd, events, sizeof(events))) > 0) {
+        auto count = static_cast<std::size_t>(bytes) / sizeof(input_event);
+        metrics::count(metrics::Counter::EVDEV_EVENTS_READ, count);
+        for(std::size_t i = 0; i < count; i++) {
+            auto &ev = events[i];
+            GWIDI_PROBE5(evdev_read, fd, ev.type, ev.code, ev.value, eventTimeUs(ev));
+            // value: or 0 for EV_KEY for release, 1 for keypress and 2 for autorepeat
+            if(paused || ev.type != EV_KEY || ev.code >= 0x100 || ev.value < 0 || ev.value > 2) {
+                handleOtherEvent(passthrough, ev, paused);
+                continue;
+            }
+
+            auto value = ev.value;
+            auto watched = keyWatched(ev.code);
+            if(value == 2) {
+                value = watched ? repeatValue(ev) : 0;
+                if(value == 0) {
+                    handleOtherEvent(passthrough, ev, paused);
+                    continue;
+                }
+            }
+            else {
+                setKeyPressed(ev.code, value == 1);
+                if(value == 1) {
+                    m_pressedAtUs[ev.code] = m_lastRepeatUs[ev.code] = eventTimeUs(ev);
+                }
+            }
+
+            auto claimed = false;
+            if(watched) {
+                SPDLOG_DEBUG("sending key: {}, {}", ev.code, value);
+                GWIDI_TRACE_EVENT(logging::TraceKind::KEY_FORWARDED, ev.code, value);
+                GWIDI_PROBE2(key_watched, ev.code, value);
+                metrics::count(metrics::Counter::KEYS_FORWARDED);
+                claimed = sink(ev.code, value);
+            }
+            else {
+                metrics::count(metrics::Counter::EVDEV_EVENTS_FILTERED);
+            }
+            if(passthrough && !claimKey(*passthrough, ev, claimed)) {
+                passthroughEvent(*passthrough, ev);
+            }
+        }
+        // A short read drained the device, don't spend a syscall on finding that out
+        if(count < EVENTS_PER_READ) {
+            break;
+        }
+    }
+}
+
+struct WindowInfo {
+    xcb_window_t window{XCB_WINDOW_NONE};
+    std::string name;
+    std::string wmClass;
+    uint32_t pid{0};
+};
+
+class InputFocusDetector : public FocusSource {
 public:
     InputFocusDetector();
-    ~InputFocusDetector();
+    ~InputFocusDetector() override;
 
     std::map<std::string, std::string> windowStats();
     std::string currentFocusedWindowName();
 
-    void beginListening();
-    void stopListening();
+    // O(1) lookups into the window index, which is kept current from X events after the initial scan
+    std::optional<WindowInfo> findWindowByName(const std::string& windowName);
+    std::optional<WindowInfo> findWindowByClass(const std::string& wmClass);
+    std::optional<WindowInfo> findWindowByPid(uint32_t pid);
 
-    inline bool isAlive() {
-        return m_thAlive.load();
-    }
+    void beginListening() override;
+    void stopListening() override;
 
-    inline void setGainFocusCb(std::function<void()> cb) {
-        m_gainFocusCb = std::move(cb);
-    }
+    int attach() override;
+    void dispatch() override;
 
-    inline void setLoseFocusCb(std::function<void()> cb) {
-        m_loseFocusCb = std::move(cb);
-    }
+private:
+    struct Atoms {
+        xcb_atom_t netActiveWindow{XCB_ATOM_NONE};
+        xcb_atom_t netWmName{XCB_ATOM_NONE};
+        xcb_atom_t netWmPid{XCB_ATOM_NONE};
+        xcb_atom_t wmClass{XCB_ATOM_WM_CLASS};
+    };
 
-    inline void setSelectedWindowName(const std::string& windowName) {
-        m_selectedWindowName = windowName;
-    }
+    xcb_connection_t *m_connection{nullptr};
+    xcb_window_t m_rootWindow{XCB_WINDOW_NONE};
+    Atoms m_atoms;
 
-private:
-    Display *m_display{nullptr};
-    Window m_rootWindow;
+    std::mutex m_windowTreeMutex;
+    std::unordered_map<xcb_window_t, WindowInfo> m_windows;
+    std::unordered_map<std::string, xcb_window_t> m_windowTree;
+    std::unordered_map<std::string, xcb_window_t> m_windowsByClass;
+    std::unordered_map<uint32_t, xcb_window_t> m_windowsByPid;
 
-    std::map<std::string, Window> m_windowTree;
-    void getAllWindowsFromRoot(Window root);
+    void internAtoms();
+    void getAllWindowsFromRoot(xcb_window_t root);
+    void trackWindows(const std::vector<xcb_window_t>& windows);
+    void indexWindow(const WindowInfo& info);
+    void unindexWindow(xcb_window_t window);
+    std::optional<WindowInfo> lookup(const std::optional<xcb_window_t>& window);
 
-    void statusCheck(int status, unsigned long window);
-    unsigned char* getStringProperty(unsigned long window, Display* display, const char* propName);
-    unsigned long getWindowProperty(unsigned long window, Display* display, const char* propName);
+    std::string getStringProperty(xcb_window_t window, xcb_atom_t prop);
+    uint32_t getWindowProperty(xcb_window_t window, xcb_atom_t prop);
 
+    void handleEvent(xcb_generic_event_t* event);
+    std::optional<WindowInfo> matchWindow(const WindowMatch& match);
+    void selectWindowIfPresent();
+    void selectedWindowChanged() override;
     void registerForWindowEvents();
 
-    std::atomic_bool m_thAlive{false};
     std::shared_ptr<std::thread> m_th;
 
-    std::string m_selectedWindowName;
-    Window m_selectedWindow;
-    std::function<void()> m_gainFocusCb;
-    std::function<void()> m_loseFocusCb;
+    // Indexed like selectedWindows(), and the other way around so focus events map to their profile in O(1)
+    std::vector<xcb_window_t> m_selectedWindows;
+    std::unordered_map<xcb_window_t, int> m_profileByWindow;
+    std::uint64_t m_appliedMatchVersion{0};
+    int m_wakeFd{-1};
 };
 
 }
@@ -0,0 +1,81 @@
+#ifndef GWIDI_INPUTSERVER_SCRIPTEDFOCUSSOURCE_H
+#define GWIDI_INPUTSERVER_SCRIPTEDFOCUSSOURCE_H
+
+#include "FocusSource.h"
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gwidi::input {
+
+// Replays focus transitions from a script instead of watching X. Each non-empty, non-comment ('#') line is:
+//   <delay_ms> gain                 -- the first selected window gains focus
+//   <delay_ms> lose                 -- the focused selected window loses focus
+//   <delay_ms> focus <window name>  -- <window name> becomes the focused window, whichever profile matches it by name
+// Delays are relative to the previous line. The whole script is replayed `repeat` times.
+class ScriptedFocusSource : public FocusSource {
+public:
+    struct Transition {
+        std::chrono::milliseconds delay;
+        bool hasFocus;
+        std::string windowName; // empty for gain/lose lines
+    };
+
+    struct Stats {
+        std::size_t transitions{0};
+        std::chrono::nanoseconds totalLatency{0};   // deadline -> callback returned
+        std::chrono::nanoseconds maxLatency{0};
+        std::chrono::nanoseconds elapsed{0};        // first deadline -> last callback returned
+    };
+
+    explicit ScriptedFocusSource(const std::string& scriptPath, std::size_t repeat = 1);
+    explicit ScriptedFocusSource(std::vector<Transition> transitions, std::size_t repeat = 1);
+    ~ScriptedFocusSource() override;
+
+    void beginListening() override;
+    void stopListening() override;
+
+    // Attached sources are driven by a timerfd armed for the next transition's deadline
+    int attach() override;
+    void dispatch() override;
+
+    // Blocks until the script has been fully replayed (or the source was stopped)
+    void waitFinished();
+
+    Stats stats();
+
+    static std::vector<Transition> parseScript(const std::string& scriptPath);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void rewind();
+    bool finished() const;
+    void deliverNext();
+    void armTimer();
+
+    std::vector<Transition> m_transitions;
+    std::size_t m_repeat;
+
+    // Replay position, only touched by whichever thread drives the source
+    std::size_t m_pass{0};
+    std::size_t m_index{0};
+    Clock::time_point m_deadline;
+    Clock::time_point m_previousDone;
+    Clock::time_point m_firstDeadline;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    Stats m_stats;
+
+    int m_timerFd{-1};
+    std::shared_ptr<std::thread> m_th;
+};
+
+}
+
+#endif //GWIDI_INPUTSERVER_SCRIPTEDFOCUSSOURCE_H
@@ -12,9 +12,9 @@ if(NOT TARGET gwidi_socketserver)
 endif()
 
 add_library(linux_inputreader)
-target_sources(linux_inputreader PUBLIC ${CMAKE_CURRENT_LIST_DIR}/LinuxInputReader.cc)
-target_link_libraries(linux_inputreader PUBLIC spdlog::spdlog ${gwidi_socketserver_LIBRARIES} ${X11_LIBRARIES})
-target_include_directories(linux_inputreader PUBLIC ${CMAKE_CURRENT_LIST_DIR}/include)
+target_sources(linux_inputreader PUBLIC ${CMAKE_CURRENT_LIST_DIR}/LinuxInputReader.cc ${CMAKE_CURRENT_LIST_DIR}/ScriptedFocusSource.cc ${CMAKE_CURRENT_LIST_DIR}/AxisShaper.cc ${CMAKE_CURRENT_LIST_DIR}/DiscoveryCache.cc)
+target_link_libraries(linux_inputreader PUBLIC spdlog::spdlog ${gwidi_socketserver_LIBRARIES} ${X11_xcb_LIB})
+target_include_directories(linux_inputreader PUBLIC ${CMAKE_CURRENT_LIST_DIR}/include ${X11_xcb_INCLUDE_PATH})
 
 set(linux_inputreader_INCLUDE_DIRS ${CMAKE_CURRENT_LIST_DIR}/include)
 set(linux_inputreader_LIBRARIES linux_inputreader)
@@ -0,0 +1,30 @@
+#include "ScriptedFocusSource.h"
+#include <spdlog/spdlog.h>
+#include <cstdlib>
+
+// Measures focus-event latency (scheduled deadline -> callback returned) and throughput without a display
+int main(int argc, char** argv) {
+    std::size_t transitions = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+
+    std::vector<gwidi::input::ScriptedFocusSource::Transition> script {
+            {std::chrono::milliseconds{0}, true, {}},
+            {std::chrono::milliseconds{0}, false, {}},
+    };
+
+    std::size_t gained = 0, lost = 0;
+    gwidi::input::ScriptedFocusSource source{script, transitions / 2};
+    source.setGainFocusCb([&gained]() { gained++; });
+    source.setLoseFocusCb([&lost]() { lost++; });
+    source.beginListening();
+    source.waitFinished();
+
+    auto stats = source.stats();
+    auto seconds = std::chrono::duration<double>(stats.elapsed).count();
+    spdlog::info("{} transitions ({} gained, {} lost) in {:.3f}s, {:.0f}/s", stats.transitions, gained, lost, seconds,
+                 seconds > 0 ? stats.transitions / seconds : 0.0);
+    if(stats.transitions > 0) {
+        spdlog::info("latency avg: {}ns, max: {}ns", stats.totalLatency.count() / stats.transitions, stats.maxLatency.count());
+    }
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include "KeyPipeline.h"
+#include <spdlog/spdlog.h>
+#include <linux/input-event-codes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdlib>
+
+// Per-event cost of the reader's key path: the type-erased callback (a std::function calling through two more, like
+// the server's key path used to) against a KeyPipeline the compiler can inline. Events are fed through a pipe, so the
+// reader's real read loop is measured, then the sinks are called on their own without any I/O.
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+std::vector<input_event> makeFrames() {
+    // Watched and unwatched presses and releases, each followed by its SYN_REPORT like a real keyboard
+    std::vector<input_event> events;
+    for(auto code : {KEY_Q, KEY_W, KEY_Q, KEY_E}) {
+        for(auto value : {1, 0}) {
+            input_event ev{};
+            ev.type = EV_KEY;
+            ev.code = code;
+            ev.value = value;
+            events.push_back(ev);
+            ev.type = EV_SYN;
+            ev.code = SYN_REPORT;
+            ev.value = 0;
+            events.push_back(ev);
+        }
+    }
+    return events;
+}
+
+template<typename Drain>
+double readLoopNsPerEvent(Drain drain, std::size_t events) {
+    int fds[2];
+    if(pipe2(fds, O_NONBLOCK) != 0) {
+        return 0;
+    }
+    fcntl(fds[1], F_SETPIPE_SZ, 1 << 20);
+
+    // Writes stay below PIPE_BUF so every one lands whole and reads never split an event
+    auto frames = makeFrames();
+    std::vector<input_event> chunk;
+    while(chunk.size() + frames.size() <= 4096 / sizeof(input_event)) {
+        chunk.insert(chunk.end(), frames.begin(), frames.end());
+    }
+
+    std::size_t done = 0;
+    Clock::duration elapsed{};
+    while(done < events) {
+        std::size_t queued = 0;
+        while(write(fds[1], chunk.data(), chunk.size() * sizeof(input_event)) > 0) {
+            queued += chunk.size();
+        }
+        auto start = Clock::now();
+        drain(fds[0]);
+        elapsed += Clock::now() - start;
+        done += queued;
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    return std::chrono::duration<double, std::nano>(elapsed).count() / done;
+}
+
+template<typename Sink>
+double dispatchNsPerKey(Sink& sink, std::size_t keys) {
+    // Pinned once like handleReadable() does, so snapshot reads cost what they do in the read loop
+    gwidi::SnapshotPin pin;
+    auto start = Clock::now();
+    for(std::size_t i = 0; i < keys; i++) {
+        sink(i & 1 ? KEY_Q : KEY_W, static_cast<int>(i & 2) >> 1);
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / keys;
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::size_t events = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000000;
+
+    gwidi::input::LinuxInputReader reader;
+    reader.setWatchedKeys({KEY_Q, KEY_W});
+
+    gwidi::SnapshotStore<gwidi::input::KeyFilter> forwarded{gwidi::input::KeyFilter::of({KEY_Q})};
+    volatile std::size_t delivered = 0;
+
+    // The old shape: reader callback -> server handler -> user callback, each a std::function
+    std::function<void(int, int)> userCb = [&delivered](int, int) { delivered = delivered + 1; };
+    std::function<bool(int, int)> serverCb = [&forwarded, &userCb](int code, int value) {
+        if(!forwarded.current()->value.allows(code)) {
+            return false;
+        }
+        userCb(code, value);
+        return true;
+    };
+    reader.setWatchedKeyCb(serverCb);
+
+    auto countStage = [&delivered](int, int) {
+        delivered = delivered + 1;
+        return gwidi::input::StageResult::PASS;
+    };
+    gwidi::input::KeyPipeline<gwidi::input::KeyFilterStage, decltype(countStage)> pipeline{
+            gwidi::input::KeyFilterStage{&forwarded}, countStage};
+
+    auto callbackRead = readLoopNsPerEvent([&reader](int fd) { reader.handleReadable(fd); }, events);
+    auto pipelineRead = readLoopNsPerEvent([&reader, &pipeline](int fd) { reader.handleReadable(fd, pipeline); }, events);
+    spdlog::info("read loop, {} events: callback {:.1f}ns/event, pipeline {:.1f}ns/event", events, callbackRead, pipelineRead);
+
+    // What handleReadable(fd) wraps the stored callback in
+    auto storedCallback = [&serverCb](int code, int value) { return serverCb && serverCb(code, value); };
+    auto callbackDispatch = dispatchNsPerKey(storedCallback, events);
+    auto pipelineDispatch = dispatchNsPerKey(pipeline, events);
+    spdlog::info("dispatch only, {} keys: callback {:.2f}ns/key, pipeline {:.2f}ns/key", events, callbackDispatch, pipelineDispatch);
+    spdlog::info("{} keys delivered", static_cast<std::size_t>(delivered));
+
+    return 0;
+}
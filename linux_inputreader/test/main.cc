@@ -27,7 +27,7 @@ int main() {
     server.setWatchedKeys({KEY_Q});
     server.setWatchedKeyCb([&socketServer](int code, int value){
         socketServer.sendKeyEvent(gwidi::udpsocket::KeyEvent{code, value});
-
+        return true;
     });
     server.beginListening();
 
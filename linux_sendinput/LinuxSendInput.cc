@@ -1,8 +1,11 @@
 #include "LinuxSendInput.h"
+#include "GwidiProbes.h"
 #include <iostream>
 #include <fcntl.h>
 #include <unistd.h>
+#include <cstdio>
 #include <cstring>
+#include <string>
 #include <unordered_map>
 
 std::unordered_map<std::string, int> SendInput::hk_map {
@@ -18,6 +21,9 @@ std::unordered_map<std::string, int> SendInput::hk_map {
         {"9", KEY_9}, // octave down
 };
 
+std::atomic<std::uint64_t> SendInput::m_writeCount{0};
+std::atomic<std::uint64_t> SendInput::m_errorCount{0};
+
 SendInput::SendInput() : SendInput(BUS_USB, 0x1234, 0x5678, "Gwidi Device") {
 }
 
@@ -32,7 +38,38 @@ SendInput::SendInput(__u16 busType, __u16 vendor, __u16 product, const char* dev
     setupInputDevice();
 }
 
+SendInput::SendInput(NullSinkTag) : m_nullSink{true} {
+    input_fd = open("/dev/null", O_WRONLY);
+}
+
+std::unique_ptr<SendInput> SendInput::nullSink() {
+    return std::unique_ptr<SendInput>(new SendInput(NullSinkTag{}));
+}
+
+SendInput::SendInput(CloneTag, int sourceFd) {
+    input_fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if(input_fd >= 0 && !setupCloneDevice(sourceFd)) {
+        close(input_fd);
+        input_fd = -1;
+    }
+}
+
+std::unique_ptr<SendInput> SendInput::cloneOf(int sourceFd) {
+    auto clone = std::unique_ptr<SendInput>(new SendInput(CloneTag{}, sourceFd));
+    if(clone->input_fd < 0) {
+        clone->m_nullSink = true;   // nothing to tear down
+        return nullptr;
+    }
+    return clone;
+}
+
 SendInput::~SendInput() {
+    if(m_nullSink) {
+        if(input_fd >= 0) {
+            close(input_fd);
+        }
+        return;
+    }
     teardownInputDevice();
 }
 
@@ -48,6 +85,31 @@ void SendInput::sendInput(const std::string &key) {
     emit(input_fd, EV_SYN, SYN_REPORT, 0);
 }
 
+void SendInput::sendKey(int code, int value) {
+    struct input_event frame[2]{};
+    frame[0].type = EV_KEY;
+    frame[0].code = code;
+    frame[0].value = value;
+    frame[1].type = EV_SYN;
+    frame[1].code = SYN_REPORT;
+    emitFrame(frame, 2);
+}
+
+void SendInput::tapKey(int code) {
+    struct input_event frame[4]{};
+    frame[0].type = EV_KEY;
+    frame[0].code = code;
+    frame[0].value = 1;
+    frame[1].type = EV_SYN;
+    frame[1].code = SYN_REPORT;
+    frame[2].type = EV_KEY;
+    frame[2].code = code;
+    frame[2].value = 0;
+    frame[3].type = EV_SYN;
+    frame[3].code = SYN_REPORT;
+    emitFrame(frame, 4);
+}
+
 int SendInput::keyToHk(const std::string& key) {
     auto it = hk_map.find(key);
     if(it == hk_map.end()) {
@@ -66,17 +128,44 @@ void SendInput::emit(int fd, int type, int code, int val) {
     ie.time.tv_sec = 0;
     ie.time.tv_usec = 0;
 
-    write(fd, &ie, sizeof(ie));
+    auto written = write(fd, &ie, sizeof(ie));
+    GWIDI_PROBE4(uinput_write, code, val, 1, written);
+    if(written == sizeof(ie)) {
+        m_writeCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    else {
+        m_errorCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void SendInput::emitFrame(const struct input_event *events, std::size_t count) {
+    auto size = static_cast<ssize_t>(sizeof(struct input_event) * count);
+    auto written = write(input_fd, events, size);
+    GWIDI_PROBE4(uinput_write, events[0].code, events[0].value, count, written);
+    if(written == size) {
+        m_writeCount.fetch_add(count, std::memory_order_relaxed);
+    }
+    else {
+        m_errorCount.fetch_add(count, std::memory_order_relaxed);
+    }
+}
+
+std::uint64_t SendInput::writeCount() {
+    return m_writeCount.load(std::memory_order_relaxed);
+}
+
+std::uint64_t SendInput::errorCount() {
+    return m_errorCount.load(std::memory_order_relaxed);
 }
 
 void SendInput::setupInputDevice() {
     /*
      * The ioctls below will enable the device that is about to be
-     * created, to pass key events, in this case all keys in the map
+     * created, to pass key events, in this case every key code the reader forwards (macros can inject any of them)
      */
     ioctl(input_fd, UI_SET_EVBIT, EV_KEY);
-    for(auto &hk_entry : hk_map) {
-        ioctl(input_fd, UI_SET_KEYBIT, hk_entry.second);
+    for(auto code = KEY_ESC; code < 0x100; code++) {
+        ioctl(input_fd, UI_SET_KEYBIT, code);
     }
 
     ioctl(input_fd, UI_DEV_SETUP, &usetup);
@@ -87,6 +176,57 @@ void SendInput::setupInputDevice() {
     sleep(1);
 }
 
+bool SendInput::setupCloneDevice(int sourceFd) {
+    // Only read as much of the source's name as still fits behind the prefix
+    char name[UINPUT_MAX_NAME_SIZE - std::char_traits<char>::length(CLONE_NAME_PREFIX)]{};
+    ioctl(sourceFd, EVIOCGNAME(sizeof(name)), name);
+    snprintf(usetup.name, sizeof(usetup.name), "%s%s", CLONE_NAME_PREFIX, name);
+    ioctl(sourceFd, EVIOCGID, &usetup.id);
+
+    unsigned long evBits[EV_MAX / (8 * sizeof(unsigned long)) + 1]{};
+    ioctl(sourceFd, EVIOCGBIT(0, sizeof(evBits)), evBits);
+    auto testBit = [](const unsigned long* bits, int bit) {
+        return (bits[bit / (8 * sizeof(unsigned long))] >> (bit % (8 * sizeof(unsigned long)))) & 1;
+    };
+
+    // Copy every code of every event type the source reports, with the ioctl that enables it on our side
+    const struct {
+        int type;
+        int max;
+        unsigned long setBit;
+    } codeTypes[] = {
+            {EV_KEY, KEY_MAX, UI_SET_KEYBIT},
+            {EV_REL, REL_MAX, UI_SET_RELBIT},
+            {EV_ABS, ABS_MAX, UI_SET_ABSBIT},
+            {EV_MSC, MSC_MAX, UI_SET_MSCBIT},
+            {EV_LED, LED_MAX, UI_SET_LEDBIT},
+            {EV_SW, SW_MAX, UI_SET_SWBIT},
+    };
+    unsigned long codeBits[KEY_MAX / (8 * sizeof(unsigned long)) + 1];
+    for(auto &codeType : codeTypes) {
+        if(!testBit(evBits, codeType.type)) {
+            continue;
+        }
+        memset(codeBits, 0, sizeof(codeBits));
+        ioctl(sourceFd, EVIOCGBIT(codeType.type, sizeof(codeBits)), codeBits);
+        ioctl(input_fd, UI_SET_EVBIT, codeType.type);
+        for(auto code = 0; code <= codeType.max; code++) {
+            if(!testBit(codeBits, code)) {
+                continue;
+            }
+            ioctl(input_fd, codeType.setBit, code);
+            if(codeType.type == EV_ABS) {
+                struct uinput_abs_setup abs{};
+                abs.code = code;
+                ioctl(sourceFd, EVIOCGABS(code), &abs.absinfo);
+                ioctl(input_fd, UI_ABS_SETUP, &abs);
+            }
+        }
+    }
+
+    return ioctl(input_fd, UI_DEV_SETUP, &usetup) == 0 && ioctl(input_fd, UI_DEV_CREATE) == 0;
+}
+
 void SendInput::teardownInputDevice() {
     /*
      * Give userspace some time to read the events before we destroy the
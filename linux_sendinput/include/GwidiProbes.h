@@ -0,0 +1,49 @@
+#ifndef GWIDI_INPUTSERVER_GWIDIPROBES_H
+#define GWIDI_INPUTSERVER_GWIDIPROBES_H
+
+// USDT probes (provider "gwidi") along the key path, for perf / bpftrace / systemtap. Configure with -DGWIDI_USDT=ON
+// to compile them in: each one is a single nop plus an ELF note, arguments are only read once a tracer attaches.
+// Without it they compile to nothing. Sample scripts are in scripts/bpftrace.
+//
+//   evdev_read(fd, type, code, value, event_time_us)   every input_event read, with the kernel's timestamp
+//   key_watched(code, value)                           watched key handed to the server
+//   key_filter(code, value, verdict)                   forwarding decision, see ProbeVerdict
+//   encode(msg_type, code, size)                       key event serialized for the client (EVENT_AXIS: event count)
+//   send(buffer, size, result)                         sendto() of any datagram to the client, the type is the first int
+//   recv(size)                                         datagram received from a client
+//   dispatch(msg_type, size)                           processEvent() about to handle it
+//   uinput_write(code, value, events, result)          write() of a frame (or single event) to uinput
+//   passthrough(events, latency_us, code)              frame re-emitted for a grabbed keyboard, kernel timestamp to
+//                                                      written, code of its first event
+//
+// Lives with the lowest layer that fires them, everything above gets it through linux_sendinput's include path.
+
+#ifdef GWIDI_USDT
+#include <sys/sdt.h>
+
+#define GWIDI_PROBE1(name, a) DTRACE_PROBE1(gwidi, name, a)
+#define GWIDI_PROBE2(name, a, b) DTRACE_PROBE2(gwidi, name, a, b)
+#define GWIDI_PROBE3(name, a, b, c) DTRACE_PROBE3(gwidi, name, a, b, c)
+#define GWIDI_PROBE4(name, a, b, c, d) DTRACE_PROBE4(gwidi, name, a, b, c, d)
+#define GWIDI_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(gwidi, name, a, b, c, d, e)
+#else
+// sizeof keeps the arguments referenced without evaluating them, so nothing is left unused and nothing runs
+#define GWIDI_PROBE1(name, a) do { (void)sizeof(a); } while(0)
+#define GWIDI_PROBE2(name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while(0)
+#define GWIDI_PROBE3(name, a, b, c) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while(0)
+#define GWIDI_PROBE4(name, a, b, c, d) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); (void)sizeof(d); } while(0)
+#define GWIDI_PROBE5(name, a, b, c, d, e) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); (void)sizeof(d); (void)sizeof(e); } while(0)
+#endif
+
+namespace gwidi {
+
+enum ProbeVerdict {
+    PROBE_FORWARDED = 0,
+    PROBE_GATED = 1,        // focus gating and the watched window isn't focused
+    PROBE_CONSUMED = 2,     // a macro swallowed it
+    PROBE_FILTERED = 3      // only read as a macro trigger, the client didn't ask for it
+};
+
+}
+
+#endif //GWIDI_INPUTSERVER_GWIDIPROBES_H
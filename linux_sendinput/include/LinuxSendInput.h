@@ -1,6 +1,9 @@
 #ifndef EVDEV_TEST_LINUXSENDINPUT_H
 #define EVDEV_TEST_LINUXSENDINPUT_H
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <unordered_map>
 #include <string>
 #include <linux/uinput.h>
@@ -11,16 +14,51 @@ public:
     SendInput();
     SendInput(__u16 busType, __u16 vendor, __u16 product, const char* deviceName);
     ~SendInput();
+
+    // Writes to /dev/null instead of a uinput device: no root, no settle delay, counters and probes still apply.
+    // For load tests and machines without /dev/uinput.
+    static std::unique_ptr<SendInput> nullSink();
+
+    // A uinput device with the same name prefix-tagged, ids and capabilities (keys, axes, leds, ...) as the evdev device
+    // open on `sourceFd`, minus EV_REP: the source's own repeats are re-emitted instead. Returns nullptr if uinput is
+    // unavailable. Created without the settle delay, the caller grabs the source right after.
+    static std::unique_ptr<SendInput> cloneOf(int sourceFd);
+    static constexpr const char* CLONE_NAME_PREFIX = "gwidi passthrough: ";
+
     void sendInput(const std::string& key);
+
+    // Each call is a single write() carrying the key change(s) and their SYN_REPORT, so the frame reaches the kernel
+    // in one syscall and cannot interleave with another thread's frame
+    void sendKey(int code, int value);
+    void tapKey(int code);
+
+    // Writes events as they are, SYN_REPORT included, in a single write()
+    inline void sendFrame(const struct input_event* events, std::size_t count) {
+        emitFrame(events, count);
+    }
+
+    // Process-wide totals across every SendInput instance
+    static std::uint64_t writeCount();
+    static std::uint64_t errorCount();
 private:
+    struct NullSinkTag {};
+    explicit SendInput(NullSinkTag);
+    struct CloneTag {};
+    SendInput(CloneTag, int sourceFd);
+
     static std::unordered_map<std::string, int> hk_map;
+    static std::atomic<std::uint64_t> m_writeCount;
+    static std::atomic<std::uint64_t> m_errorCount;
     void emit(int fd, int type, int code, int val);
+    void emitFrame(const struct input_event* events, std::size_t count);
     static int keyToHk(const std::string& key);
 
     void setupInputDevice();
+    bool setupCloneDevice(int sourceFd);
     void teardownInputDevice();
 
     int input_fd{-1};
+    bool m_nullSink{false};
     struct uinput_setup usetup{};
 };
 
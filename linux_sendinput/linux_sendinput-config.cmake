@@ -2,6 +2,16 @@ add_library(linux_sendinput)
 target_sources(linux_sendinput PUBLIC ${CMAKE_CURRENT_LIST_DIR}/LinuxSendInput.cc)
 target_include_directories(linux_sendinput PUBLIC ${CMAKE_CURRENT_LIST_DIR}/include)
 
+# USDT probes (GwidiProbes.h) for perf / bpftrace, needs sys/sdt.h from the systemtap sdt headers
+if(GWIDI_USDT)
+    include(CheckIncludeFileCXX)
+    check_include_file_cxx(sys/sdt.h GWIDI_HAVE_SDT_H)
+    if(NOT GWIDI_HAVE_SDT_H)
+        message(FATAL_ERROR "GWIDI_USDT needs sys/sdt.h (systemtap-sdt-dev / systemtap-sdt-devel)")
+    endif()
+    target_compile_definitions(linux_sendinput PUBLIC GWIDI_USDT)
+endif()
+
 set(linux_sendinput_INCLUDE_DIRS ${CMAKE_CURRENT_LIST_DIR}/include)
 set(linux_sendinput_LIBRARIES linux_sendinput)
 
@@ -1,44 +1,176 @@
 #include "GwidiServer.h"
+#include "ScriptedFocusSource.h"
 #include <linux/input-event-codes.h>
-#include <spdlog/spdlog.h>
+#include "GwidiLogging.h"
+#include <cstring>
+#include <sstream>
+
+int main(int argc, char** argv) {
+    gwidi::logging::initAsyncLogging();
 
-int main() {
     std::unique_ptr<gwidi::server::GwidiServer> gwidiServer;
-    std::string windowName = "Guild Wars 2";
-
-    gwidi::server::Configuration cfg {
-        [&gwidiServer, &windowName](){
-            spdlog::info("Focus gained!");
-            auto socketServer = gwidiServer->socketServer();
-            if(socketServer) {
-                socketServer->sendWindowFocusEvent(windowName, true);
+
+    // Focus events go out per profile, see profileFocusCb below. Watched keys are sent by the server itself, see
+    // sendKeyEvents below; everything not set here keeps its default.
+    gwidi::server::Configuration cfg;
+    cfg.gainFocusCb = [](){
+        spdlog::info("Focus gained!");
+    };
+    cfg.loseFocusCb = [](){
+        spdlog::info("Focus lost!");
+    };
+    cfg.watchedWindowName = "Guild Wars 2";
+    cfg.watchedKeys = {KEY_Q};
+
+    // --reactor serves every fd from a single epoll thread instead of one thread per subsystem
+    // --metrics <path> serves Prometheus text on a Unix socket
+    // --discovery-cache <path> remembers the input devices and matched window there for a faster next start
+    // --reliable sequences key events and retransmits them until the client acks
+    // --bind <addr>, --port <port> and --client-port <port> move the server off 127.0.0.1:5577 / 5578
+    // --listeners <n> spreads inbound datagrams over n SO_REUSEPORT sockets, each with its own thread
+    // --axes forwards gamepad / mouse axes (EV_ABS, EV_REL), each axis at most every 8ms
+    // --grab takes the keyboards exclusively: watched keys only reach the client, the rest passes through uinput
+    // --null-sendinput injects into /dev/null instead of uinput (load tests, see gwidi_loadgen)
+    // --window <name>, --window-class <class>, --keys <code,code,...> and --focus-gating set the initial
+    // configuration, clients can change all of them later with EVENT_RECONFIGURE
+    // --profile <name>:<window name>:<code,code,...> adds a named profile, clients subscribe to it in their hello
+    // --repeat <all|throttled|held>[:ms] forwards autorepeat of every watched key, throttled / held at most every ms
+    for(auto i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--reactor") == 0) {
+            cfg.threadingMode = gwidi::server::ThreadingMode::Reactor;
+        }
+        else if(strcmp(argv[i], "--focus-gating") == 0) {
+            cfg.focusGating = true;
+        }
+        else if(strcmp(argv[i], "--reliable") == 0) {
+            cfg.reliableKeyEvents = true;
+        }
+        else if(strcmp(argv[i], "--bind") == 0 && i + 1 < argc) {
+            cfg.listen.bindAddress = argv[++i];
+        }
+        else if(strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            cfg.listen.port = std::stoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--client-port") == 0 && i + 1 < argc) {
+            cfg.listen.clientPort = std::stoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--listeners") == 0 && i + 1 < argc) {
+            cfg.listen.listenerShards = std::stoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--axes") == 0) {
+            cfg.axes.enabled = true;
+            cfg.axes.rules = {
+                    {EV_ABS, -1, 0, 0, 1, 8},
+                    {EV_REL, -1, 0, 0, 1, 8}
+            };
+        }
+        else if(strcmp(argv[i], "--grab") == 0) {
+            cfg.exclusiveGrab = true;
+        }
+        else if(strcmp(argv[i], "--null-sendinput") == 0) {
+            cfg.nullSendInput = true;
+        }
+        else if(strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            cfg.watchedWindowName = argv[++i];
+        }
+        else if(strcmp(argv[i], "--window-class") == 0 && i + 1 < argc) {
+            cfg.watchedWindowClass = argv[++i];
+        }
+        else if(strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+            cfg.watchedKeys.clear();
+            std::stringstream keys{argv[++i]};
+            std::string key;
+            while(std::getline(keys, key, ',')) {
+                cfg.watchedKeys.emplace_back(std::stoi(key));
             }
-        },
-        [&gwidiServer, &windowName](){
-            spdlog::info("Focus lost!");
-            auto socketServer = gwidiServer->socketServer();
-            if(socketServer) {
-                socketServer->sendWindowFocusEvent(windowName, false);
+        }
+        else if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            gwidi::udpsocket::Profile profile;
+            std::stringstream fields{argv[++i]};
+            std::getline(fields, profile.name, ':');
+            std::getline(fields, profile.windowName, ':');
+            std::string key;
+            while(std::getline(fields, key, ',')) {
+                profile.watchedKeys.emplace_back(std::stoi(key));
             }
-        },
-        [&gwidiServer](int code, int type) {
-            spdlog::info("Key {}, type: {} detected", code, type);
-            auto socketServer = gwidiServer->socketServer();
-            if(socketServer) {
-                socketServer->sendKeyEvent(gwidi::udpsocket::KeyEvent{code, type});
+            cfg.profiles.emplace_back(std::move(profile));
+        }
+        else if(strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            std::stringstream fields{argv[++i]};
+            std::string mode;
+            std::string intervalMs;
+            std::getline(fields, mode, ':');
+            std::getline(fields, intervalMs);
+            gwidi::udpsocket::RepeatRule rule{-1, gwidi::udpsocket::REPEAT_ALL, 0};
+            if(mode == "throttled") {
+                rule.mode = gwidi::udpsocket::REPEAT_THROTTLED;
             }
-        },
-        windowName,
-        {KEY_Q} // TODO: This needs to be something passed when the server is started
-        // TODO: We won't always know when starting the server, build a message from client -> server that reconfigures the watched keys
+            else if(mode == "held") {
+                rule.mode = gwidi::udpsocket::REPEAT_HELD;
+            }
+            if(!intervalMs.empty()) {
+                rule.intervalMs = std::stoul(intervalMs);
+            }
+            cfg.repeats = {rule};
+        }
+        else if(strcmp(argv[i], "--discovery-cache") == 0 && i + 1 < argc) {
+            cfg.discoveryCachePath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            cfg.metricsSocketPath = argv[++i];
+        }
+    }
+
+    cfg.sendKeyEvents = true;
+    cfg.axisCb = [&gwidiServer](const std::vector<gwidi::udpsocket::AxisEvent> &events) {
+        auto socketServer = gwidiServer->socketServer();
+        if(socketServer) {
+            socketServer->sendAxisEvents(events, gwidiServer->activeProfile());
+        }
+    };
+
+    // Windows can be retargeted at runtime, always report the one in the current configuration
+    cfg.profileFocusCb = [&gwidiServer](int profile, bool hasFocus) {
+        auto socketServer = gwidiServer->socketServer();
+        auto snapshot = gwidiServer->configuration();
+        auto &current = snapshot->value;
+        if(!socketServer || profile > static_cast<int>(current.profiles.size())) {
+            return;
+        }
+        auto &windowName = profile == 0 ? current.watchedWindowName : current.profiles[profile - 1].windowName;
+        socketServer->sendWindowFocusEvent(windowName, hasFocus, profile);
+    };
+
+    cfg.readyCb = []() {
+        spdlog::info("Forwarding keys");
     };
 
     gwidiServer = std::make_unique<gwidi::server::GwidiServer>(cfg);
+
+    // --trace <path> records a compact binary event trace instead of relying on per-event text logs
+    std::string tracePath;
+    for(auto i = 1; i + 1 < argc; i++) {
+        if(strcmp(argv[i], "--trace") == 0) {
+            tracePath = argv[i + 1];
+            gwidi::logging::EventTrace::instance().enable();
+        }
+    }
+
+    // --focus-script <path> replays focus transitions from a file instead of watching X (headless / load tests)
+    for(auto i = 1; i + 1 < argc; i++) {
+        if(strcmp(argv[i], "--focus-script") == 0) {
+            gwidiServer->setFocusSource(std::make_unique<gwidi::input::ScriptedFocusSource>(argv[i + 1]));
+        }
+    }
     gwidiServer->start();
 
     while(gwidiServer->isAlive()) {
         std::this_thread::sleep_for(std::chrono::seconds(2));
     }
 
+    if(!tracePath.empty()) {
+        gwidi::logging::EventTrace::instance().dump(tracePath);
+    }
+
     return 0;
 }